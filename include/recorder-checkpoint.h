@@ -0,0 +1,24 @@
+#ifndef _RECORDER_CHECKPOINT_H_
+#define _RECORDER_CHECKPOINT_H_
+#include "recorder.h"
+
+/*
+ * Periodic local checkpoints (RECORDER_CHECKPOINT_INTERVAL)
+ *
+ * Every RECORDER_CHECKPOINT_INTERVAL seconds, and when SIGTERM or
+ * SIGUSR1 is received, each process flushes its timestamps and appends
+ * the new CST entries and a snapshot of its grammar to <rank>.ckpt.
+ * If the job fails before finalize, the reader recovers the trace
+ * from the last complete checkpoint.
+ *
+ * Checkpoints are written with write() from a static buffer without
+ * allocating memory. The signal handlers only wake up a watcher thread,
+ * which takes the checkpoint once the logger is not being updated.
+ */
+void checkpoint_init(RecorderLogger* logger);
+bool checkpoint_enabled();
+void checkpoint_progress(RecorderLogger* logger, double now);
+void checkpoint_new_segment(RecorderLogger* logger);
+void checkpoint_finalize(RecorderLogger* logger);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _RECORDER_EPOCH_H_
+#define _RECORDER_EPOCH_H_
+#include "recorder.h"
+
+/*
+ * Epoch-based inter-process compression (RECORDER_EPOCH_INTERVAL)
+ *
+ * Every RECORDER_EPOCH_INTERVAL seconds, or at MPI_Pcontrol() calls,
+ * processes merge the call signatures discovered since the last epoch
+ * using nonblocking collectives on a duplicated communicator.
+ * All processes assign the same global terminal id to each signature,
+ * so at finalize only the signatures of the last epoch need to be merged.
+ *
+ * After each epoch, the merged CST (0.cst), per-process grammars
+ * (<rank>.cfg) and timestamps on disk form a readable trace.
+ */
+void epoch_init(RecorderLogger* logger);
+bool epoch_enabled();
+void epoch_progress(RecorderLogger* logger, double now);
+void epoch_trigger(RecorderLogger* logger);
+void epoch_finalize(RecorderLogger* logger);
+
+#endif
@@ -117,6 +117,40 @@ typedef struct CallSignature_t {
 } CallSignature;
 
 
+/*
+ * Checkpoint file (<rank>.ckpt), a sequence of frames:
+ * | CheckpointFrame | payload (size bytes) | uint32_t checksum of payload |
+ *
+ * CKPT_CST:     new CST entries, each is
+ *               | terminal_id | rank | key_len | key |
+ * CKPT_GRAMMAR: the serialized grammar, same as the .cfg file
+ * CKPT_COMMIT:  | int64_t timestamps (uint32_t) written so far | int segment |
+ *               marks a consistent state of all frames before it,
+ *               segment is the number of segments saved before
+ */
+#define CKPT_MAGIC      0x504b4352
+#define CKPT_CST        1
+#define CKPT_GRAMMAR    2
+#define CKPT_COMMIT     3
+
+typedef struct CheckpointFrame_t {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t size;
+} CheckpointFrame;
+
+/* FNV-1a, used for checkpoint frames */
+static inline uint32_t ckpt_checksum(uint32_t h, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*) data;
+    for(size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+#define CKPT_CHECKSUM_INIT  2166136261u
+
+
 typedef struct RecorderMetadata_t {
     int    total_ranks;
     double start_ts;
@@ -156,6 +190,11 @@ typedef struct RecorderLogger_t {
     int       log_tid;          // Wether to store thread id
     int       log_level;        // Wether to store the level of the call
     int       interprocess_compression; // Wether to perform interprocess compression
+    int       node_helper;      // Wether to hand over records to the node leader
+
+    size_t    memory_budget;    // Start a new segment once exceeded, 0 means no limit
+    size_t    segment_base_usage;   // Memory usage when the current segment started
+    int       segment;          // Number of segments saved (<rank>.<segment>.cst/cfg)
 } RecorderLogger;
 
 
@@ -177,6 +216,9 @@ void free_record(Record *record);
 // TODO only used by ftrace logger
 // Need to see how to replace it
 void write_record(Record* record);
+void logger_append_record(RecorderLogger* lg, char* key, int key_len, double tstart, double tend);
+void logger_mark_epoch();
+void save_global_metadata();
 
 
 /* recorder-cst-cfg.c */
@@ -186,6 +228,7 @@ int  cs_key_length(Record* record);
 char* compose_cs_key(Record *record, int* key_len);
 Record* cs_to_record(CallSignature* cs);
 void cleanup_cst(CallSignature* cst);
+void* serialize_cst(CallSignature *cst, size_t *len);
 void save_cst_local(RecorderLogger* logger);
 void save_cst_merged(RecorderLogger* logger);
 void save_cfg_local(RecorderLogger* logger);
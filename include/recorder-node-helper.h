@@ -0,0 +1,22 @@
+#ifndef _RECORDER_NODE_HELPER_H_
+#define _RECORDER_NODE_HELPER_H_
+#include "recorder.h"
+
+/*
+ * Node-level helper (RECORDER_NODE_HELPER=1)
+ *
+ * Each process pushes its records (call signature key + timestamps)
+ * into a shared-memory ring. A helper thread on the node leader
+ * (the lowest rank of the node) drains all rings and maintains the
+ * CST/CFG/timestamps of every process of the node. At finalize, only
+ * the node leaders take part in the output (or inter-process compression).
+ *
+ * The output files are identical in format to the ones written without
+ * the helper, so no change is needed on the reader side.
+ */
+void node_helper_init(RecorderLogger* logger);
+bool node_helper_enabled();
+void node_helper_push(const char* key, int key_len, double tstart, double tend);
+void node_helper_finalize(RecorderLogger* logger);
+
+#endif
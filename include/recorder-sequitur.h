@@ -114,7 +114,6 @@ int digram_delete(Digram **digram_table, Symbol *symbol);
 /* recorder_sequitur_logger.c */
 int* serialize_grammar(Grammar *grammar, int *integers);
 double sequitur_dump(const char *path, Grammar *grammar, int mpi_rank, int mpi_size);
-void sequitur_save_unique_grammars(const char* path, Grammar* lg, int mpi_rank, int mpi_size);
 
 /* recorder_sequitur_utils.c */
 void  sequitur_print_rules(Grammar *grammar);
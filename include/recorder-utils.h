@@ -8,6 +8,8 @@ void utils_init();
 void utils_finalize();
 void* recorder_malloc(size_t size);
 void recorder_free(void* ptr, size_t size);
+size_t recorder_memory_usage();                 // bytes currently allocated by recorder_malloc()
+int recorder_log_offset();                      // if data records carry their file offset
 pthread_t recorder_gettid(void);
 long get_file_size(const char *filename);       // return the size of a file
 int accept_filename(const char *filename);      // if include the file in trace
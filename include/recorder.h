@@ -72,10 +72,16 @@
 #define RECORDER_TIME_RESOLUTION    		"RECORDER_TIME_RESOLUTION"
 #define RECORDER_LOG_POINTER        		"RECORDER_LOG_POINTER"
 #define RECORDER_LOG_TID            		"RECORDER_LOG_TID"
+#define RECORDER_LOG_OFFSET         		"RECORDER_LOG_OFFSET"
 #define RECORDER_INTERPROCESS_COMPRESSION	"RECORDER_INTERPROCESS_COMPRESSION"
 #define RECORDER_LOG_LEVEL          		"RECORDER_LOG_LEVEL"
 #define RECORDER_EXCLUSION_FILE     		"RECORDER_EXCLUSION_FILE"
 #define RECORDER_INCLUSION_FILE     		"RECORDER_INCLUSION_FILE"
+#define RECORDER_NODE_HELPER        		"RECORDER_NODE_HELPER"
+#define RECORDER_NODE_HELPER_BUFFER 		"RECORDER_NODE_HELPER_BUFFER"
+#define RECORDER_EPOCH_INTERVAL     		"RECORDER_EPOCH_INTERVAL"
+#define RECORDER_CHECKPOINT_INTERVAL		"RECORDER_CHECKPOINT_INTERVAL"
+#define RECORDER_MEMORY_BUDGET      		"RECORDER_MEMORY_BUDGET"
 
 
 
@@ -477,4 +483,19 @@ RECORDER_FORWARD_DECL(H5Pset_all_coll_metadata_ops, herr_t, (hid_t accpl_id, hbo
 RECORDER_FORWARD_DECL(H5Pget_all_coll_metadata_ops, herr_t, (hid_t accpl_id, hbool_t* is_collective));
 
 
+/*
+ * Inter-process compression helpers that work on a
+ * given communicator (they need mpi.h, so are not
+ * declared in recorder-logger.h and recorder-sequitur.h)
+ */
+/* recorder-cst-cfg.c */
+void merge_cst(CallSignature** dst, CallSignature* src);
+CallSignature* compress_csts(CallSignature* cst, MPI_Comm comm);
+CallSignature* bcast_merged_cst(CallSignature* compressed_cst, const char* path, MPI_Comm comm);
+void update_cfg_terminals(RecorderLogger* logger, CallSignature* merged_cst);
+/* recorder-sequitur-logger.c */
+void sequitur_save_unique_grammars(const char* path, Grammar** grammars, int* ranks, int num_grammars,
+                                   int total_ranks, MPI_Comm comm);
+
+
 #endif /* __RECORDER_H */
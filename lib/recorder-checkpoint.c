@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <errno.h>
+#include "recorder.h"
+#include "recorder-checkpoint.h"
+
+#define CKPT_BUFFER_SIZE    (64*1024)
+
+extern pthread_mutex_t g_mutex;
+
+typedef struct CheckpointState_t {
+    bool            enabled;
+    int             fd;
+    double          interval;           // in seconds
+    double          last_checkpoint;
+    int             written_terminals;  // CST entries [0, written_terminals) are in the file
+    RecorderLogger* logger;
+
+    // The signal handler only wakes up the watcher thread,
+    // which takes the checkpoint outside of the signal context
+    volatile sig_atomic_t pending_sigterm;
+    sem_t           signal_sem;
+    pthread_t       watcher;
+    bool            sigterm_handler;    // whether we installed the handler
+    bool            sigusr1_handler;
+
+    // Output buffer of the current frame
+    char            buf[CKPT_BUFFER_SIZE];
+    size_t          buf_len;
+    uint32_t        checksum;
+} CheckpointState;
+
+static CheckpointState ckpt = { .enabled = false };
+
+
+static void ckpt_flush_buffer() {
+    size_t written = 0;
+    while(written < ckpt.buf_len) {
+        ssize_t ret = RECORDER_REAL_CALL(write) (ckpt.fd, ckpt.buf+written, ckpt.buf_len-written);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            break;
+        written += ret;
+    }
+    ckpt.buf_len = 0;
+}
+
+static void ckpt_write(const void* data, size_t len, bool payload) {
+    if(payload)
+        ckpt.checksum = ckpt_checksum(ckpt.checksum, data, len);
+
+    const char* ptr = data;
+    while(len > 0) {
+        size_t n = CKPT_BUFFER_SIZE - ckpt.buf_len;
+        if(n > len) n = len;
+        memcpy(ckpt.buf+ckpt.buf_len, ptr, n);
+        ckpt.buf_len += n;
+        ptr += n;
+        len -= n;
+        if(ckpt.buf_len == CKPT_BUFFER_SIZE)
+            ckpt_flush_buffer();
+    }
+}
+
+static void ckpt_begin_frame(uint32_t type, uint32_t size) {
+    CheckpointFrame frame = { .magic = CKPT_MAGIC, .type = type, .size = size };
+    ckpt_write(&frame, sizeof(frame), false);
+    ckpt.checksum = CKPT_CHECKSUM_INIT;
+}
+
+static void ckpt_end_frame() {
+    uint32_t checksum = ckpt.checksum;
+    ckpt_write(&checksum, sizeof(checksum), false);
+}
+
+static void ckpt_write_int(int val) {
+    ckpt_write(&val, sizeof(int), true);
+}
+
+/*
+ * Append a checkpoint: new CST entries, grammar and a commit.
+ * Does not allocate memory, caller needs to hold g_mutex.
+ */
+static void checkpoint_write(RecorderLogger* logger) {
+    // 1. Timestamps first, so the grammar never
+    // describes more records than the .ts file has
+    if(logger->ts_index > 0)
+        RECORDER_REAL_CALL(fwrite)(logger->ts, sizeof(uint32_t), logger->ts_index, logger->ts_file);
+    logger->ts_index = 0;
+    RECORDER_REAL_CALL(fflush)(logger->ts_file);
+    int64_t ts_elements = RECORDER_REAL_CALL(ftell)(logger->ts_file) / sizeof(uint32_t);
+
+    // 2. CST entries added since the last checkpoint
+    CallSignature *entry, *tmp;
+    uint32_t size = 0;
+    HASH_ITER(hh, logger->cst, entry, tmp) {
+        if(entry->terminal_id >= ckpt.written_terminals)
+            size += 3*sizeof(int) + entry->key_len;
+    }
+    if(size > 0) {
+        ckpt_begin_frame(CKPT_CST, size);
+        HASH_ITER(hh, logger->cst, entry, tmp) {
+            if(entry->terminal_id < ckpt.written_terminals)
+                continue;
+            ckpt_write_int(entry->terminal_id);
+            ckpt_write_int(entry->rank);
+            ckpt_write_int(entry->key_len);
+            ckpt_write(entry->key, entry->key_len, true);
+        }
+        ckpt_end_frame();
+        ckpt.written_terminals = logger->current_cfg_terminal;
+    }
+
+    // 3. Grammar snapshot, same layout as serialize_grammar()
+    Symbol *rule, *sym;
+    int rules_count = 0, symbols_count = 0, total_symbols = 0;
+    DL_COUNT(logger->cfg.rules, rule, rules_count);
+    DL_FOREACH(logger->cfg.rules, rule) {
+        DL_COUNT(rule->rule_body, sym, symbols_count);
+        total_symbols += symbols_count;
+    }
+    ckpt_begin_frame(CKPT_GRAMMAR, sizeof(int) * (1 + 2*rules_count + 2*total_symbols));
+    ckpt_write_int(rules_count);
+    DL_FOREACH(logger->cfg.rules, rule) {
+        DL_COUNT(rule->rule_body, sym, symbols_count);
+        ckpt_write_int(rule->val);
+        ckpt_write_int(symbols_count);
+        DL_FOREACH(rule->rule_body, sym) {
+            ckpt_write_int(sym->val);
+            ckpt_write_int(sym->exp);
+        }
+    }
+    ckpt_end_frame();
+
+    // 4. Commit
+    ckpt_begin_frame(CKPT_COMMIT, sizeof(ts_elements)+sizeof(int));
+    ckpt_write(&ts_elements, sizeof(ts_elements), true);
+    ckpt_write_int(logger->segment);
+    ckpt_end_frame();
+    ckpt_flush_buffer();
+}
+
+/*
+ * Only async-signal-safe calls here, the checkpoint
+ * itself is taken by the watcher thread.
+ */
+static void checkpoint_signal_handler(int sig) {
+    int saved_errno = errno;
+    if(sig == SIGTERM)
+        ckpt.pending_sigterm = 1;
+    sem_post(&ckpt.signal_sem);
+    errno = saved_errno;
+}
+
+static void* checkpoint_watcher_main(void* arg) {
+    // Signals are handled by the application threads
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    while(true) {
+        if(sem_wait(&ckpt.signal_sem) != 0)
+            continue;       // EINTR
+        if(!ckpt.enabled)
+            break;
+
+        // Waits for the interrupted update of the logger (if any) to
+        // finish. During finalize the trace will be complete anyway.
+        pthread_mutex_lock(&g_mutex);
+        if(logger_initialized())
+            checkpoint_write(ckpt.logger);
+        pthread_mutex_unlock(&g_mutex);
+
+        // Checkpoint taken, now terminate as the signal would have
+        if(ckpt.pending_sigterm) {
+            signal(SIGTERM, SIG_DFL);
+            kill(getpid(), SIGTERM);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static bool install_signal_handler(int sig) {
+    // Do not override the application's own handler
+    struct sigaction old_act;
+    sigaction(sig, NULL, &old_act);
+    if(old_act.sa_handler != SIG_DFL)
+        return false;
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = checkpoint_signal_handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    sigaction(sig, &act, NULL);
+    return true;
+}
+
+/*
+ * Must be called after the traces directory is
+ * created and the timestamps file is opened.
+ */
+void checkpoint_init(RecorderLogger* logger) {
+    const char* interval_str = getenv(RECORDER_CHECKPOINT_INTERVAL);
+    if(!interval_str)
+        return;
+
+    MAP_OR_FAIL(open);
+    MAP_OR_FAIL(write);
+    MAP_OR_FAIL(close);
+    MAP_OR_FAIL(ftell);
+    MAP_OR_FAIL(unlink);
+    MAP_OR_FAIL(ftruncate);
+
+    char ckpt_filename[1024];
+    sprintf(ckpt_filename, "%s/%d.ckpt", logger->traces_dir, logger->rank);
+    ckpt.fd = RECORDER_REAL_CALL(open) (ckpt_filename, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+    if(ckpt.fd < 0) {
+        printf("[Recorder] Open file: %s failed, errno: %d\n", ckpt_filename, errno);
+        return;
+    }
+
+    ckpt.interval = atof(interval_str);
+    ckpt.last_checkpoint = recorder_wtime();
+    ckpt.written_terminals = 0;
+    ckpt.logger = logger;
+    ckpt.pending_sigterm = 0;
+    ckpt.buf_len = 0;
+
+    // The reader needs the metadata to recover the trace
+    if(logger->rank == 0)
+        save_global_metadata();
+
+    ckpt.enabled = true;
+    sem_init(&ckpt.signal_sem, 0, 0);
+    pthread_create(&ckpt.watcher, NULL, checkpoint_watcher_main, NULL);
+    ckpt.sigterm_handler = install_signal_handler(SIGTERM);
+    ckpt.sigusr1_handler = install_signal_handler(SIGUSR1);
+}
+
+bool checkpoint_enabled() {
+    return ckpt.enabled;
+}
+
+/*
+ * Take a checkpoint if it is time to.
+ * Caller needs to hold g_mutex.
+ * now: current time, from recorder_wtime()
+ */
+void checkpoint_progress(RecorderLogger* logger, double now) {
+    if(ckpt.interval > 0 && now - ckpt.last_checkpoint >= ckpt.interval) {
+        ckpt.last_checkpoint = now;
+        checkpoint_write(logger);
+    }
+}
+
+/*
+ * A segment has been saved (see logger_new_segment()),
+ * the checkpoint only needs to describe the new one.
+ * Caller needs to hold g_mutex.
+ */
+void checkpoint_new_segment(RecorderLogger* logger) {
+    ckpt.written_terminals = 0;
+    RECORDER_REAL_CALL(ftruncate) (ckpt.fd, 0);
+}
+
+/*
+ * The complete trace is written at finalize,
+ * the checkpoint file is no longer needed.
+ */
+void checkpoint_finalize(RecorderLogger* logger) {
+    if(!ckpt.enabled)
+        return;
+
+    ckpt.enabled = false;
+    if(ckpt.sigterm_handler)
+        signal(SIGTERM, SIG_DFL);
+    if(ckpt.sigusr1_handler)
+        signal(SIGUSR1, SIG_DFL);
+    sem_post(&ckpt.signal_sem);
+    pthread_join(ckpt.watcher, NULL);
+    sem_destroy(&ckpt.signal_sem);
+
+    RECORDER_REAL_CALL(close) (ckpt.fd);
+    char ckpt_filename[1024];
+    sprintf(ckpt_filename, "%s/%d.ckpt", logger->traces_dir, logger->rank);
+    RECORDER_REAL_CALL(unlink) (ckpt_filename);
+}
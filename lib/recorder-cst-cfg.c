@@ -215,6 +215,7 @@ void save_cst_local(RecorderLogger* logger) {
     RECORDER_REAL_CALL(fwrite)(data, 1, len, f);
     RECORDER_REAL_CALL(fflush)(f);
     RECORDER_REAL_CALL(fclose)(f);
+    recorder_free(data, len);
 }
 
 CallSignature* copy_cst(CallSignature* origin) {
@@ -233,31 +234,62 @@ CallSignature* copy_cst(CallSignature* origin) {
     return cst;
 }
 
-CallSignature* compress_csts(RecorderLogger* logger) {
-    int my_rank = logger->rank;
+/*
+ * Merge the entries of src into *dst, counts are
+ * summed up for signatures that exist in both.
+ */
+void merge_cst(CallSignature** dst, CallSignature* src) {
+    CallSignature *entry, *tmp, *found;
+    HASH_ITER(hh, src, entry, tmp) {
+        HASH_FIND(hh, *dst, entry->key, entry->key_len, found);
+        if(found) {
+            found->count += entry->count;
+        } else {
+            found = recorder_malloc(sizeof(CallSignature));
+            found->terminal_id = entry->terminal_id;
+            found->key_len = entry->key_len;
+            found->rank = entry->rank;
+            found->count = entry->count;
+            found->key = recorder_malloc(entry->key_len);
+            memcpy(found->key, entry->key, entry->key_len);
+            HASH_ADD_KEYPTR(hh, *dst, found->key, found->key_len, found);
+        }
+    }
+}
+
+/*
+ * Tree-based reduction of the CSTs of all processes in comm.
+ * Eventually the root (rank 0 of comm) will get the fully merged CST,
+ * for other processes NULL is returned.
+ */
+CallSignature* compress_csts(CallSignature* cst, MPI_Comm comm) {
+    int my_rank, nprocs;
+    PMPI_Comm_rank(comm, &my_rank);
+    PMPI_Comm_size(comm, &nprocs);
+
     int other_rank;
     int mask = 1;
     bool done = false;
 
-    int phases = recorder_ceil(recorder_log2(logger->nprocs));
+    int phases = recorder_ceil(recorder_log2(nprocs));
 
-    CallSignature* merged_cst = copy_cst(logger->cst);
+    CallSignature* merged_cst = copy_cst(cst);
 
     for(int k = 0; k < phases; k++, mask*=2) {
         if(done) break;
 
         other_rank = my_rank ^ mask;     // other_rank = my_rank XOR 2^k
 
-        if(other_rank >= logger->nprocs) continue;
+        if(other_rank >= nprocs) continue;
 
         size_t size;
         void* buf;
 
         // bigger ranks send to smaller ranks
         if(my_rank < other_rank) {
-            RECORDER_REAL_CALL(PMPI_Recv)(&size, sizeof(size), MPI_BYTE, other_rank, mask, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            RECORDER_REAL_CALL(PMPI_Recv)(&size, sizeof(size), MPI_BYTE, other_rank, mask, comm, MPI_STATUS_IGNORE);
             buf = recorder_malloc(size);
-            RECORDER_REAL_CALL(PMPI_Recv)(buf, size, MPI_BYTE, other_rank, mask, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            RECORDER_REAL_CALL(PMPI_Recv)(buf, size, MPI_BYTE, other_rank, mask, comm, MPI_STATUS_IGNORE);
 
             int cst_rank, entries, key_len;
             unsigned count;
@@ -319,8 +351,8 @@ CallSignature* compress_csts(RecorderLogger* logger) {
 
         } else {   // SENDER
             buf = serialize_cst(merged_cst, &size);
-            RECORDER_REAL_CALL(PMPI_Send)(&size, sizeof(size), MPI_BYTE, other_rank, mask, MPI_COMM_WORLD);
-            RECORDER_REAL_CALL(PMPI_Send)(buf, size, MPI_BYTE, other_rank, mask, MPI_COMM_WORLD);
+            RECORDER_REAL_CALL(PMPI_Send)(&size, sizeof(size), MPI_BYTE, other_rank, mask, comm);
+            RECORDER_REAL_CALL(PMPI_Send)(buf, size, MPI_BYTE, other_rank, mask, comm);
             recorder_free(buf, size);
             done = true;
         }
@@ -337,64 +369,88 @@ CallSignature* compress_csts(RecorderLogger* logger) {
         }
     } else {
         cleanup_cst(merged_cst);
+        merged_cst = NULL;
     }
     return merged_cst;
 }
 
 
-void save_cst_merged(RecorderLogger* logger) {
-    // 1. Inter-process copmression for CSTs
-    // Eventually, rank 0 will have the compressed cst.
-    CallSignature* compressed_cst = compress_csts(logger);
+/*
+ * Broadcast the merged CST from the root (rank 0 of comm)
+ * to all processes in comm. The root also writes it out to path.
+ *
+ * compressed_cst is the result of compress_csts(), return the
+ * merged CST on every process, caller needs to clean it up.
+ */
+CallSignature* bcast_merged_cst(CallSignature* compressed_cst, const char* path, MPI_Comm comm) {
+    int rank;
+    PMPI_Comm_rank(comm, &rank);
 
-    // 2. Broadcast the merged CST to all ranks
     size_t cst_stream_size;
     void *cst_stream;
 
-    if(logger->rank == 0) {
+    if(rank == 0) {
         cst_stream = serialize_cst(compressed_cst, &cst_stream_size);
 
-        RECORDER_REAL_CALL(PMPI_Bcast)(&cst_stream_size, sizeof(cst_stream_size), MPI_BYTE, 0, MPI_COMM_WORLD);
-        RECORDER_REAL_CALL(PMPI_Bcast)(cst_stream, cst_stream_size, MPI_BYTE, 0, MPI_COMM_WORLD);
+        RECORDER_REAL_CALL(PMPI_Bcast)(&cst_stream_size, sizeof(cst_stream_size), MPI_BYTE, 0, comm);
+        RECORDER_REAL_CALL(PMPI_Bcast)(cst_stream, cst_stream_size, MPI_BYTE, 0, comm);
 
-        // 3. Rank 0 write out the compressed CST
+        // Rank 0 write out the compressed CST
         errno = 0;
-        FILE *trace_file = fopen(logger->cst_path, "wb");
+        FILE *trace_file = fopen(path, "wb");
         if(trace_file) {
             fwrite(cst_stream, 1, cst_stream_size, trace_file);
             fclose(trace_file);
         } else {
-            printf("[Recorder] Open file: %s failed, errno: %d\n", logger->cst_path, errno);
+            printf("[Recorder] Open file: %s failed, errno: %d\n", path, errno);
         }
     } else {
-        RECORDER_REAL_CALL(PMPI_Bcast)(&cst_stream_size, sizeof(cst_stream_size), MPI_BYTE, 0, MPI_COMM_WORLD);
+        RECORDER_REAL_CALL(PMPI_Bcast)(&cst_stream_size, sizeof(cst_stream_size), MPI_BYTE, 0, comm);
         cst_stream = recorder_malloc(cst_stream_size);
-        RECORDER_REAL_CALL(PMPI_Bcast)(cst_stream, cst_stream_size, MPI_BYTE, 0, MPI_COMM_WORLD);
+        RECORDER_REAL_CALL(PMPI_Bcast)(cst_stream, cst_stream_size, MPI_BYTE, 0, comm);
 
-        // 3. Other rank get the compressed cst stream from rank 0
+        // Other rank get the compressed cst stream from rank 0
         // then convert it to the CST
         compressed_cst = deserialize_cst(cst_stream);
     }
 
-    // 4. Update function entry's terminal id
+    recorder_free(cst_stream, cst_stream_size);
+    return compressed_cst;
+}
+
+/*
+ * Update the terminal ids used by the logger's grammar
+ * to the ones assigned in the merged CST.
+ */
+void update_cfg_terminals(RecorderLogger* logger, CallSignature* merged_cst) {
     int *update_terminal_id = recorder_malloc(sizeof(int) * logger->current_cfg_terminal);
     CallSignature *entry, *tmp, *res;
     HASH_ITER(hh, logger->cst, entry, tmp) {
-        HASH_FIND(hh, compressed_cst, entry->key, entry->key_len, res);
+        HASH_FIND(hh, merged_cst, entry->key, entry->key_len, res);
         if(res)
             update_terminal_id[entry->terminal_id] = res->terminal_id;
         else
             printf("[Recorder] %d Not possible! Not exist in merged cst?\n", logger->rank);
     }
 
-
-    cleanup_cst(compressed_cst);
-    recorder_free(cst_stream, cst_stream_size);
-
     sequitur_update(&(logger->cfg), update_terminal_id);
     recorder_free(update_terminal_id, sizeof(int)* logger->current_cfg_terminal);
 }
 
+void save_cst_merged(RecorderLogger* logger) {
+    // 1. Inter-process copmression for CSTs
+    // Eventually, rank 0 will have the compressed cst.
+    CallSignature* compressed_cst = compress_csts(logger->cst, MPI_COMM_WORLD);
+
+    // 2. Broadcast the merged CST to all ranks
+    // and rank 0 writes it out
+    CallSignature* merged_cst = bcast_merged_cst(compressed_cst, logger->cst_path, MPI_COMM_WORLD);
+
+    // 3. Update function entry's terminal id
+    update_cfg_terminals(logger, merged_cst);
+    cleanup_cst(merged_cst);
+}
+
 
 void save_cfg_local(RecorderLogger* logger) {
     FILE* f = RECORDER_REAL_CALL(fopen) (logger->cfg_path, "wb");
@@ -403,10 +459,12 @@ void save_cfg_local(RecorderLogger* logger) {
     RECORDER_REAL_CALL(fwrite)(data, sizeof(int), count, f);
     RECORDER_REAL_CALL(fflush)(f);
     RECORDER_REAL_CALL(fclose)(f);
+    recorder_free(data, sizeof(int)*count);
 }
 
 void save_cfg_merged(RecorderLogger* logger) {
     //sequitur_dump(logger->cfg_path, &logger->cfg, logger->rank, logger->nprocs);
-    sequitur_save_unique_grammars(logger->traces_dir, &logger->cfg, logger->rank, logger->nprocs);
+    Grammar* grammar = &logger->cfg;
+    sequitur_save_unique_grammars(logger->traces_dir, &grammar, &logger->rank, 1, logger->nprocs, MPI_COMM_WORLD);
 }
 
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include "recorder.h"
+#include "recorder-epoch.h"
+
+
+typedef enum {
+    EPOCH_IDLE,
+    EPOCH_SIZES,            // exchanging the size of new signatures
+    EPOCH_KEYS,             // exchanging new signatures
+    EPOCH_COUNTS,           // reducing signature counts to rank 0
+} EpochPhase;
+
+typedef struct EpochState_t {
+    bool        enabled;
+    MPI_Comm    comm;               // duplicated MPI_COMM_WORLD
+    int         rank;
+    int         nprocs;
+    double      interval;           // in seconds, 0 means only at MPI_Pcontrol()
+    double      last_epoch;
+    pthread_t   mpi_thread;         // only this thread makes MPI calls
+
+    int         started;
+    int         completed;
+    bool        finalizing;
+    bool        last;               // the last epoch, run at finalize
+    EpochPhase  phase;
+    MPI_Request request;
+
+    CallSignature* global_cst;      // terminal_id is the global terminal id
+    int         global_terminals;
+    int*        global_ids;         // local terminal id -> global terminal id
+    int         global_ids_len;
+    int         merged_terminals;   // local terminals [0, merged_terminals) have a global id
+
+    // Snapshot taken at the start of the current epoch
+    int         snapshot_terminals;
+    int*        snapshot_counts;
+    int*        snapshot_grammar;
+    int         snapshot_grammar_len;
+
+    // Exchange buffers of the current epoch
+    int         send_size;
+    char*       send_buf;
+    int*        recv_sizes;
+    int*        displs;
+    char*       recv_buf;
+    int         recv_total;
+    int         counts_len;
+    int*        counts;
+    int*        reduced_counts;     // only on rank 0
+} EpochState;
+
+static EpochState epoch = { .enabled = false };
+
+
+/*
+ * Collective call over MPI_COMM_WORLD
+ * Must be called after the traces directory is created.
+ */
+void epoch_init(RecorderLogger* logger) {
+    const char* interval_str = getenv(RECORDER_EPOCH_INTERVAL);
+    if(!interval_str)
+        return;
+
+    epoch.interval = atof(interval_str);
+    if(epoch.interval < 0)
+        epoch.interval = 0;
+    epoch.rank   = logger->rank;
+    epoch.nprocs = logger->nprocs;
+    epoch.last_epoch = recorder_wtime();
+    epoch.mpi_thread = pthread_self();
+    epoch.started = 0;
+    epoch.completed = 0;
+    epoch.finalizing = false;
+    epoch.last = false;
+    epoch.phase = EPOCH_IDLE;
+    epoch.global_cst = NULL;
+    epoch.global_terminals = 0;
+    epoch.global_ids = NULL;
+    epoch.global_ids_len = 0;
+    epoch.merged_terminals = 0;
+    epoch.recv_sizes = recorder_malloc(sizeof(int) * epoch.nprocs);
+    epoch.displs = recorder_malloc(sizeof(int) * epoch.nprocs);
+
+    MAP_OR_FAIL(rename);
+    MAP_OR_FAIL(unlink);
+    PMPI_Comm_dup(MPI_COMM_WORLD, &epoch.comm);
+
+    // Epochs produce the merged format
+    logger->interprocess_compression = 1;
+    epoch.enabled = true;
+}
+
+bool epoch_enabled() {
+    return epoch.enabled;
+}
+
+static void write_file_atomic(const char* path, const void* data, size_t size) {
+    char tmp_path[1100];
+    sprintf(tmp_path, "%s.tmp", path);
+    FILE* f = RECORDER_REAL_CALL(fopen) (tmp_path, "wb");
+    if(!f) {
+        printf("[Recorder] Open file: %s failed, errno: %d\n", tmp_path, errno);
+        return;
+    }
+    RECORDER_REAL_CALL(fwrite)(data, 1, size, f);
+    RECORDER_REAL_CALL(fflush)(f);
+    RECORDER_REAL_CALL(fclose)(f);
+    RECORDER_REAL_CALL(rename) (tmp_path, path);
+}
+
+static void epoch_start(RecorderLogger* logger) {
+    epoch.started++;
+    epoch.phase = EPOCH_SIZES;
+
+    // Flush timestamps so they match the grammar snapshot.
+    // At finalize, the timestamps file has already been closed.
+    if(!epoch.finalizing) {
+        if(logger->ts_index > 0)
+            RECORDER_REAL_CALL(fwrite)(logger->ts, sizeof(uint32_t), logger->ts_index, logger->ts_file);
+        logger->ts_index = 0;
+        RECORDER_REAL_CALL(fflush)(logger->ts_file);
+    }
+
+    epoch.snapshot_terminals = logger->current_cfg_terminal;
+    if(epoch.global_ids_len < epoch.snapshot_terminals) {
+        int len = epoch.snapshot_terminals * 2;
+        int* ids = recorder_malloc(sizeof(int) * len);
+        memcpy(ids, epoch.global_ids, sizeof(int) * epoch.global_ids_len);
+        for(int i = epoch.global_ids_len; i < len; i++)
+            ids[i] = -1;
+        recorder_free(epoch.global_ids, sizeof(int) * epoch.global_ids_len);
+        epoch.global_ids = ids;
+        epoch.global_ids_len = len;
+    }
+    epoch.snapshot_counts = recorder_malloc(sizeof(int) * epoch.snapshot_terminals);
+    epoch.snapshot_grammar = serialize_grammar(&logger->cfg, &epoch.snapshot_grammar_len);
+
+    // Only send the signatures that are new to the global CST
+    CallSignature *entry, *tmp, *found;
+    epoch.send_size = 0;
+    HASH_ITER(hh, logger->cst, entry, tmp) {
+        epoch.snapshot_counts[entry->terminal_id] = entry->count;
+        if(entry->terminal_id < epoch.merged_terminals)
+            continue;
+        HASH_FIND(hh, epoch.global_cst, entry->key, entry->key_len, found);
+        if(found)
+            epoch.global_ids[entry->terminal_id] = found->terminal_id;
+        else
+            epoch.send_size += sizeof(int) + entry->key_len;
+    }
+
+    epoch.send_buf = recorder_malloc(epoch.send_size);
+    char* ptr = epoch.send_buf;
+    HASH_ITER(hh, logger->cst, entry, tmp) {
+        if(entry->terminal_id < epoch.merged_terminals || epoch.global_ids[entry->terminal_id] >= 0)
+            continue;
+        memcpy(ptr, &entry->key_len, sizeof(int));
+        ptr += sizeof(int);
+        memcpy(ptr, entry->key, entry->key_len);
+        ptr += entry->key_len;
+    }
+
+    PMPI_Iallgather(&epoch.send_size, 1, MPI_INT, epoch.recv_sizes, 1, MPI_INT, epoch.comm, &epoch.request);
+}
+
+/*
+ * Add the gathered new signatures to the global CST.
+ * Going through them in rank order guarantees every process
+ * assigns the same global id to the same signature.
+ */
+static void merge_new_signatures(RecorderLogger* logger) {
+    CallSignature *entry, *tmp, *found;
+
+    char* ptr = epoch.recv_buf;
+    for(int r = 0; r < epoch.nprocs; r++) {
+        char* end = epoch.recv_buf + epoch.displs[r] + epoch.recv_sizes[r];
+        while(ptr < end) {
+            int key_len;
+            memcpy(&key_len, ptr, sizeof(int));
+            ptr += sizeof(int);
+            HASH_FIND(hh, epoch.global_cst, ptr, key_len, found);
+            if(!found) {
+                found = recorder_malloc(sizeof(CallSignature));
+                found->key = recorder_malloc(key_len);
+                memcpy(found->key, ptr, key_len);
+                found->key_len = key_len;
+                found->rank = r;
+                found->terminal_id = epoch.global_terminals++;
+                found->count = 0;
+                HASH_ADD_KEYPTR(hh, epoch.global_cst, found->key, found->key_len, found);
+            }
+            ptr += key_len;
+        }
+    }
+
+    HASH_ITER(hh, logger->cst, entry, tmp) {
+        if(entry->terminal_id < epoch.merged_terminals || entry->terminal_id >= epoch.snapshot_terminals)
+            continue;
+        if(epoch.global_ids[entry->terminal_id] >= 0)
+            continue;
+        HASH_FIND(hh, epoch.global_cst, entry->key, entry->key_len, found);
+        epoch.global_ids[entry->terminal_id] = found->terminal_id;
+    }
+    epoch.merged_terminals = epoch.snapshot_terminals;
+}
+
+/*
+ * Write out a consistent trace of this epoch:
+ * grammar of this process and, on rank 0, the merged CST
+ * and the metadata.
+ */
+static void epoch_checkpoint(RecorderLogger* logger) {
+    int* g = epoch.snapshot_grammar;
+    int k = 0;
+    int rules = g[k++];
+    for(int i = 0; i < rules; i++) {
+        k++;                        // rule head
+        int symbols = g[k++];
+        for(int j = 0; j < symbols; j++, k+=2) {
+            if(g[k] >= 0)           // terminal
+                g[k] = epoch.global_ids[g[k]];
+        }
+    }
+
+    char path[1100];
+    sprintf(path, "%s/%d.cfg", logger->traces_dir, epoch.rank);
+    write_file_atomic(path, g, sizeof(int) * epoch.snapshot_grammar_len);
+
+    if(epoch.rank != 0)
+        return;
+
+    CallSignature *entry, *tmp;
+    HASH_ITER(hh, epoch.global_cst, entry, tmp) {
+        if(entry->terminal_id < epoch.counts_len)
+            entry->count = epoch.reduced_counts[entry->terminal_id];
+    }
+    size_t len;
+    void* data = serialize_cst(epoch.global_cst, &len);
+    write_file_atomic(logger->cst_path, data, len);
+    recorder_free(data, len);
+
+    // Each process has its own grammar in the checkpoint
+    int grammar_ids[epoch.nprocs+1];
+    for(int r = 0; r < epoch.nprocs; r++)
+        grammar_ids[r] = r;
+    grammar_ids[epoch.nprocs] = epoch.nprocs;
+    sprintf(path, "%s/ug.mt", logger->traces_dir);
+    write_file_atomic(path, grammar_ids, sizeof(grammar_ids));
+
+    if(epoch.completed == 0)
+        save_global_metadata();
+}
+
+/*
+ * Called once the outstanding request has completed
+ */
+static void epoch_advance(RecorderLogger* logger) {
+    switch(epoch.phase) {
+        case EPOCH_SIZES:
+            epoch.recv_total = 0;
+            for(int r = 0; r < epoch.nprocs; r++) {
+                epoch.displs[r] = epoch.recv_total;
+                epoch.recv_total += epoch.recv_sizes[r];
+            }
+            epoch.recv_buf = recorder_malloc(epoch.recv_total);
+            PMPI_Iallgatherv(epoch.send_buf, epoch.send_size, MPI_BYTE, epoch.recv_buf,
+                             epoch.recv_sizes, epoch.displs, MPI_BYTE, epoch.comm, &epoch.request);
+            epoch.phase = EPOCH_KEYS;
+            break;
+        case EPOCH_KEYS:
+            merge_new_signatures(logger);
+            recorder_free(epoch.send_buf, epoch.send_size);
+            recorder_free(epoch.recv_buf, epoch.recv_total);
+
+            // Every process has the same number of global terminals now
+            epoch.counts_len = epoch.global_terminals;
+            epoch.counts = recorder_malloc(sizeof(int) * epoch.counts_len);
+            memset(epoch.counts, 0, sizeof(int) * epoch.counts_len);
+            for(int i = 0; i < epoch.snapshot_terminals; i++)
+                epoch.counts[epoch.global_ids[i]] += epoch.snapshot_counts[i];
+            epoch.reduced_counts = NULL;
+            if(epoch.rank == 0)
+                epoch.reduced_counts = recorder_malloc(sizeof(int) * epoch.counts_len);
+            PMPI_Ireduce(epoch.counts, epoch.reduced_counts, epoch.counts_len, MPI_INT,
+                         MPI_SUM, 0, epoch.comm, &epoch.request);
+            epoch.phase = EPOCH_COUNTS;
+            break;
+        case EPOCH_COUNTS:
+            if(!epoch.finalizing)
+                epoch_checkpoint(logger);
+            recorder_free(epoch.snapshot_counts, sizeof(int) * epoch.snapshot_terminals);
+            recorder_free(epoch.snapshot_grammar, sizeof(int) * epoch.snapshot_grammar_len);
+            recorder_free(epoch.counts, sizeof(int) * epoch.counts_len);
+            if(!epoch.last)     // kept for writing the final CST
+                recorder_free(epoch.reduced_counts, sizeof(int) * epoch.counts_len);
+            epoch.completed++;
+            epoch.phase = EPOCH_IDLE;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Drive the current epoch forward, or start a new one if it is
+ * time to. Caller needs to hold g_mutex.
+ * now: current time, from recorder_wtime()
+ */
+void epoch_progress(RecorderLogger* logger, double now) {
+    if(!pthread_equal(pthread_self(), epoch.mpi_thread))
+        return;
+
+    if(epoch.phase != EPOCH_IDLE) {
+        int flag = 0;
+        PMPI_Test(&epoch.request, &flag, MPI_STATUS_IGNORE);
+        if(flag)
+            epoch_advance(logger);
+    } else if(epoch.interval > 0 && now - epoch.last_epoch >= epoch.interval) {
+        epoch.last_epoch = now;
+        epoch_start(logger);
+    }
+}
+
+/*
+ * A user-marked phase boundary (MPI_Pcontrol).
+ * Caller needs to hold g_mutex.
+ */
+void epoch_trigger(RecorderLogger* logger) {
+    if(!pthread_equal(pthread_self(), epoch.mpi_thread))
+        return;
+    if(epoch.phase == EPOCH_IDLE) {
+        epoch.last_epoch = recorder_wtime();
+        epoch_start(logger);
+    }
+}
+
+static void epoch_wait(RecorderLogger* logger) {
+    while(epoch.phase != EPOCH_IDLE) {
+        PMPI_Wait(&epoch.request, MPI_STATUS_IGNORE);
+        epoch_advance(logger);
+    }
+}
+
+/*
+ * Collective call over MPI_COMM_WORLD
+ * Replaces save_cst_merged() and save_cfg_merged().
+ */
+void epoch_finalize(RecorderLogger* logger) {
+    epoch.finalizing = true;
+
+    // 1. Processes may have started different number of epochs,
+    // catch up with the one that started the most.
+    int max_started;
+    PMPI_Allreduce(&epoch.started, &max_started, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    while(epoch.completed < max_started) {
+        if(epoch.phase == EPOCH_IDLE)
+            epoch_start(logger);
+        epoch_wait(logger);
+    }
+
+    // 2. A last epoch for the signatures discovered since
+    // then, this also gives rank 0 the final counts
+    epoch.last = true;
+    epoch_start(logger);
+    epoch_wait(logger);
+
+    // 3. Rank 0 writes out the merged CST
+    if(epoch.rank == 0) {
+        CallSignature *entry, *tmp;
+        HASH_ITER(hh, epoch.global_cst, entry, tmp)
+            entry->count = epoch.reduced_counts[entry->terminal_id];
+        size_t len;
+        void* data = serialize_cst(epoch.global_cst, &len);
+        write_file_atomic(logger->cst_path, data, len);
+        recorder_free(data, len);
+
+        // Remove per-process grammars of the checkpoints,
+        // unique grammars will be written below
+        char path[1100];
+        for(int r = 0; r < epoch.nprocs; r++) {
+            sprintf(path, "%s/%d.cfg", logger->traces_dir, r);
+            RECORDER_REAL_CALL(unlink) (path);
+        }
+    }
+    recorder_free(epoch.reduced_counts, sizeof(int) * epoch.counts_len);
+
+    // 4. Switch the grammar to global terminal ids and save unique grammars
+    sequitur_update(&logger->cfg, epoch.global_ids);
+    save_cfg_merged(logger);
+
+    cleanup_cst(epoch.global_cst);
+    recorder_free(epoch.global_ids, sizeof(int) * epoch.global_ids_len);
+    recorder_free(epoch.recv_sizes, sizeof(int) * epoch.nprocs);
+    recorder_free(epoch.displs, sizeof(int) * epoch.nprocs);
+    PMPI_Comm_free(&epoch.comm);
+    epoch.enabled = false;
+}
@@ -144,6 +144,16 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided) {
     return ret;
 }
 
+/*
+ * MPI_Pcontrol() is not traced, we use it
+ * to let users mark phase boundaries for epochs.
+ */
+int MPI_Pcontrol(const int level, ...) {
+    if(logger_initialized())
+        logger_mark_epoch();
+    return PMPI_Pcontrol(level);
+}
+
 int PMPI_Finalize(void) {
     recorder_finalize();
     MAP_OR_FAIL(PMPI_Finalize);
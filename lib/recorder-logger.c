@@ -7,6 +7,9 @@
 #include <errno.h>
 #include "recorder.h"
 #include "recorder-pattern-recognition.h"
+#include "recorder-node-helper.h"
+#include "recorder-epoch.h"
+#include "recorder-checkpoint.h"
 #ifdef RECORDER_ENABLE_CUDA_TRACE
 #include "recorder-cuda-profiler.h"
 #endif
@@ -35,6 +38,17 @@ struct RecordStack {
 };
 static struct RecordStack *g_record_stack = NULL;
 
+/**
+ * Records waiting for the node helper
+ */
+typedef struct PendingRecord_t {
+    char* key;
+    int key_len;
+    double tstart, tend;
+    struct PendingRecord_t *prev, *next;
+} PendingRecord;
+static PendingRecord *g_pending_records = NULL;
+
 
 void free_record(Record *record) {
     if(record == NULL)
@@ -52,6 +66,190 @@ void free_record(Record *record) {
     recorder_free(record, sizeof(Record));
 }
 
+/*
+ * Add one record (its call signature key and timestamps)
+ * to the CST, CFG and timestamp buffer of lg.
+ * Take the ownership of key. The caller needs to hold g_mutex
+ * if lg can be accessed concurrently.
+ */
+void logger_append_record(RecorderLogger* lg, char* key, int key_len, double tstart, double tend) {
+    CallSignature *entry = NULL;
+    HASH_FIND(hh, lg->cst, key, key_len, entry);
+    if(entry) {                         // Found
+        entry->count++;
+        recorder_free(key, key_len);
+    } else {                            // Not exist, add to hash table
+        entry = (CallSignature*) recorder_malloc(sizeof(CallSignature));
+        entry->key = key;
+        entry->key_len = key_len;
+        entry->rank = lg->rank;
+        entry->terminal_id = lg->current_cfg_terminal++;
+        entry->count = 1;
+        HASH_ADD_KEYPTR(hh, lg->cst, entry->key, entry->key_len, entry);
+    }
+
+    append_terminal(&lg->cfg, entry->terminal_id, 1);
+
+    // write timestamps
+    uint32_t delta_tstart = (tstart-lg->prev_tstart) / lg->ts_resolution;
+    uint32_t delta_tend   = (tend-lg->prev_tstart)   / lg->ts_resolution;
+    lg->prev_tstart = tstart;
+    lg->ts[lg->ts_index++] = delta_tstart;
+    lg->ts[lg->ts_index++] = delta_tend;
+    if(lg->ts_index == lg->ts_max_elements) {
+        if(!lg->directory_created)
+            logger_set_mpi_info(0, 1);
+        RECORDER_REAL_CALL(fwrite)(lg->ts, sizeof(uint32_t), lg->ts_max_elements, lg->ts_file);
+        lg->ts_index = 0;
+    }
+}
+
+/*
+ * The memory budget is hit: save the current CST and grammar
+ * as a segment (<rank>.<segment>.cst/cfg), then start over with
+ * empty ones. Timestamps keep going to the same .ts file, the
+ * reader decodes segments in order before the final CST/CFG.
+ */
+static void logger_new_segment() {
+    char cst_path[1024], cfg_path[1024];
+    strcpy(cst_path, logger.cst_path);
+    strcpy(cfg_path, logger.cfg_path);
+    sprintf(logger.cst_path, "%s/%d.%d.cst", logger.traces_dir, logger.rank, logger.segment);
+    sprintf(logger.cfg_path, "%s/%d.%d.cfg", logger.traces_dir, logger.rank, logger.segment);
+    save_cst_local(&logger);
+    save_cfg_local(&logger);
+    strcpy(logger.cst_path, cst_path);
+    strcpy(logger.cfg_path, cfg_path);
+
+    cleanup_cst(logger.cst);
+    logger.cst = NULL;
+    sequitur_cleanup(&logger.cfg);
+    sequitur_init(&logger.cfg);
+    logger.current_cfg_terminal = 0;
+    logger.segment++;
+
+    if(checkpoint_enabled())
+        checkpoint_new_segment(&logger);
+
+    logger.segment_base_usage = recorder_memory_usage();
+}
+
+/*
+ * Memory used by the current segment needs to be
+ * substantial, otherwise memory that is not released by
+ * starting a new segment would trigger one for every record.
+ */
+static inline bool memory_budget_exceeded() {
+    size_t usage = recorder_memory_usage();
+    return usage > logger.memory_budget &&
+           usage - logger.segment_base_usage > logger.memory_budget / 2;
+}
+
+/*
+ * With the node helper, records generated before
+ * MPI_Init() are kept here until the helper is up
+ */
+static void add_pending_record(char* key, int key_len, double tstart, double tend) {
+    PendingRecord* pr = recorder_malloc(sizeof(PendingRecord));
+    pr->key = key;
+    pr->key_len = key_len;
+    pr->tstart = tstart;
+    pr->tend = tend;
+    DL_APPEND(g_pending_records, pr);
+}
+
+static void flush_pending_records() {
+    PendingRecord *pr, *tmp;
+    DL_FOREACH_SAFE(g_pending_records, pr, tmp) {
+        DL_DELETE(g_pending_records, pr);
+        if(node_helper_enabled()) {
+            node_helper_push(pr->key, pr->key_len, pr->tstart, pr->tend);
+            recorder_free(pr->key, pr->key_len);
+        } else {
+            logger_append_record(&logger, pr->key, pr->key_len, pr->tstart, pr->tend);
+        }
+        recorder_free(pr, sizeof(PendingRecord));
+    }
+}
+
+/*
+ * Reads and writes at the file pointer carry their offset as the last
+ * argument (see recorder-posix.c). It is logged relative to where the
+ * previous one of this process on the same file ended, so sequential
+ * I/O keeps the same call signature. The reader reverses this with
+ * recorder_get_io_offset(), using the same arguments.
+ */
+typedef struct PointerFunc_t {
+    const char* name;
+    int file_arg, offset_arg;
+    int count_arg, size_arg;                // bytes: count (times size)
+} PointerFunc;
+
+static const PointerFunc pointer_funcs[] = {
+    { "read",     0, 3, 2, -1 }, { "write",    0, 3, 2, -1 },
+    { "readv",    0, 3, 1, -1 }, { "writev",   0, 3, 1, -1 },
+    { "fread",    3, 4, 2,  1 }, { "fwrite",   3, 4, 2,  1 },
+    { "vfprintf", 0, 2, 1, -1 },
+};
+static const PointerFunc* pointer_func_table[256];
+
+typedef struct FileEnd_t {
+    char* filename;
+    long long end;                          // of the last logged access
+    UT_hash_handle hh;
+} FileEnd;
+static FileEnd* file_ends = NULL;
+
+static void init_pointer_funcs() {
+    memset(pointer_func_table, 0, sizeof(pointer_func_table));
+    for(int i = 0; i < sizeof(pointer_funcs)/sizeof(pointer_funcs[0]); i++)
+        pointer_func_table[get_function_id_by_name(pointer_funcs[i].name)] = &pointer_funcs[i];
+}
+
+/*
+ * Records are given in the order they are appended,
+ * the caller needs to hold g_mutex.
+ */
+static void relative_file_offset(Record* record) {
+    const PointerFunc* pf = pointer_func_table[record->func_id];
+    if(!pf || record->arg_count != pf->offset_arg+1)
+        return;
+
+    // Unknown, e.g., for FIFOs
+    char** offset_arg = &record->args[pf->offset_arg];
+    long long offset = atoll(*offset_arg);
+    free(*offset_arg);
+    if(offset < 0) {
+        *offset_arg = strdup("?");
+        return;
+    }
+
+    FileEnd* fe = NULL;
+    const char* filename = record->args[pf->file_arg];
+    HASH_FIND_STR(file_ends, filename, fe);
+    if(!fe) {
+        fe = malloc(sizeof(FileEnd));
+        fe->filename = strdup(filename);
+        fe->end = 0;
+        HASH_ADD_KEYPTR(hh, file_ends, fe->filename, strlen(fe->filename), fe);
+    }
+
+    long long bytes = atoll(record->args[pf->count_arg]);
+    if(pf->size_arg >= 0)
+        bytes *= atoll(record->args[pf->size_arg]);
+    *offset_arg = itoa(offset - fe->end);
+    fe->end = offset + bytes;
+}
+
+static void cleanup_file_ends() {
+    FileEnd *fe, *tmp;
+    HASH_ITER(hh, file_ends, fe, tmp) {
+        HASH_DEL(file_ends, fe);
+        free(fe->filename);
+        free(fe);
+    }
+}
+
 void write_record(Record *record) {
 
     // Before pass the record to compose_cs_key()
@@ -63,41 +261,41 @@ void write_record(Record *record) {
     if(!logger.log_level)
         record->level = 0;
 
+    pthread_mutex_lock(&g_mutex);
+
+    if(recorder_log_offset())
+        relative_file_offset(record);
     int key_len;
     char* key = compose_cs_key(record, &key_len);
 
-    pthread_mutex_lock(&g_mutex);
-
-    CallSignature *entry = NULL;
-    HASH_FIND(hh, logger.cst, key, key_len, entry);
-    if(entry) {                         // Found
-        entry->count++;
+    if(node_helper_enabled()) {
+        node_helper_push(key, key_len, record->tstart, record->tend);
         recorder_free(key, key_len);
-    } else {                            // Not exist, add to hash table
-        entry = (CallSignature*) recorder_malloc(sizeof(CallSignature));
-        entry->key = key;
-        entry->key_len = key_len;
-        entry->rank = logger.rank;
-        entry->terminal_id = logger.current_cfg_terminal++;
-        entry->count = 1;
-        HASH_ADD_KEYPTR(hh, logger.cst, entry->key, entry->key_len, entry);
+    } else if(logger.node_helper && !logger.directory_created) {
+        add_pending_record(key, key_len, record->tstart, record->tend);
+    } else {
+        logger_append_record(&logger, key, key_len, record->tstart, record->tend);
+        if(epoch_enabled())
+            epoch_progress(&logger, record->tend);
+        if(checkpoint_enabled())
+            checkpoint_progress(&logger, record->tend);
+        // Segments need the final rank, and do not
+        // work with the global terminal ids of epochs
+        if(logger.memory_budget && logger.directory_created &&
+           !epoch_enabled() && memory_budget_exceeded())
+            logger_new_segment();
     }
 
-    append_terminal(&logger.cfg, entry->terminal_id, 1);
-
-    // write timestamps
-    uint32_t delta_tstart = (record->tstart-logger.prev_tstart) / logger.ts_resolution;
-    uint32_t delta_tend   = (record->tend-logger.prev_tstart)   / logger.ts_resolution;
-    logger.prev_tstart = record->tstart;
-    logger.ts[logger.ts_index++] = delta_tstart;
-    logger.ts[logger.ts_index++] = delta_tend;
-    if(logger.ts_index == logger.ts_max_elements) {
-        if(!logger.directory_created)
-            logger_set_mpi_info(0, 1);
-        RECORDER_REAL_CALL(fwrite)(logger.ts, sizeof(uint32_t), logger.ts_max_elements, logger.ts_file);
-        logger.ts_index = 0;
-    }
+    pthread_mutex_unlock(&g_mutex);
+}
 
+/*
+ * User-marked phase boundary, see MPI_Pcontrol()
+ */
+void logger_mark_epoch() {
+    pthread_mutex_lock(&g_mutex);
+    if(epoch_enabled())
+        epoch_trigger(&logger);
     pthread_mutex_unlock(&g_mutex);
 }
 
@@ -198,11 +396,35 @@ void logger_set_mpi_info(int mpi_rank, int mpi_size) {
     if(mpi_initialized)
         RECORDER_REAL_CALL(PMPI_Barrier) (MPI_COMM_WORLD);
 
-    char ts_filename[1024];
-    sprintf(ts_filename, "%s/%d.ts", logger.traces_dir, mpi_rank);
-    logger.ts_file = RECORDER_REAL_CALL(fopen) (ts_filename, "wb");
+    // The node helper only works for MPI programs
+    if(!mpi_initialized)
+        logger.node_helper = 0;
+
+    // With the node helper, the node leader writes
+    // the timestamps of this process
+    if(!logger.node_helper) {
+        char ts_filename[1024];
+        sprintf(ts_filename, "%s/%d.ts", logger.traces_dir, mpi_rank);
+        logger.ts_file = RECORDER_REAL_CALL(fopen) (ts_filename, "wb");
+    }
 
     logger.directory_created = true;
+
+    if(!logger.node_helper)
+        checkpoint_init(&logger);
+
+    if(logger.node_helper)
+        node_helper_init(&logger);
+    else if(mpi_initialized)
+        epoch_init(&logger);
+
+    // Only with the node helper we can have pending records,
+    // in which case we are not called from write_record()
+    if(g_pending_records) {
+        pthread_mutex_lock(&g_mutex);
+        flush_pending_records();
+        pthread_mutex_unlock(&g_mutex);
+    }
 }
 
 
@@ -239,6 +461,11 @@ void logger_init() {
     logger.log_tid   = 0;
     logger.log_level = 1;
     logger.interprocess_compression = 0;
+    logger.node_helper = 0;
+    logger.memory_budget = 0;
+    logger.segment_base_usage = 0;
+    logger.segment = 0;
+    init_pointer_funcs();
 
     // ts buffer size in MB
     const char* buffer_size_str = getenv(RECORDER_BUFFER_SIZE);
@@ -266,6 +493,12 @@ void logger_init() {
     const char* interprocess_compression = getenv(RECORDER_INTERPROCESS_COMPRESSION);
     if(interprocess_compression)
         logger.interprocess_compression = atoi(interprocess_compression);
+    const char* memory_budget_str = getenv(RECORDER_MEMORY_BUDGET);
+    if(memory_budget_str)
+        logger.memory_budget = (size_t) atoi(memory_budget_str) * 1024 * 1024;
+    const char* node_helper = getenv(RECORDER_NODE_HELPER);
+    if(node_helper)
+        logger.node_helper = atoi(node_helper);
 
 
     initialized = true;
@@ -320,17 +553,21 @@ void logger_finalize() {
     if(!logger.directory_created)
         logger_set_mpi_info(0, 1);
 
+    // Not while the checkpoint watcher is writing
+    pthread_mutex_lock(&g_mutex);
     initialized = false;
+    pthread_mutex_unlock(&g_mutex);
 
     #ifdef RECORDER_ENABLE_CUDA_TRACE
     cuda_profiler_exit();
     #endif
 
-    if(logger.ts_index > 0)
-        RECORDER_REAL_CALL(fwrite)(logger.ts, sizeof(int), logger.ts_index, logger.ts_file);
-
-    RECORDER_REAL_CALL(fflush)(logger.ts_file);
-    RECORDER_REAL_CALL(fclose)(logger.ts_file);
+    if(!logger.node_helper) {
+        if(logger.ts_index > 0)
+            RECORDER_REAL_CALL(fwrite)(logger.ts, sizeof(int), logger.ts_index, logger.ts_file);
+        RECORDER_REAL_CALL(fflush)(logger.ts_file);
+        RECORDER_REAL_CALL(fclose)(logger.ts_file);
+    }
     recorder_free(logger.ts, sizeof(uint32_t)*logger.ts_max_elements);
 
     /*
@@ -344,15 +581,21 @@ void logger_finalize() {
     //interprocess_pattern_recognition(&logger, "pwrite", 3);
 
     cleanup_record_stack();
-    if(logger.interprocess_compression) {
+    if(logger.node_helper) {
+        node_helper_finalize(&logger);
+    } else if(epoch_enabled()) {
+        epoch_finalize(&logger);
+    } else if(logger.interprocess_compression) {
         save_cst_merged(&logger);
         save_cfg_merged(&logger);
     } else {
         save_cst_local(&logger);
         save_cfg_local(&logger);
     }
+    checkpoint_finalize(&logger);
     cleanup_cst(logger.cst);
     sequitur_cleanup(&logger.cfg);
+    cleanup_file_ends();
 
     if(logger.rank == 0) {
         save_global_metadata();
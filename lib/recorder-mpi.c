@@ -234,8 +234,9 @@ static inline char* whence2name(int whence) {
 }
 
 /**
- * For MPI_Wait and MPI_Test we always fill in MPI_Status
- * even if user passed MPI_STATUS_IGNORE.
+ * For MPI_Wait, MPI_Test and the calls that receive or complete one
+ * request (MPI_Recv, MPI_Sendrecv, MPI_Waitany, MPI_Testany) we always
+ * fill in MPI_Status even if user passed MPI_STATUS_IGNORE.
  *
  * The purpose is that later when we match MPI calls
  * we are sure we can find out the recveive src/tag.
@@ -691,14 +692,16 @@ int RECORDER_MPI_IMP(MPI_Send) (CONST void *buf, int count, MPI_Datatype datatyp
     RECORDER_INTERCEPTOR_EPILOGUE(6, args);
 }
 int RECORDER_MPI_IMP(MPI_Recv) (void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status, MPI_Fint* ierr) {
-    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Recv, (buf, count, datatype, source, tag, comm, status), ierr);
-    char **args = assemble_args_list(7, ptoa(buf), itoa(count), type2name(datatype), itoa(source), itoa(tag), comm2name(&comm), status2str(status));
+    MPI_Status *status_p = (status==MPI_STATUS_IGNORE) ? alloca(sizeof(MPI_Status)) : status;
+    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Recv, (buf, count, datatype, source, tag, comm, status_p), ierr);
+    char **args = assemble_args_list(7, ptoa(buf), itoa(count), type2name(datatype), itoa(source), itoa(tag), comm2name(&comm), status2str(status_p));
     RECORDER_INTERCEPTOR_EPILOGUE(7, args);
 }
 int RECORDER_MPI_IMP(MPI_Sendrecv) (CONST void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag, void *recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status, MPI_Fint* ierr) {
-    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Sendrecv, (sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag, comm, status), ierr);
+    MPI_Status *status_p = (status==MPI_STATUS_IGNORE) ? alloca(sizeof(MPI_Status)) : status;
+    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Sendrecv, (sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag, comm, status_p), ierr);
     char **args = assemble_args_list(12, ptoa(sendbuf), itoa(sendcount), type2name(sendtype), itoa(dest), itoa(sendtag), ptoa(recvbuf), itoa(recvcount), type2name(recvtype),
-                                        itoa(source), itoa(recvtag), comm2name(&comm), status2str(status));
+                                        itoa(source), itoa(recvtag), comm2name(&comm), status2str(status_p));
     RECORDER_INTERCEPTOR_EPILOGUE(12, args);
 }
 
@@ -749,8 +752,9 @@ int RECORDER_MPI_IMP(MPI_Waitany) (int count, MPI_Request requests[], int *indx,
         arr[i] = (size_t) requests[i];
     char* requests_str = arrtoa(arr, count);
 
-    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Waitany, (count, requests, indx, status), ierr);
-    char **args = assemble_args_list(4, itoa(count), requests_str, itoa(*indx), status2str(status));
+    MPI_Status *status_p = (status==MPI_STATUS_IGNORE) ? alloca(sizeof(MPI_Status)) : status;
+    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Waitany, (count, requests, indx, status_p), ierr);
+    char **args = assemble_args_list(4, itoa(count), requests_str, itoa(*indx), status2str(status_p));
     RECORDER_INTERCEPTOR_EPILOGUE(4, args);
 }
 
@@ -826,8 +830,9 @@ int RECORDER_MPI_IMP(MPI_Testany) (int count, MPI_Request requests[], int *indx,
         arr[i] = (size_t) requests[i];
     char* requests_str = arrtoa(arr, count);
 
-    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Testany, (count, requests, indx, flag, status), ierr);
-    char **args = assemble_args_list(5, itoa(count), requests_str, itoa(*indx), itoa(*flag), status2str(status));
+    MPI_Status *status_p = (status==MPI_STATUS_IGNORE) ? alloca(sizeof(MPI_Status)) : status;
+    RECORDER_INTERCEPTOR_PROLOGUE_F(int, PMPI_Testany, (count, requests, indx, flag, status_p), ierr);
+    char **args = assemble_args_list(5, itoa(count), requests_str, itoa(*indx), itoa(*flag), status2str(status_p));
     RECORDER_INTERCEPTOR_EPILOGUE(5, args);
 }
 
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include "recorder.h"
+#include "recorder-node-helper.h"
+
+#define DEFAULT_RING_SIZE   (4*1024*1024)       // 4MB per process
+#define MIN_RING_SIZE       (1*1024*1024)
+#define CACHE_LINE_SIZE     64
+#define RING_HEADER_SIZE    (3*CACHE_LINE_SIZE)
+
+
+/*
+ * Single producer (the traced process) single consumer
+ * (the helper thread of the node leader) ring buffer.
+ *
+ * head and tail are monotonically increasing byte offsets,
+ * they are kept on different cache lines to avoid false sharing.
+ */
+typedef struct RingHeader_t {
+    uint64_t head;                  // only written by the producer
+    char     pad0[CACHE_LINE_SIZE-sizeof(uint64_t)];
+    uint64_t tail;                  // only written by the consumer
+    char     pad1[CACHE_LINE_SIZE-sizeof(uint64_t)];
+    uint64_t capacity;
+    int      closed;                // producer will not push anymore
+} RingHeader;
+
+/*
+ * Each entry is followed by the call signature key,
+ * and is padded to 8 bytes. size = 0 marks a wrap around.
+ */
+typedef struct RingEntry_t {
+    uint32_t size;
+    int32_t  key_len;
+    double   tstart, tend;
+} RingEntry;
+
+typedef struct NodeHelper_t {
+    bool        enabled;
+    MPI_Comm    node_comm;
+    MPI_Comm    leader_comm;        // MPI_COMM_NULL on non-leader processes
+    MPI_Win     win;
+    int         node_rank;
+    int         node_size;
+    RingHeader* ring;               // ring of this process
+
+    // Below are only used by the node leader
+    RingHeader**    rings;          // rings of all processes on this node
+    int*            world_ranks;
+    RecorderLogger* members;        // CST/CFG/timestamps of all processes on this node
+    pthread_t       thread;
+} NodeHelper;
+
+static NodeHelper helper = { .enabled = false };
+
+
+static inline char* ring_data(RingHeader* ring) {
+    return ((char*)ring) + RING_HEADER_SIZE;
+}
+
+/*
+ * Consume all available entries of the i-th ring.
+ * Return true if any entry has been consumed.
+ */
+static bool drain_ring(int i) {
+    RingHeader* ring = helper.rings[i];
+    char* data = ring_data(ring);
+
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(tail == head)
+        return false;
+
+    while(tail != head) {
+        uint64_t pos = tail % ring->capacity;
+        RingEntry* entry = (RingEntry*) (data + pos);
+        if(entry->size == 0) {
+            tail += ring->capacity - pos;
+            continue;
+        }
+
+        // logger_append_record() takes the ownership of the key
+        char* key = recorder_malloc(entry->key_len);
+        memcpy(key, entry+1, entry->key_len);
+        logger_append_record(&helper.members[i], key, entry->key_len, entry->tstart, entry->tend);
+
+        tail += entry->size;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void* helper_thread_main(void* arg) {
+    struct timespec backoff = {0, 50000};   // 50us
+
+    while(true) {
+        bool progress = false;
+        bool all_closed = true;
+
+        for(int i = 0; i < helper.node_size; i++) {
+            // Check closed before draining, so everything
+            // pushed before close is guaranteed to be consumed.
+            int closed = __atomic_load_n(&helper.rings[i]->closed, __ATOMIC_ACQUIRE);
+            if(drain_ring(i))
+                progress = true;
+            if(!closed)
+                all_closed = false;
+        }
+
+        if(all_closed && !progress)
+            break;
+        if(!progress)
+            nanosleep(&backoff, NULL);
+    }
+
+    return NULL;
+}
+
+/*
+ * Initialize the per-process state maintained by the leader
+ * as if it were the logger of that process.
+ */
+static void init_member(RecorderLogger* member, RecorderLogger* logger, int world_rank, double start_ts) {
+    *member = *logger;
+    member->rank = world_rank;
+    member->cst  = NULL;
+    sequitur_init(&member->cfg);
+    member->current_cfg_terminal = 0;
+    member->prev_tstart = start_ts;
+    member->ts = recorder_malloc(sizeof(uint32_t) * logger->ts_max_elements);
+    member->ts_index = 0;
+
+    sprintf(member->cst_path, "%s/%d.cst", logger->traces_dir, world_rank);
+    sprintf(member->cfg_path, "%s/%d.cfg", logger->traces_dir, world_rank);
+
+    char ts_filename[1024];
+    sprintf(ts_filename, "%s/%d.ts", logger->traces_dir, world_rank);
+    member->ts_file = RECORDER_REAL_CALL(fopen) (ts_filename, "wb");
+}
+
+/*
+ * Collective call over MPI_COMM_WORLD
+ * Must be called after the traces directory is created.
+ */
+void node_helper_init(RecorderLogger* logger) {
+    size_t capacity = DEFAULT_RING_SIZE;
+    const char* buffer_size_str = getenv(RECORDER_NODE_HELPER_BUFFER);
+    if(buffer_size_str)
+        capacity = (size_t) strtoull(buffer_size_str, NULL, 10) * 1024 * 1024;
+    if(capacity < MIN_RING_SIZE)
+        capacity = MIN_RING_SIZE;
+
+    PMPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, logger->rank, MPI_INFO_NULL, &helper.node_comm);
+    PMPI_Comm_rank(helper.node_comm, &helper.node_rank);
+    PMPI_Comm_size(helper.node_comm, &helper.node_size);
+
+    int color = (helper.node_rank == 0) ? 0 : MPI_UNDEFINED;
+    PMPI_Comm_split(MPI_COMM_WORLD, color, logger->rank, &helper.leader_comm);
+
+    void* base;
+    PMPI_Win_allocate_shared(RING_HEADER_SIZE+capacity, 1, MPI_INFO_NULL, helper.node_comm, &base, &helper.win);
+    PMPI_Win_lock_all(MPI_MODE_NOCHECK, helper.win);
+
+    helper.ring = (RingHeader*) base;
+    memset(helper.ring, 0, sizeof(RingHeader));
+    helper.ring->capacity = capacity;
+
+    // The leader needs the world rank and the local start
+    // time (for timestamp delta) of every process on the node
+    double* start_times = NULL;
+    if(helper.node_rank == 0) {
+        helper.world_ranks = recorder_malloc(sizeof(int) * helper.node_size);
+        start_times = recorder_malloc(sizeof(double) * helper.node_size);
+    }
+    PMPI_Gather(&logger->rank, 1, MPI_INT, helper.world_ranks, 1, MPI_INT, 0, helper.node_comm);
+    PMPI_Gather(&logger->prev_tstart, 1, MPI_DOUBLE, start_times, 1, MPI_DOUBLE, 0, helper.node_comm);
+
+    // Make sure all ring headers are initialized
+    PMPI_Win_sync(helper.win);
+    PMPI_Barrier(helper.node_comm);
+
+    if(helper.node_rank == 0) {
+        helper.rings   = recorder_malloc(sizeof(RingHeader*) * helper.node_size);
+        helper.members = recorder_malloc(sizeof(RecorderLogger) * helper.node_size);
+        for(int i = 0; i < helper.node_size; i++) {
+            MPI_Aint size;
+            int disp_unit;
+            PMPI_Win_shared_query(helper.win, i, &size, &disp_unit, &helper.rings[i]);
+            init_member(&helper.members[i], logger, helper.world_ranks[i], start_times[i]);
+        }
+        recorder_free(start_times, sizeof(double) * helper.node_size);
+
+        pthread_create(&helper.thread, NULL, helper_thread_main, NULL);
+    }
+
+    helper.enabled = true;
+}
+
+bool node_helper_enabled() {
+    return helper.enabled;
+}
+
+/*
+ * Push one record into the ring of this process,
+ * wait if there is not enough space.
+ * The caller needs to hold g_mutex.
+ */
+void node_helper_push(const char* key, int key_len, double tstart, double tend) {
+    RingHeader* ring = helper.ring;
+    char* data = ring_data(ring);
+    uint64_t capacity = ring->capacity;
+
+    uint32_t size = (sizeof(RingEntry) + key_len + 7) & ~7;
+    if(size > capacity) {
+        fprintf(stderr, "[Recorder] record of size %u exceeds the node helper buffer, dropped\n", size);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t pos  = head % capacity;
+    uint64_t needed = size;
+    if(capacity - pos < size)           // not enough contiguous space, wrap around
+        needed += capacity - pos;
+
+    while(head + needed - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > capacity)
+        sched_yield();
+
+    if(capacity - pos < size) {
+        ((RingEntry*) (data + pos))->size = 0;
+        head += capacity - pos;
+        pos = 0;
+    }
+
+    RingEntry* entry = (RingEntry*) (data + pos);
+    entry->size    = size;
+    entry->key_len = key_len;
+    entry->tstart  = tstart;
+    entry->tend    = tend;
+    memcpy(entry+1, key, key_len);
+
+    __atomic_store_n(&ring->head, head+size, __ATOMIC_RELEASE);
+}
+
+static void save_members_merged(RecorderLogger* logger) {
+    // 1. Merge CSTs within the node, then across node leaders
+    CallSignature* node_cst = NULL;
+    for(int i = 0; i < helper.node_size; i++)
+        merge_cst(&node_cst, helper.members[i].cst);
+
+    CallSignature* compressed_cst = compress_csts(node_cst, helper.leader_comm);
+    cleanup_cst(node_cst);
+
+    // 2. Rank 0 (always the leader of its node) writes out the merged CST
+    CallSignature* merged_cst = bcast_merged_cst(compressed_cst, logger->cst_path, helper.leader_comm);
+
+    // 3. Update terminal ids and save unique grammars
+    Grammar* grammars[helper.node_size];
+    for(int i = 0; i < helper.node_size; i++) {
+        update_cfg_terminals(&helper.members[i], merged_cst);
+        grammars[i] = &helper.members[i].cfg;
+    }
+    cleanup_cst(merged_cst);
+
+    sequitur_save_unique_grammars(logger->traces_dir, grammars, helper.world_ranks,
+                                  helper.node_size, logger->nprocs, helper.leader_comm);
+}
+
+/*
+ * Collective call over MPI_COMM_WORLD
+ */
+void node_helper_finalize(RecorderLogger* logger) {
+    __atomic_store_n(&helper.ring->closed, 1, __ATOMIC_RELEASE);
+
+    if(helper.node_rank == 0) {
+        pthread_join(helper.thread, NULL);
+
+        for(int i = 0; i < helper.node_size; i++) {
+            RecorderLogger* member = &helper.members[i];
+            if(member->ts_index > 0)
+                RECORDER_REAL_CALL(fwrite)(member->ts, sizeof(uint32_t), member->ts_index, member->ts_file);
+            RECORDER_REAL_CALL(fflush)(member->ts_file);
+            RECORDER_REAL_CALL(fclose)(member->ts_file);
+            recorder_free(member->ts, sizeof(uint32_t)*member->ts_max_elements);
+        }
+
+        if(logger->interprocess_compression) {
+            save_members_merged(logger);
+        } else {
+            for(int i = 0; i < helper.node_size; i++) {
+                save_cst_local(&helper.members[i]);
+                save_cfg_local(&helper.members[i]);
+            }
+        }
+
+        for(int i = 0; i < helper.node_size; i++) {
+            cleanup_cst(helper.members[i].cst);
+            sequitur_cleanup(&helper.members[i].cfg);
+        }
+        recorder_free(helper.members, sizeof(RecorderLogger) * helper.node_size);
+        recorder_free(helper.rings, sizeof(RingHeader*) * helper.node_size);
+        recorder_free(helper.world_ranks, sizeof(int) * helper.node_size);
+
+        PMPI_Comm_free(&helper.leader_comm);
+    }
+
+    PMPI_Win_unlock_all(helper.win);
+    PMPI_Win_free(&helper.win);
+    PMPI_Comm_free(&helper.node_comm);
+
+    helper.enabled = false;
+}
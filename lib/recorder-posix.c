@@ -79,9 +79,22 @@ typedef struct stream_map {
     UT_hash_handle hh;
 } stream_map_t;
 
+/*
+ * Current offset of an open file description, shared by the
+ * descriptors dup()'ed from it. It is not tracked in append mode
+ * or once a stream is opened on it (fdopen), as the kernel or the
+ * stream moves it, then we ask the kernel instead.
+ */
+typedef struct file_pos {
+    off64_t offset;
+    int     tracked;
+    int     refs;
+} file_pos_t;
+
 typedef struct fd_map {
     char* filename;
     int fd;             // key
+    file_pos_t* pos;
     UT_hash_handle hh;
 } fd_map_t;
 
@@ -152,6 +165,10 @@ inline void add_to_map(char* filename, void* arg, int arg_type) {
         fd_map_t *entry = malloc(sizeof(fd_map_t));
         entry->fd = *((int*) arg);
         entry->filename = realrealpath(filename);
+        entry->pos = malloc(sizeof(file_pos_t));
+        entry->pos->offset = 0;
+        entry->pos->tracked = 1;
+        entry->pos->refs = 1;
         HASH_ADD_INT(fd2name_map, fd, entry);
     }
 }
@@ -163,6 +180,8 @@ inline void remove_from_map(void* arg, int arg_type) {
         HASH_FIND_INT(fd2name_map, &fd, entry);
         if(entry) {
             HASH_DEL(fd2name_map, entry);
+            if(--entry->pos->refs == 0)
+                free(entry->pos);
             free(entry->filename);
             free(entry);
         }
@@ -179,6 +198,85 @@ inline void remove_from_map(void* arg, int arg_type) {
     }
 }
 
+static inline file_pos_t* fd2pos(int fd) {
+    fd_map_t *entry = NULL;
+    HASH_FIND_INT(fd2name_map, &fd, entry);
+    return entry ? entry->pos : NULL;
+}
+
+/*
+ * newfd is a duplicate of oldfd, both
+ * have been added to the map already.
+ */
+static void share_file_pos(int oldfd, int newfd) {
+    fd_map_t *old_entry = NULL, *new_entry = NULL;
+    HASH_FIND_INT(fd2name_map, &oldfd, old_entry);
+    HASH_FIND_INT(fd2name_map, &newfd, new_entry);
+    if(!old_entry || !new_entry || old_entry == new_entry)
+        return;
+    if(--new_entry->pos->refs == 0)
+        free(new_entry->pos);
+    new_entry->pos = old_entry->pos;
+    new_entry->pos->refs++;
+}
+
+static void set_file_pos_tracked(int fd, int tracked) {
+    file_pos_t* pos = fd2pos(fd);
+    if(pos)
+        pos->tracked = tracked;
+}
+
+static void set_file_pos(int fd, off64_t offset) {
+    file_pos_t* pos = fd2pos(fd);
+    if(pos && offset >= 0)
+        pos->offset = offset;
+}
+
+/*
+ * Called after a read or write at the current offset of fd that
+ * transferred the given bytes. Advance the offset and return
+ * where the transfer started, -1 if unknown.
+ */
+static off64_t advance_file_pos(int fd, ssize_t bytes) {
+    file_pos_t* pos = fd2pos(fd);
+    if(!pos)
+        return -1;
+    if(bytes < 0)
+        bytes = 0;
+
+    if(!pos->tracked) {
+        MAP_OR_FAIL(lseek64);
+        off64_t cur = RECORDER_REAL_CALL(lseek64)(fd, 0, SEEK_CUR);
+        return cur < 0 ? -1 : cur - bytes;
+    }
+    off64_t offset = pos->offset;
+    pos->offset += bytes;
+    return offset;
+}
+
+/*
+ * Same for streams, the position includes
+ * what is buffered, ftello() is cheap.
+ */
+static off64_t stream_start_pos(FILE* stream, ssize_t bytes) {
+    MAP_OR_FAIL(ftello);
+    off64_t cur = RECORDER_REAL_CALL(ftello)(stream);
+    if(bytes < 0)
+        bytes = 0;
+    return cur < 0 ? -1 : cur - bytes;
+}
+
+/*
+ * Data records at the file pointer carry the offset as their last
+ * argument, unless RECORDER_LOG_OFFSET=0. The argument count is
+ * given by OFFSET_ARGS(n), offset_arg() is NULL without it.
+ */
+#define OFFSET_ARGS(n)  ((n) + recorder_log_offset())
+
+static inline char* offset_arg(off64_t offset) {
+    return recorder_log_offset() ? itoa(offset) : NULL;
+}
+
 
 int RECORDER_POSIX_DECL(close)(int fd) {
     GET_CHECK_FILENAME(close, (fd), &fd, ARG_TYPE_FD);
@@ -259,6 +357,7 @@ int RECORDER_POSIX_DECL(open64)(const char *path, int flags, ...) {
         GET_CHECK_FILENAME(open64, (path, flags, mode), path, ARG_TYPE_PATH);
         RECORDER_INTERCEPTOR_PROLOGUE(int, open64, (path, flags, mode));
         add_to_map(_fname, &res, ARG_TYPE_FD);
+        set_file_pos_tracked(res, !(flags & O_APPEND));
         char** args = assemble_args_list(3, _fname, itoa(flags), itoa(mode));
         RECORDER_INTERCEPTOR_EPILOGUE(3, args);
 
@@ -266,6 +365,7 @@ int RECORDER_POSIX_DECL(open64)(const char *path, int flags, ...) {
         GET_CHECK_FILENAME(open64, (path, flags), path, ARG_TYPE_PATH);
         RECORDER_INTERCEPTOR_PROLOGUE(int, open64, (path, flags));
         add_to_map(_fname, &res, ARG_TYPE_FD);
+        set_file_pos_tracked(res, !(flags & O_APPEND));
         char** args = assemble_args_list(2, _fname, itoa(flags));
         RECORDER_INTERCEPTOR_EPILOGUE(2, args);
     }
@@ -280,12 +380,14 @@ int RECORDER_POSIX_DECL(open)(const char *path, int flags, ...) {
         GET_CHECK_FILENAME(open, (path, flags, mode), path, ARG_TYPE_PATH);
         RECORDER_INTERCEPTOR_PROLOGUE(int, open, (path, flags, mode));
         add_to_map(_fname, &res, ARG_TYPE_FD);
+        set_file_pos_tracked(res, !(flags & O_APPEND));
         char** args = assemble_args_list(3, _fname, itoa(flags), itoa(mode));
         RECORDER_INTERCEPTOR_EPILOGUE(3, args);
     } else {
         GET_CHECK_FILENAME(open, (path, flags), path, ARG_TYPE_PATH);
         RECORDER_INTERCEPTOR_PROLOGUE(int, open, (path, flags));
         add_to_map(_fname, &res, ARG_TYPE_FD);
+        set_file_pos_tracked(res, !(flags & O_APPEND));
         char** args = assemble_args_list(2, _fname, itoa(flags));
         RECORDER_INTERCEPTOR_EPILOGUE(2, args);
     }
@@ -414,8 +516,9 @@ ssize_t RECORDER_POSIX_DECL(readv)(int fd, const struct iovec *iov, int iovcnt)
     for (i = 0; i < iovcnt; i++)
         total += iov[i].iov_len;
     RECORDER_INTERCEPTOR_PROLOGUE(ssize_t, readv, (fd, iov, iovcnt));
-    char** args = assemble_args_list(3, _fname, itoa(total), itoa(iovcnt));
-    RECORDER_INTERCEPTOR_EPILOGUE(3, args);
+    off64_t offset = advance_file_pos(fd, res);
+    char** args = assemble_args_list(OFFSET_ARGS(3), _fname, itoa(total), itoa(iovcnt), offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(3), args);
 }
 
 ssize_t RECORDER_POSIX_DECL(writev)(int fd, const struct iovec *iov, int iovcnt) {
@@ -426,15 +529,17 @@ ssize_t RECORDER_POSIX_DECL(writev)(int fd, const struct iovec *iov, int iovcnt)
     for (i = 0; i < iovcnt; i++)
         total += iov[i].iov_len;
     RECORDER_INTERCEPTOR_PROLOGUE(ssize_t, writev, (fd, iov, iovcnt));
-    char** args = assemble_args_list(3, _fname, itoa(total), itoa(iovcnt));
-    RECORDER_INTERCEPTOR_EPILOGUE(3, args);
+    off64_t offset = advance_file_pos(fd, res);
+    char** args = assemble_args_list(OFFSET_ARGS(3), _fname, itoa(total), itoa(iovcnt), offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(3), args);
 }
 
 size_t RECORDER_POSIX_DECL(fread)(void *ptr, size_t size, size_t nmemb, FILE *stream) {
     GET_CHECK_FILENAME(fread, (ptr, size, nmemb, stream), stream, ARG_TYPE_STREAM);
     RECORDER_INTERCEPTOR_PROLOGUE(size_t, fread, (ptr, size, nmemb, stream));
-    char** args = assemble_args_list(4, ptoa(ptr), itoa(size), itoa(nmemb), _fname);
-    RECORDER_INTERCEPTOR_EPILOGUE(4, args);
+    off64_t offset = stream_start_pos(stream, res * size);
+    char** args = assemble_args_list(OFFSET_ARGS(4), ptoa(ptr), itoa(size), itoa(nmemb), _fname, offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(4), args);
 }
 
 size_t RECORDER_POSIX_DECL(fwrite)(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
@@ -444,8 +549,9 @@ size_t RECORDER_POSIX_DECL(fwrite)(const void *ptr, size_t size, size_t nmemb, F
     //    aligned_flag = 1;
     GET_CHECK_FILENAME(fwrite, (ptr, size, nmemb, stream), stream, ARG_TYPE_STREAM);
     RECORDER_INTERCEPTOR_PROLOGUE(size_t, fwrite, (ptr, size, nmemb, stream));
-    char** args = assemble_args_list(4, ptoa(ptr), itoa(size), itoa(nmemb), _fname);
-    RECORDER_INTERCEPTOR_EPILOGUE(4, args);
+    off64_t offset = stream_start_pos(stream, res * size);
+    char** args = assemble_args_list(OFFSET_ARGS(4), ptoa(ptr), itoa(size), itoa(nmemb), _fname, offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(4), args);
 }
 
 int RECORDER_POSIX_DECL(fprintf)(FILE *stream, const char *format, ...) {
@@ -459,22 +565,25 @@ int RECORDER_POSIX_DECL(fprintf)(FILE *stream, const char *format, ...) {
     GET_CHECK_FILENAME(vfprintf, (stream, format, fprintf_args), stream, ARG_TYPE_STREAM);
     RECORDER_INTERCEPTOR_PROLOGUE(size_t, vfprintf, (stream, format, fprintf_args));
     va_end(fprintf_args);
-    char** args = assemble_args_list(2, _fname, itoa(size));
-    RECORDER_INTERCEPTOR_EPILOGUE(2, args);
+    off64_t offset = stream_start_pos(stream, (int) res);
+    char** args = assemble_args_list(OFFSET_ARGS(2), _fname, itoa(size), offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(2), args);
 }
 
 ssize_t RECORDER_POSIX_DECL(read)(int fd, void *buf, size_t count) {
     GET_CHECK_FILENAME(read, (fd, buf, count), &fd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(ssize_t, read, (fd, buf, count));
-    char** args = assemble_args_list(3, _fname, ptoa(buf), itoa(count));
-    RECORDER_INTERCEPTOR_EPILOGUE(3, args);
+    off64_t offset = advance_file_pos(fd, res);
+    char** args = assemble_args_list(OFFSET_ARGS(3), _fname, ptoa(buf), itoa(count), offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(3), args);
 }
 
 ssize_t RECORDER_POSIX_DECL(write)(int fd, const void *buf, size_t count) {
     GET_CHECK_FILENAME(write, (fd, buf, count), &fd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(ssize_t, write, (fd, buf, count));
-    char** args = assemble_args_list(3, _fname, ptoa(buf), itoa(count));
-    RECORDER_INTERCEPTOR_EPILOGUE(3, args);
+    off64_t offset = advance_file_pos(fd, res);
+    char** args = assemble_args_list(OFFSET_ARGS(3), _fname, ptoa(buf), itoa(count), offset_arg(offset));
+    RECORDER_INTERCEPTOR_EPILOGUE(OFFSET_ARGS(3), args);
 }
 
 int RECORDER_POSIX_DECL(fseek)(FILE *stream, long offset, int whence) {
@@ -499,6 +608,7 @@ extern
 off64_t RECORDER_POSIX_DECL(lseek64)(int fd, off64_t offset, int whence) {
     GET_CHECK_FILENAME(lseek64, (fd, offset, whence), &fd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(off64_t, lseek64, (fd, offset, whence));
+    set_file_pos(fd, res);
 
     off64_t stored_offset = offset;
 
@@ -521,6 +631,7 @@ extern
 off_t RECORDER_POSIX_DECL(lseek)(int fd, off_t offset, int whence) {
     GET_CHECK_FILENAME(lseek, (fd, offset, whence), &fd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(off_t, lseek, (fd, offset, whence));
+    set_file_pos(fd, res);
     char** args = assemble_args_list(3, _fname, itoa(offset), itoa(whence));
     RECORDER_INTERCEPTOR_EPILOGUE(3, args);
 }
@@ -668,6 +779,8 @@ int RECORDER_POSIX_DECL(fcntl)(int fd, int cmd, ...) {
         GET_CHECK_FILENAME(fcntl, (fd, cmd, val), &fd, ARG_TYPE_FD);
 
         RECORDER_INTERCEPTOR_PROLOGUE(int, fcntl, (fd, cmd, val));
+        if(cmd == F_SETFL && res != -1)
+            set_file_pos_tracked(fd, !(val & O_APPEND));
         char** args = assemble_args_list(3, _fname, itoa(cmd), itoa(val));
         RECORDER_INTERCEPTOR_EPILOGUE(3, args);
     } else if(cmd==F_GETFD || cmd==F_GETFL || cmd==F_GETOWN) {                     // arg: void
@@ -700,14 +813,22 @@ int RECORDER_POSIX_DECL(fcntl)(int fd, int cmd, ...) {
 int RECORDER_POSIX_DECL(dup)(int oldfd) {
     GET_CHECK_FILENAME(dup, (oldfd), &oldfd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(int, dup, (oldfd));
-    add_to_map(_fname, &res, ARG_TYPE_FD);
+    if(res != -1) {
+        add_to_map(_fname, &res, ARG_TYPE_FD);
+        share_file_pos(oldfd, res);
+    }
     char** args = assemble_args_list(1, itoa(oldfd));
     RECORDER_INTERCEPTOR_EPILOGUE(1, args);
 }
 int RECORDER_POSIX_DECL(dup2)(int oldfd, int newfd) {
     GET_CHECK_FILENAME(dup2, (oldfd, newfd), &oldfd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(int, dup2, (oldfd, newfd));
-    add_to_map(_fname, &res, ARG_TYPE_FD);
+    // newfd was closed if it was open
+    if(res != -1 && res != oldfd) {
+        remove_from_map(&res, ARG_TYPE_FD);
+        add_to_map(_fname, &res, ARG_TYPE_FD);
+        share_file_pos(oldfd, res);
+    }
     char** args = assemble_args_list(2, itoa(oldfd), itoa(newfd));
     RECORDER_INTERCEPTOR_EPILOGUE(2, args);
 }
@@ -733,6 +854,7 @@ FILE* RECORDER_POSIX_DECL(fdopen)(int fd, const char *mode) {
     GET_CHECK_FILENAME(fdopen, (fd, mode), &fd, ARG_TYPE_FD);
     RECORDER_INTERCEPTOR_PROLOGUE(FILE*, fdopen, (fd, mode));
     add_to_map(_fname, res, ARG_TYPE_STREAM);
+    set_file_pos_tracked(fd, 0);
     char** args = assemble_args_list(2, _fname, strdup(mode));
     RECORDER_INTERCEPTOR_EPILOGUE(2, args);
 }
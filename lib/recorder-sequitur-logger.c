@@ -164,36 +164,75 @@ Grammar* compress_grammars(Grammar *lg, int mpi_rank, int mpi_size, size_t *unco
     return grammar;
 }
 
-void sequitur_save_unique_grammars(const char* path, Grammar* lg, int mpi_rank, int mpi_size) {
-    int grammar_ids[mpi_size];
+/*
+ * Gather grammars to the root (rank 0 of comm) and store only
+ * the unique ones. Each process can contribute more than one grammar,
+ * grammars[i] is the grammar of the process whose global rank
+ * is ranks[i]. total_ranks is the number of all traced processes.
+ */
+void sequitur_save_unique_grammars(const char* path, Grammar** grammars, int* ranks, int num_grammars,
+                                   int total_ranks, MPI_Comm comm) {
+    int comm_rank, comm_size;
+    PMPI_Comm_rank(comm, &comm_rank);
+    PMPI_Comm_size(comm, &comm_size);
+
+    // Serialize local grammars into one stream:
+    // [rank, integers, serialized grammar] for each grammar
     int integers = 0;
-    int *local_grammar = serialize_grammar(lg, &integers);
+    int *serialized[num_grammars];
+    int lens[num_grammars];
+    for(int i = 0; i < num_grammars; i++) {
+        serialized[i] = serialize_grammar(grammars[i], &lens[i]);
+        integers += 2 + lens[i];
+    }
 
-    int recvcounts[mpi_size], displs[mpi_size];
-    PMPI_Gather(&integers, 1, MPI_INT, recvcounts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int *local_grammars = recorder_malloc(sizeof(int) * integers);
+    int pos = 0;
+    for(int i = 0; i < num_grammars; i++) {
+        local_grammars[pos++] = ranks[i];
+        local_grammars[pos++] = lens[i];
+        memcpy(local_grammars+pos, serialized[i], sizeof(int)*lens[i]);
+        pos += lens[i];
+        recorder_free(serialized[i], sizeof(int)*lens[i]);
+    }
+
+    int recvcounts[comm_size], displs[comm_size];
+    PMPI_Gather(&integers, 1, MPI_INT, recvcounts, 1, MPI_INT, 0, comm);
 
     displs[0] = 0;
     size_t gathered_integers = recvcounts[0];
-    for(int i = 1; i < mpi_size;i++) {
+    for(int i = 1; i < comm_size;i++) {
         gathered_integers += recvcounts[i];
         displs[i] = displs[i-1] + recvcounts[i-1];
     }
 
     int *gathered_grammars = NULL;
-    if(mpi_rank == 0)
+    if(comm_rank == 0)
         gathered_grammars = recorder_malloc(sizeof(int) * gathered_integers);
 
-    PMPI_Gatherv(local_grammar, integers, MPI_INT, gathered_grammars, recvcounts, displs, MPI_INT, 0, MPI_COMM_WORLD);
-    recorder_free(local_grammar, sizeof(int)*integers);
+    PMPI_Gatherv(local_grammars, integers, MPI_INT, gathered_grammars, recvcounts, displs, MPI_INT, 0, comm);
+    recorder_free(local_grammars, sizeof(int)*integers);
+
+    if(comm_rank !=0) return;
+
+    // Locate the serialized grammar of each rank
+    int* rank_grammars[total_ranks];
+    int  rank_grammar_lens[total_ranks];
+    for(size_t k = 0; k < gathered_integers; ) {
+        int rank = gathered_grammars[k++];
+        rank_grammar_lens[rank] = gathered_grammars[k++];
+        rank_grammars[rank] = gathered_grammars + k;
+        k += rank_grammar_lens[rank];
+    }
 
-    if(mpi_rank !=0) return;
+    int grammar_ids[total_ranks];
 
     // Go through each rank's grammar
-    for(int rank = 0; rank < mpi_size; rank++) {
+    for(int rank = 0; rank < total_ranks; rank++) {
 
         // Serialized grammar
-        int* g = gathered_grammars + displs[rank];
-        int g_len = recvcounts[rank] * sizeof(int);
+        int* g = rank_grammars[rank];
+        int g_len = rank_grammar_lens[rank] * sizeof(int);
         //printf("rank: %d, grammar lengh: %d\n", rank, g_len);
 
         UniqueGrammar *ug_entry = NULL;
@@ -228,11 +267,12 @@ void sequitur_save_unique_grammars(const char* path, Grammar* lg, int mpi_rank,
         HASH_DEL(unique_grammars, ug);
         recorder_free(ug, sizeof(UniqueGrammar));
     }
+    recorder_free(gathered_grammars, sizeof(int)*gathered_integers);
 
     char ug_metadata_fname[1096] = {0};
     sprintf(ug_metadata_fname, "%s/ug.mt", path);
     FILE* f = fopen(ug_metadata_fname, "wb");
-    fwrite(grammar_ids, sizeof(int), mpi_size, f);
+    fwrite(grammar_ids, sizeof(int), total_ranks, f);
     fwrite(&num_unique_grammars, sizeof(int), 1, f);
     fflush(f);
     fclose(f);
@@ -11,6 +11,7 @@
 
 // Log pointer addresses in the trace file?
 static bool   log_pointer = false;
+static int    log_offset = 1;
 static size_t memory_usage = 0;
 
 
@@ -98,6 +99,9 @@ void utils_init() {
     const char* s = getenv(RECORDER_LOG_POINTER);
     if(s)
         log_pointer = atoi(s);
+    s = getenv(RECORDER_LOG_OFFSET);
+    if(s)
+        log_offset = (atoi(s) != 0);
 
     exclusion_prefix = NULL;
     inclusion_prefix = NULL;
@@ -130,13 +134,21 @@ void* recorder_malloc(size_t size) {
     if(size == 0)
         return NULL;
 
-    memory_usage += size;
+    __sync_fetch_and_add(&memory_usage, size);   // the node helper thread also allocates
     return malloc(size);
 }
+size_t recorder_memory_usage() {
+    return memory_usage;
+}
+
+int recorder_log_offset() {
+    return log_offset;
+}
+
 void recorder_free(void* ptr, size_t size) {
     if(size == 0 || ptr == NULL)
         return;
-    memory_usage -= size;
+    __sync_fetch_and_sub(&memory_usage, size);
 
     free(ptr);
     ptr = NULL;
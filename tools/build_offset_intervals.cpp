@@ -5,6 +5,7 @@
 #include <string>
 #include <unordered_map>
 #include <algorithm>
+#include <unistd.h>
 extern "C" {                            // Needed to mix linking C and C++ sources
 #include "reader.h"
 }
@@ -14,12 +15,12 @@ using namespace std;
 typedef struct RRecord_t {
     int rank;
     int seq_id;
-    Record* record;
+    double tstart;
+    const Record* record;   // call signature template, see RecordView
 } RRecord;
 
 
 RecorderReader *reader;
-vector<RRecord> records;
 
 static inline size_t str2sizet(char* arg) {
     size_t res;
@@ -43,65 +44,49 @@ void handle_data_operation(RRecord &rr,
                             unordered_map<string, vector<Interval>> &intervals,
                             string current_mpifh, int current_mpi_call_depth)
 {
-    Record *R = rr.record;
-    const char* func = recorder_get_func_name(reader, R);
+    const Record *R = rr.record;
+    const RecorderFuncDesc* desc = recorder_get_func_desc(reader, R);
 
-    if(!strstr(func, "read") && !strstr(func, "write"))
+    if(desc->op != RECORDER_OP_READ && desc->op != RECORDER_OP_WRITE)
         return;
 
     Interval I;
     I.rank = rr.rank;
     I.seqId = rr.seq_id;
-    I.tstart = R->tstart;
-    I.isRead = strstr(func, "read") ? true: false;
+    I.tstart = rr.tstart;
+    I.isRead = (desc->op == RECORDER_OP_READ);
     memset(I.mpifh, 0, sizeof(I.mpifh));
     strcpy(I.mpifh, "-");
 
     if(R->level == current_mpi_call_depth+1)
         strcpy(I.mpifh, current_mpifh.c_str());
 
-    string filename = "";
-    if(strstr(func, "writev") || strstr(func, "readv")) {
-        filename = R->args[0];
-        I.offset = offset_book[filename];
-        I.count = str2sizet(R->args[1]);
-        offset_book[filename] += I.count;
-    } else if(strstr(func, "fwrite") || strstr(func, "fread")) {
-        filename = R->args[3];
-        I.offset = offset_book[filename];
-        I.count = str2sizet(R->args[1]) * str2sizet(R->args[2]);
-        offset_book[filename] += I.count;
-    } else if(strstr(func, "pwrite") || strstr(func, "pread")) {
-        filename = R->args[0];
-        I.count = str2sizet(R->args[2]);
-        I.offset = str2sizet(R->args[3]);
-    } else if(strstr(func, "write") || strstr(func, "read")) {
-        filename = R->args[0];
-        I.count = str2sizet(R->args[2]);
+    // read, write, readv, writev, fread, fwrite, vfprintf
+    // are at the file pointer and move it
+    string filename = R->args[desc->file_arg];
+    I.count = str2sizet(R->args[desc->count_arg]);
+    if(desc->size_arg >= 0)
+        I.count *= str2sizet(R->args[desc->size_arg]);
+    if(!desc->at_pointer && desc->offset_arg >= 0 && desc->offset_arg < R->arg_count) {
+        I.offset = str2sizet(R->args[desc->offset_arg]);
+    } else {
         I.offset = offset_book[filename];
         offset_book[filename] += I.count;
-    } else if(strstr(func, "fprintf")) {
-        filename = R->args[0];
-        I.count = str2sizet(R->args[1]);
-        offset_book[filename] += I.count;
     }
 
-    if(filename != "") {
-
-        if(local_eof.find(filename) == local_eof.end())
-            local_eof[filename] = I.offset + I.count;
-        else
-            local_eof[filename] = max(local_eof[filename], I.offset+I.count);
+    if(local_eof.find(filename) == local_eof.end())
+        local_eof[filename] = I.offset + I.count;
+    else
+        local_eof[filename] = max(local_eof[filename], I.offset+I.count);
 
-        /* TODO:
-         * On POSIX systems, update global eof now
-         * On other systems (e.,g with commit semantics
-         * and session semantics), update global eof at
-         * close/sync ? */
-        global_eof[filename] = get_eof(filename, local_eof, global_eof);
+    /* TODO:
+     * On POSIX systems, update global eof now
+     * On other systems (e.,g with commit semantics
+     * and session semantics), update global eof at
+     * close/sync ? */
+    global_eof[filename] = get_eof(filename, local_eof, global_eof);
 
-        intervals[filename].push_back(I);
-    }
+    intervals[filename].push_back(I);
 }
 
 /*
@@ -120,34 +105,29 @@ void handle_metadata_operation(RRecord &rr,
                                 unordered_map<string, size_t> &global_eof
                               )
 {
-    Record *R = rr.record;
-    const char* func = recorder_get_func_name(reader, R);
+    const Record *R = rr.record;
+    const RecorderFuncDesc* desc = recorder_get_func_desc(reader, R);
 
-    string filename = "";
+    if(desc->file_arg < 0)          // e.g., tmpfile(), msync()
+        return;
+    string filename = R->args[desc->file_arg];
 
-    if(strstr(func, "fopen") || strstr(func, "fdopen")) {
-        filename = R->args[0];
+    if(desc->op == RECORDER_OP_OPEN) {
         offset_book[filename] = 0;
 
         // append
-        if(strstr(R->args[1], "a"))
+        if(desc->mode_arg >= 0 && strchr(R->args[desc->mode_arg], 'a'))
             offset_book[filename] = get_eof(filename, local_eof, global_eof);
 
-    } else if(strstr(func, "open")) {
-        filename = R->args[0];
-        offset_book[filename] = 0;
-
         /* TODO: Do O_APPEND, SEEK_SET, ... have
          * the same value on this machine and the machine where
          * traces were collected? */
-        int flag = atoi(R->args[1]);
-        if(flag & O_APPEND)
+        if(desc->flags_arg >= 0 && (atoi(R->args[desc->flags_arg]) & O_APPEND))
             offset_book[filename] = get_eof(filename, local_eof, global_eof);
 
-    } else if(strstr(func, "seek") || strstr(func, "seeko")) {
-        filename = R->args[0];
-        size_t offset = str2sizet(R->args[1]);
-        int whence = atoi(R->args[2]);
+    } else if(desc->op == RECORDER_OP_SEEK && desc->whence_arg >= 0) {
+        size_t offset = str2sizet(R->args[desc->offset_arg]);
+        int whence = atoi(R->args[desc->whence_arg]);
 
         if(whence == SEEK_SET)
             offset_book[filename] = offset;
@@ -156,69 +136,190 @@ void handle_metadata_operation(RRecord &rr,
         else if(whence == SEEK_END)
             offset_book[filename] = get_eof(filename, local_eof, global_eof);
 
-    } else if(strstr(func, "close") || strstr(func, "sync")) {
-        filename = R->args[0];
-
+    } else if(desc->op == RECORDER_OP_CLOSE || desc->op == RECORDER_OP_SYNC) {
         // Update the global eof at close time
         global_eof[filename] = get_eof(filename, local_eof, global_eof);
 
         // Remove from the table
-        if(strstr(func, "close"))
+        if(desc->op == RECORDER_OP_CLOSE)
             offset_book.erase(filename);
-    } else {
-        return;
     }
 }
 
-bool compare_by_tstart(const RRecord &lhs, const RRecord &rhs) {
-    return lhs.record->tstart < rhs.record->tstart;
+/*
+ * Filter of the merge, evaluated once per call signature.
+ * seq ids still count the records filtered out.
+ */
+bool is_offset_related(const Record* r, void* arg) {
+
+    const RecorderFuncDesc* desc = recorder_get_func_desc(reader, r);
+
+    // For MPI-IO calls keep only MPI_File_write* and MPI_File_read*
+    if(desc->layer == RECORDER_MPIIO)
+        return desc->op == RECORDER_OP_READ || desc->op == RECORDER_OP_WRITE;
+
+    if(desc->layer != RECORDER_POSIX)
+        return false;
+
+    // Records missing from a recovered CST have no arguments
+    if(r->arg_count == 0 && desc->file_arg >= 0)
+        return false;
+
+    switch(desc->op) {
+        case RECORDER_OP_READ:
+        case RECORDER_OP_WRITE:
+        case RECORDER_OP_OPEN:
+        case RECORDER_OP_CLOSE:
+        case RECORDER_OP_SEEK:
+        case RECORDER_OP_SYNC:
+            return true;
+        default:
+            return false;
+    }
 }
 
-static int current_seq_id = 0;
+/*
+ * Offsets are replayed from the records of all ranks in
+ * tstart order, as appending or seeking to the end depends on
+ * what other ranks wrote. Needed for traces recorded without
+ * the offsets of calls at the file pointer.
+ */
+static void replay_intervals(unordered_map<string, vector<Interval>> &intervals) {
 
-void insert_one_record(Record* r, void* arg) {
+    // Records of all ranks in tstart order, streamed
+    RecorderFilter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.match = is_offset_related;
+    RecorderMerge* merge = recorder_merge_open(reader, &filter);
 
-    /* increase seq id before the checks
-     * so we always have the correct seq id
-     * when we insert a record */
-    current_seq_id++;
+    unordered_map<string, size_t> offset_books[reader->metadata.total_ranks];
+    unordered_map<string, size_t> local_eofs[reader->metadata.total_ranks];
+    unordered_map<string, size_t> global_eof;
 
-    int func_type = recorder_get_func_type(reader, r);
-    const char* func = recorder_get_func_name(reader, r);
+    string current_mpifh = "";
+    int current_mpi_call_depth;
 
-    if((func_type != RECORDER_POSIX) && (func_type != RECORDER_MPIIO))
-        return;
+    RecordView view;
+    RRecord rr;
+    while(recorder_merge_next(merge, &view, &rr.rank)) {
+        rr.seq_id = view.seq_id;
+        rr.tstart = view.tstart;
+        rr.record = view.tmpl;
+        // Only MPI_File_write* and MPI_File_read* calls here
+        // thanks to is_offset_related()
+        if(recorder_get_func_type(reader, rr.record) == RECORDER_MPIIO) {
+            current_mpifh = rr.record->args[0];
+            current_mpi_call_depth = (int) rr.record->level;
+        // POSIX calls
+        } else {
+            handle_metadata_operation(rr, offset_books[rr.rank], local_eofs[rr.rank], global_eof);
+            handle_data_operation(rr, offset_books[rr.rank], local_eofs[rr.rank], global_eof, intervals, current_mpifh, current_mpi_call_depth);
+        }
+    }
+    recorder_merge_close(merge);
+}
 
-    // For MPI-IO calls keep only MPI_File_write* and MPI_File_read*
-    if((func_type == RECORDER_MPIIO) && (!strstr(func, "MPI_File_write")) 
-        && (!strstr(func, "MPI_File_read")) && (!strstr(func, "MPI_File_iread"))
-        && (!strstr(func, "MPI_File_iwrite")))
+/*
+ * When every read and write carries its offset, an interval
+ * is a projection of one record, so ranks are independent and
+ * decoded in parallel. Each thread collects its own intervals.
+ */
+typedef struct ProjectContext_t {
+    unordered_map<string, vector<Interval>> intervals;
+    int rank;
+    string current_mpifh;
+    int current_mpi_call_depth;
+    RecorderFileOffsets* offsets;
+    bool complete;              // no record without its offset so far
+} ProjectContext;
+
+static void project_begin_rank(int rank, void* ctx) {
+    ProjectContext* pc = (ProjectContext*) ctx;
+    pc->rank = rank;
+    pc->current_mpifh = "";
+    pc->current_mpi_call_depth = -2;
+    pc->offsets = recorder_new_file_offsets();
+}
+
+static void project_end_rank(int rank, void* ctx) {
+    ProjectContext* pc = (ProjectContext*) ctx;
+    recorder_free_file_offsets(pc->offsets);
+}
+
+static void project_one_record(RecordView* v, void* ctx) {
+    ProjectContext* pc = (ProjectContext*) ctx;
+    const Record* R = v->tmpl;
+    const RecorderFuncDesc* desc = recorder_get_func_desc(reader, R);
+
+    if(desc->op != RECORDER_OP_READ && desc->op != RECORDER_OP_WRITE)
+        return;
+    if(desc->layer == RECORDER_MPIIO) {
+        pc->current_mpifh = R->args[0];
+        pc->current_mpi_call_depth = (int) R->level;
         return;
-    
-    if(strstr(func, "dir") || strstr(func, "link"))
+    }
+    if(desc->layer != RECORDER_POSIX || !pc->complete)
         return;
+    // Records missing from a recovered CST have no arguments
+    if(R->arg_count > 0 && R->arg_count <= desc->offset_arg) {
+        pc->complete = false;
+        return;
+    }
 
-    RRecord rr;
-    rr.record = r;
-    rr.rank = *((int*) arg);
-    rr.seq_id = current_seq_id - 1;
+    Interval I;
+    // Unknown for files that can not seek, e.g., FIFOs,
+    // and after a record missing from a recovered CST
+    if(!recorder_get_io_offset(reader, pc->offsets, R, &I.offset))
+        return;
+    I.rank = pc->rank;
+    I.seqId = v->seq_id;
+    I.tstart = v->tstart;
+    I.isRead = (desc->op == RECORDER_OP_READ);
+    I.count = str2sizet(R->args[desc->count_arg]);
+    if(desc->size_arg >= 0)
+        I.count *= str2sizet(R->args[desc->size_arg]);
+    memset(I.mpifh, 0, sizeof(I.mpifh));
+    strcpy(I.mpifh, "-");
+    if(R->level == pc->current_mpi_call_depth+1)
+        strcpy(I.mpifh, pc->current_mpifh.c_str());
 
-    records.push_back(rr);
+    pc->intervals[R->args[desc->file_arg]].push_back(I);
 }
 
-void flatten_and_sort_records(RecorderReader *reader) {
+static bool project_intervals(unordered_map<string, vector<Interval>> &intervals) {
+    int nthreads = max(1, min(reader->metadata.total_ranks, (int) sysconf(_SC_NPROCESSORS_ONLN)));
+    vector<ProjectContext> contexts(nthreads);
+    vector<void*> ctxs(nthreads);
+    for(int t = 0; t < nthreads; t++) {
+        contexts[t].complete = true;
+        ctxs[t] = &contexts[t];
+    }
+
+    RecorderRankOps ops = { project_begin_rank, project_one_record, project_end_rank };
+    recorder_decode_ranks_parallel(reader, NULL, 0, nthreads, &ops, ctxs.data());
 
-    int nprocs = reader->metadata.total_ranks;
+    for(ProjectContext& pc : contexts)
+        if(!pc.complete)
+            return false;
 
-    for(int rank = 0; rank < nprocs; rank++) {
-        current_seq_id = 0;
-        CST* cst;
-        CFG* cfg;
-        recorder_get_cst_cfg(reader, rank, &cst, &cfg);
-        recorder_decode_records_core(reader, cst, cfg, insert_one_record, &rank, false);
+    for(ProjectContext& pc : contexts) {
+        for(auto& it : pc.intervals) {
+            vector<Interval>& file_intervals = intervals[it.first];
+            file_intervals.insert(file_intervals.end(), it.second.begin(), it.second.end());
+        }
     }
 
-    sort(records.begin(), records.end(), compare_by_tstart);
+    // Same order as replayed ones, independent of the threads
+    for(auto& it : intervals) {
+        sort(it.second.begin(), it.second.end(), [](const Interval& a, const Interval& b) {
+            if(a.tstart != b.tstart)
+                return a.tstart < b.tstart;
+            if(a.rank != b.rank)
+                return a.rank < b.rank;
+            return a.seqId < b.seqId;
+        });
+    }
+    return true;
 }
 
 /*
@@ -231,32 +332,13 @@ void flatten_and_sort_records(RecorderReader *reader) {
 IntervalsMap* build_offset_intervals(RecorderReader *_reader, int *num_files) {
 
     reader = _reader;
-    flatten_and_sort_records(reader);
 
     // <filename, intervals>
     unordered_map<string, vector<Interval>> intervals;
 
-    unordered_map<string, size_t> offset_books[reader->metadata.total_ranks];
-    unordered_map<string, size_t> local_eofs[reader->metadata.total_ranks];
-    unordered_map<string, size_t> global_eof;
-
-    string current_mpifh = "";
-    int current_mpi_call_depth;
-
-    int i;
-    for(i = 0; i < records.size(); i++) {
-        RRecord rr = records[i];
-        const char* func = recorder_get_func_name(reader, rr.record);
-        // Only MPI_File_write* and MPI_File_read* calls here
-        // thanks to insert_one_record()
-        if(strstr(func, "MPI")) {
-            current_mpifh = rr.record->args[0];
-            current_mpi_call_depth = (int) rr.record->level;
-        // POSIX calls
-        } else {
-            handle_metadata_operation(rr, offset_books[rr.rank], local_eofs[rr.rank], global_eof);
-            handle_data_operation(rr, offset_books[rr.rank], local_eofs[rr.rank], global_eof, intervals, current_mpifh, current_mpi_call_depth);
-        }
+    if(!project_intervals(intervals)) {
+        intervals.clear();
+        replay_intervals(intervals);
     }
 
     /* Now we have the list of intervals for all files,
@@ -269,7 +351,7 @@ IntervalsMap* build_offset_intervals(RecorderReader *_reader, int *num_files) {
 
     IntervalsMap *IM = (IntervalsMap*) malloc(sizeof(IntervalsMap) * (*num_files));
 
-    i = 0;
+    int i = 0;
     for(auto it = intervals.cbegin(); it != intervals.cend(); it++) {
         /* it->first: filename
          * it->second: vector<Interval> */
@@ -280,8 +362,5 @@ IntervalsMap* build_offset_intervals(RecorderReader *_reader, int *num_files) {
         i++;
     }
 
-    for(i = 0; i < records.size(); i++) {
-        recorder_free_record(records[i].record);
-    }
     return IM;
 }
@@ -1,27 +1,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 extern "C" {
 #include "reader.h"
 }
 using namespace std;
 
-int compare_by_offset(const void *lhs, const void *rhs) {
-    Interval *first = (Interval*)lhs;
-    Interval *second = (Interval*)rhs;
-    return first->offset - second->offset;
+bool compare_by_offset(const Interval& lhs, const Interval& rhs) {
+    if(lhs.offset != rhs.offset)
+        return lhs.offset < rhs.offset;
+    if(lhs.rank != rhs.rank)
+        return lhs.rank < rhs.rank;
+    return lhs.seqId < rhs.seqId;
 }
 
-int sum_array(int *arr, int count) {
-    int i, sum = 0;
-    for(i = 0; i < count; i++) {
-        sum += arr[i];
-    }
-    return sum;
-}
-
-int is_conflict(Interval* i1, Interval* i2) {
+int is_conflict(const Interval* i1, const Interval* i2) {
     // TODO: same rank but multi-threaded?
     if(i1->rank == i2->rank)
         return false;
@@ -34,84 +34,230 @@ int is_conflict(Interval* i1, Interval* i2) {
     return true;
 }
 
-void detect_conflicts(IntervalsMap *IM, int num_files, const char* base_dir) {
-    FILE* conflict_file;
-    char path[512];
-    sprintf(path, "%s/conflicts.txt", base_dir);
-    conflict_file = fopen(path, "w");
-    fprintf(conflict_file, "#rank,id,op1(fh,offset,count) "
-                           "rank,id,op2(fh,offset,count)\n");
 
-    int idx, i, j;
-    for(idx = 0; idx < num_files; idx++) {
+/*
+ * Intervals of a file that overlap each other, directly or through
+ * other intervals, form a group. Groups with at least one conflict
+ * are reported with the number of conflicting pairs and one example.
+ */
+typedef struct ConflictGroup_t {
+    size_t begin, end;              // byte range covered
+    size_t intervals, conflicts;
+    size_t reads, writes;
+    int ranks;
+    const Interval *op1, *op2;      // first conflicting pair
+} ConflictGroup;
 
-        char *filename = IM[idx].filename;
-        Interval *intervals = IM[idx].intervals;
-        fprintf(conflict_file, "#%d:%s\n", idx, filename);
+typedef struct FileConflicts_t {
+    vector<ConflictGroup> groups;
+    size_t conflicts;
+} FileConflicts;
 
-        // sort by offset
-        qsort(intervals, IM[idx].num_intervals, sizeof(Interval), compare_by_offset);
+// An interval that contains the current offset of the sweep
+typedef struct ActiveInterval_t {
+    size_t end;
+    const Interval* interval;
+} ActiveInterval;
 
-        int i = 0, j = 0;
-        Interval *i1, *i2;
+static bool ends_later(const ActiveInterval& a, const ActiveInterval& b) {
+    return a.end > b.end;
+}
 
-        while(i < IM[idx].num_intervals-1) {
+/*
+ * Sweep over the intervals sorted by start offset. The active set is a
+ * min-heap on the end offset, so intervals that end before the current
+ * one starts are removed first. All remaining ones overlap it, and with
+ * per-rank counts of the active reads and writes, the number of its
+ * conflicts is known without visiting them: O(n log n) overall instead
+ * of O(n^2) on files that many ranks write to the same offsets.
+ */
+static void detect_file_conflicts(IntervalsMap* im, FileConflicts* result) {
+    Interval* intervals = im->intervals;
+    size_t n = im->num_intervals;
+    sort(intervals, intervals + n, compare_by_offset);
 
-            i1 = &intervals[i];
-            j = i + 1;
+    int max_rank = 0;
+    for(size_t i = 0; i < n; i++)
+        max_rank = max(max_rank, intervals[i].rank);
+    vector<size_t> active_ops(max_rank+1, 0), active_writes(max_rank+1, 0);
+    vector<size_t> group_seen(max_rank+1, 0);   // last group (1-based) a rank was in
+    size_t total_ops = 0, total_writes = 0;
+    vector<ActiveInterval> active;
 
+    ConflictGroup group;
+    size_t group_id = 0;
+    result->conflicts = 0;
 
-            vector<Interval*> conflicts;
-            while(j < IM[idx].num_intervals) {
-                i2 = &intervals[j];
+    for(size_t i = 0; i < n; i++) {
+        const Interval* cur = &intervals[i];
+        // A zero-byte access touches no data
+        if(cur->count == 0)
+            continue;
 
-                if(is_conflict(i1,i2)) {
-                    conflicts.push_back(i2);
-                }
+        while(!active.empty() && active.front().end <= cur->offset) {
+            const Interval* done = active.front().interval;
+            active_ops[done->rank]--;
+            total_ops--;
+            if(!done->isRead) {
+                active_writes[done->rank]--;
+                total_writes--;
+            }
+            pop_heap(active.begin(), active.end(), ends_later);
+            active.pop_back();
+        }
 
-                if(i1->offset+i1->count > i2->offset) {
-                    j++;
-                } else {
-                    // skip the rest, as they will all have
-                    // a bigger starting offset
+        if(active.empty()) {
+            if(group_id > 0 && group.conflicts > 0)
+                result->groups.push_back(group);
+            group_id++;
+            group = ConflictGroup();
+            group.begin = cur->offset;
+            group.end = cur->offset;
+        }
+
+        // A read conflicts with the writes of other ranks,
+        // a write with all their accesses
+        size_t conflicts = cur->isRead ? total_writes - active_writes[cur->rank]
+                                       : total_ops - active_ops[cur->rank];
+        if(conflicts > 0 && group.conflicts == 0) {
+            for(const ActiveInterval& a : active) {
+                if(is_conflict(a.interval, cur)) {
+                    group.op1 = a.interval;
+                    group.op2 = cur;
                     break;
                 }
             }
+        }
+        group.conflicts += conflicts;
+        group.intervals++;
+        if(cur->isRead) group.reads++;
+        else group.writes++;
+        if(group_seen[cur->rank] != group_id) {
+            group_seen[cur->rank] = group_id;
+            group.ranks++;
+        }
+        group.end = max(group.end, cur->offset + cur->count);
+        result->conflicts += conflicts;
 
-            if (conflicts.size() > 0) {
-                fprintf(stdout, "rank:%4d, id:%10d, %5s(%5s,%12zu,%12zu) conflicts: %10d\n",
-                        i1->rank,i1->seqId,i1->isRead?"read":"write",i1->mpifh,i1->offset,i1->count,
-                        conflicts.size());
-                fprintf(conflict_file, "%d,%d,%s,%s:",
-                        i1->rank,i1->seqId,i1->isRead?"r":"w",i1->mpifh);
-                for (vector<Interval*>::iterator it = conflicts.begin(); it!=conflicts.end(); ++it) {
-                    i2 = *it;
-                    fprintf(conflict_file, "%d,%d,%s,%s%s",
-                            i2->rank,i2->seqId,i2->isRead?"r":"w",
-                            i2->mpifh,(it==conflicts.end()-1)?"":" ");
-                }
-                fprintf(conflict_file, "\n");
-                conflicts.clear();
-            }
-            i++;
+        active_ops[cur->rank]++;
+        total_ops++;
+        if(!cur->isRead) {
+            active_writes[cur->rank]++;
+            total_writes++;
+        }
+        active.push_back({cur->offset + cur->count, cur});
+        push_heap(active.begin(), active.end(), ends_later);
+    }
+    if(group_id > 0 && group.conflicts > 0)
+        result->groups.push_back(group);
+}
+
+/*
+ * The format of conflicts.txt before conflict groups, for tools that
+ * need every pair: each line is an interval followed by the intervals
+ * at larger offsets it conflicts with. Intervals are sorted by offset.
+ */
+static void write_conflict_pairs(FILE* f, const IntervalsMap* im) {
+    const Interval* intervals = im->intervals;
+    size_t n = im->num_intervals;
+    for(size_t i = 0; i + 1 < n; i++) {
+        const Interval* i1 = &intervals[i];
+        bool first = true;
+        for(size_t j = i + 1; j < n && i1->offset + i1->count > intervals[j].offset; j++) {
+            const Interval* i2 = &intervals[j];
+            if(!is_conflict(i1, i2))
+                continue;
+            if(first)
+                fprintf(f, "%d,%d,%s,%s:", i1->rank, i1->seqId, i1->isRead?"r":"w", i1->mpifh);
+            fprintf(f, "%s%d,%d,%s,%s", first?"":" ", i2->rank, i2->seqId, i2->isRead?"r":"w", i2->mpifh);
+            first = false;
+        }
+        if(!first)
+            fprintf(f, "\n");
+    }
+}
+
+/*
+ * Files are independent, threads take the next one from a shared
+ * counter, largest first. Results are written in file order.
+ */
+void detect_conflicts(IntervalsMap *IM, int num_files, const char* base_dir, bool pairs) {
+    vector<FileConflicts> results(num_files);
+    vector<int> order(num_files);
+    for(int i = 0; i < num_files; i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), [IM](int a, int b) {
+        return IM[a].num_intervals > IM[b].num_intervals;
+    });
+
+    atomic<int> next(0);
+    auto worker = [&]() {
+        int i;
+        while((i = next.fetch_add(1)) < num_files)
+            detect_file_conflicts(&IM[order[i]], &results[order[i]]);
+    };
+    int nthreads = max(1, min(num_files, (int) sysconf(_SC_NPROCESSORS_ONLN)));
+    vector<thread> threads;
+    for(int t = 1; t < nthreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for(thread& t : threads)
+        t.join();
+
+    FILE* conflict_file;
+    char path[512];
+    sprintf(path, "%s/conflicts.txt", base_dir);
+    conflict_file = fopen(path, "w");
+    if(pairs)
+        fprintf(conflict_file, "#rank,id,op1(fh) rank,id,op2(fh)\n");
+    else
+        fprintf(conflict_file, "#offset_begin,offset_end,intervals,conflicts,ranks,reads,writes:"
+                               "example rank,id,op1(fh) rank,id,op2(fh)\n");
+
+    size_t total_groups = 0, total_conflicts = 0;
+    for(int idx = 0; idx < num_files; idx++) {
+        FileConflicts* fc = &results[idx];
+        fprintf(conflict_file, "#%d:%s\n", idx, IM[idx].filename);
+        if(pairs) {
+            write_conflict_pairs(conflict_file, &IM[idx]);
+        } else {
+            for(const ConflictGroup& g : fc->groups)
+                fprintf(conflict_file, "%zu,%zu,%zu,%zu,%d,%zu,%zu:%d,%d,%s,%s %d,%d,%s,%s\n",
+                        g.begin, g.end, g.intervals, g.conflicts, g.ranks, g.reads, g.writes,
+                        g.op1->rank, g.op1->seqId, g.op1->isRead?"r":"w", g.op1->mpifh,
+                        g.op2->rank, g.op2->seqId, g.op2->isRead?"r":"w", g.op2->mpifh);
         }
+        if(fc->conflicts > 0)
+            fprintf(stdout, "%s: %zu intervals, %zu conflict groups, %zu conflicting pairs\n",
+                    IM[idx].filename, IM[idx].num_intervals, fc->groups.size(), fc->conflicts);
+        total_groups += fc->groups.size();
+        total_conflicts += fc->conflicts;
     }
     fclose(conflict_file);
+
+    fprintf(stdout, "%d files, %zu conflict groups, %zu conflicting pairs, see %s\n",
+            num_files, total_groups, total_conflicts, path);
 }
 
+/*
+ * Usage: conflict_detector <traces dir> [--pairs]
+ * --pairs: list every conflicting pair in conflicts.txt instead of the groups
+ */
 int main(int argc, char* argv[]) {
 
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s /path/to/traces [--pairs]\n", argv[0]);
+        return 1;
+    }
+    bool pairs = (argc > 2 && strcmp(argv[2], "--pairs") == 0);
+
     RecorderReader reader;
     recorder_init_reader(argv[1], &reader);
 
-    printf("Format:\nFilename,"
-           "op1(rank-seqId, offset, bytes),"
-           "op2(rank-seqId, offset, bytes)\n\n");
-
-    int i, rank, num_files;
+    int i, num_files;
     IntervalsMap *IM = build_offset_intervals(&reader, &num_files);
 
-    detect_conflicts(IM, num_files, argv[1]);
+    detect_conflicts(IM, num_files, argv[1], pairs);
 
     // Free IM
     for(i = 0; i < num_files; i++) {
@@ -0,0 +1,612 @@
+/*
+ * Match the MPI calls of a trace, see MPIMatches in reader.h
+ *
+ * Point-to-point: sends are queued by (comm, source, destination, tag)
+ * and a receive takes the first send of its key, so each receive is
+ * one hash lookup. Wildcard receives are resolved from their status.
+ * Those that could not be (MPI_STATUS_IGNORE in old traces) take the
+ * message that arrived first, by start time, among the queues to
+ * their rank.
+ *
+ * Collectives: the calls on a communicator (or file handle) happen in
+ * the same order on all its members, so the i-th collective call of
+ * each rank on a communicator are matched together.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+extern "C" {                            // Needed to mix linking C and C++ sources
+#include "reader.h"
+}
+using namespace std;
+
+typedef enum MPICallKind_t {
+    MPI_KIND_NONE = 0,
+    MPI_KIND_SEND,
+    MPI_KIND_RECV,
+    MPI_KIND_SENDRECV,
+    MPI_KIND_COLL,
+    MPI_KIND_COMPLETE,          // wait and test calls
+} MPICallKind;
+
+#define MPI_MATCH_NONE      0xff
+
+/*
+ * MPI functions used for matching, arguments are laid out as in
+ * lib/recorder-mpi.c, -1 if absent.
+ *
+ *  coll:        match type (MPI_MATCH_*) of collectives
+ *  sync:        the collective synchronizes all processes
+ *  comm_arg:    the communicator, the new one for communicator creation
+ *  peer_arg:    destination of sends, source of receives, root of collectives
+ *  req_arg:     request of nonblocking calls, request(s) of wait/test calls
+ *  file_arg:    file handle of MPI-IO collectives
+ *  index_arg:   completed request(s) of Waitany, Waitsome, ...
+ *  newrank_arg: rank in the communicator created
+ */
+typedef struct MPIFuncDesc_t {
+    const char* name;
+    unsigned char kind, coll;
+    bool sync;
+    signed char comm_arg, peer_arg, tag_arg, req_arg, file_arg;
+    signed char status_arg, index_arg, flag_arg, newrank_arg;
+} MPIFuncDesc;
+
+#define P2P_DESC(name, kind, peer, tag, comm, req, status) \
+    { name, kind, MPI_MATCH_NONE, true, comm, peer, tag, req, -1, status, -1, -1, -1 }
+#define COLL_DESC(name, coll, sync, comm, root, req, file, newrank) \
+    { name, MPI_KIND_COLL, coll, sync, comm, root, -1, req, file, -1, -1, -1, newrank }
+#define COMPLETE_DESC(name, req, status, index, flag) \
+    { name, MPI_KIND_COMPLETE, MPI_MATCH_NONE, false, -1, -1, -1, req, -1, status, index, flag, -1 }
+
+static const MPIFuncDesc mpi_descs[] = {
+    P2P_DESC("MPI_Send",            MPI_KIND_SEND,      3,  4,  5, -1, -1),
+    P2P_DESC("MPI_Ssend",           MPI_KIND_SEND,      3,  4,  5, -1, -1),
+    P2P_DESC("MPI_Isend",           MPI_KIND_SEND,      3,  4,  5,  6, -1),
+    P2P_DESC("MPI_Recv",            MPI_KIND_RECV,      3,  4,  5, -1,  6),
+    P2P_DESC("MPI_Irecv",           MPI_KIND_RECV,      3,  4,  5,  6, -1),
+    // the receive: source 8, tag 9
+    P2P_DESC("MPI_Sendrecv",        MPI_KIND_SENDRECV,  3,  4, 10, -1, 11),
+
+    COLL_DESC("MPI_Barrier",        MPI_MATCH_ALL_TO_ALL,  true,   0, -1, -1, -1, -1),
+    COLL_DESC("MPI_Allgather",      MPI_MATCH_ALL_TO_ALL,  true,   6, -1, -1, -1, -1),
+    COLL_DESC("MPI_Allgatherv",     MPI_MATCH_ALL_TO_ALL,  true,   7, -1, -1, -1, -1),
+    COLL_DESC("MPI_Alltoall",       MPI_MATCH_ALL_TO_ALL,  true,   6, -1, -1, -1, -1),
+    COLL_DESC("MPI_Ialltoall",      MPI_MATCH_ALL_TO_ALL,  true,   6, -1,  7, -1, -1),
+    COLL_DESC("MPI_Allreduce",      MPI_MATCH_ALL_TO_ALL,  true,   5, -1, -1, -1, -1),
+    COLL_DESC("MPI_Reduce_scatter", MPI_MATCH_ALL_TO_ALL,  true,   5, -1, -1, -1, -1),
+    COLL_DESC("MPI_Bcast",          MPI_MATCH_ONE_TO_MANY, false,  4,  3, -1, -1, -1),
+    COLL_DESC("MPI_Ibcast",         MPI_MATCH_ONE_TO_MANY, false,  4,  3,  5, -1, -1),
+    COLL_DESC("MPI_Scatter",        MPI_MATCH_ONE_TO_MANY, false,  7,  6, -1, -1, -1),
+    COLL_DESC("MPI_Iscatter",       MPI_MATCH_ONE_TO_MANY, false,  7,  6,  8, -1, -1),
+    COLL_DESC("MPI_Scatterv",       MPI_MATCH_ONE_TO_MANY, false,  8,  7, -1, -1, -1),
+    COLL_DESC("MPI_Reduce",         MPI_MATCH_MANY_TO_ONE, false,  6,  5, -1, -1, -1),
+    COLL_DESC("MPI_Ireduce",        MPI_MATCH_MANY_TO_ONE, false,  6,  5,  7, -1, -1),
+    COLL_DESC("MPI_Gather",         MPI_MATCH_MANY_TO_ONE, false,  7,  6, -1, -1, -1),
+    COLL_DESC("MPI_Igather",        MPI_MATCH_MANY_TO_ONE, false,  7,  6,  8, -1, -1),
+    COLL_DESC("MPI_Gatherv",        MPI_MATCH_MANY_TO_ONE, false,  8,  7, -1, -1, -1),
+    // Matched among the members of the new communicator
+    COLL_DESC("MPI_Comm_dup",       MPI_MATCH_ALL_TO_ALL,  false,  1, -1, -1, -1,  2),
+    COLL_DESC("MPI_Comm_split",     MPI_MATCH_ALL_TO_ALL,  false,  3, -1, -1, -1,  4),
+    COLL_DESC("MPI_Comm_split_type",MPI_MATCH_ALL_TO_ALL,  false,  4, -1, -1, -1,  5),
+    COLL_DESC("MPI_Comm_create",    MPI_MATCH_NONE,        false,  2, -1, -1, -1,  3),
+    COLL_DESC("MPI_Cart_create",    MPI_MATCH_ALL_TO_ALL,  false,  5, -1, -1, -1,  6),
+    COLL_DESC("MPI_Cart_sub",       MPI_MATCH_ALL_TO_ALL,  false,  2, -1, -1, -1,  3),
+    // Matched by file handle
+    COLL_DESC("MPI_File_open",      MPI_MATCH_ALL_TO_ALL,  false,  0, -1, -1,  4, -1),
+    COLL_DESC("MPI_File_close",     MPI_MATCH_ALL_TO_ALL,  false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_sync",      MPI_MATCH_ALL_TO_ALL,  false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_set_size",  MPI_MATCH_ALL_TO_ALL,  false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_set_view",  MPI_MATCH_ALL_TO_ALL,  false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_read_all",  MPI_MATCH_ALL_TO_ALL,  false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_read_at_all",   MPI_MATCH_ALL_TO_ALL, false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_read_ordered",  MPI_MATCH_ALL_TO_ALL, false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_write_all", MPI_MATCH_ALL_TO_ALL,  false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_write_at_all",  MPI_MATCH_ALL_TO_ALL, false, -1, -1, -1,  0, -1),
+    COLL_DESC("MPI_File_write_ordered", MPI_MATCH_ALL_TO_ALL, false, -1, -1, -1,  0, -1),
+
+    COMPLETE_DESC("MPI_Wait",       0,  1, -1, -1),
+    COMPLETE_DESC("MPI_Waitall",    1, -1, -1, -1),
+    COMPLETE_DESC("MPI_Waitany",    1,  3,  2, -1),
+    COMPLETE_DESC("MPI_Waitsome",   1, -1,  3, -1),
+    COMPLETE_DESC("MPI_Test",       0,  2, -1,  1),
+    COMPLETE_DESC("MPI_Testall",    1, -1, -1,  2),
+    COMPLETE_DESC("MPI_Testany",    1,  4,  2,  3),
+    COMPLETE_DESC("MPI_Testsome",   1, -1,  3, -1),
+};
+
+// Source of a receive that got nothing (MPI_PROC_NULL)
+#define PEER_NULL   INT_MIN
+
+typedef struct MPICall_t {
+    int seq;
+    const MPIFuncDesc* desc;
+    int peer, tag;              // of the send, root of collectives
+    int rpeer, rtag;            // of the receive, negative if not known
+    int complete;               // seq id of the call completing a nonblocking one, -1 if none
+    unsigned char func_id, level;
+    unsigned char complete_func_id, complete_level;
+    double tstart, tend;        // tend: of the completing call for nonblocking calls
+    string handle;              // communicator, or file handle of MPI-IO collectives
+    string req;                 // request of a nonblocking call, until it is completed
+} MPICall;
+
+typedef struct Completion_t {
+    int seq;
+    unsigned char func_id, level;
+    double tend;
+    bool has_status;
+    int src, tag;
+} Completion;
+
+/*
+ * The calls to match of a rank, and the communicators it created
+ */
+typedef struct RankCalls_t {
+    vector<MPICall> calls;
+    vector<pair<string, int>> comms;        // <id, rank in it>
+} RankCalls;
+
+typedef struct DecodeContext_t {
+    const MPIFuncDesc** descs;              // by func_id, NULL if not used
+    vector<RankCalls>* ranks;
+    RankCalls* calls;                       // of the rank being decoded
+    unordered_map<string, vector<Completion>> completions;  // <request, calls completing it>
+} DecodeContext;
+
+
+static int parse_int(const char* s) {
+    return (int) strtol(s, NULL, 10);
+}
+
+// "[a,b,c]" or "a"
+static void parse_list(const char* s, vector<string>& items) {
+    if(*s == '[')
+        s++;
+    while(*s && *s != ']') {
+        const char* end = s + strcspn(s, ",]");
+        if(end > s)
+            items.emplace_back(s, end - s);
+        s = (*end == ',') ? end + 1 : end;
+    }
+}
+
+// "[source_tag]", or MPI_STATUS_IGNORE
+static bool parse_status(const char* s, int* src, int* tag) {
+    return sscanf(s, "[%d_%d]", src, tag) == 2;
+}
+
+static bool is_nonblocking(const MPICall* call) {
+    return call->desc->req_arg >= 0;
+}
+
+// Node of a call in a match, the completing call for nonblocking receives and collectives
+static MPIMatchNode match_node(int rank, const MPICall* call) {
+    if(is_nonblocking(call))
+        return { rank, call->complete, call->complete_func_id, call->complete_level };
+    return { rank, call->seq, call->func_id, call->level };
+}
+
+/*
+ * MPI_ANY_SOURCE, MPI_ANY_TAG and MPI_PROC_NULL are negative but differ
+ * between MPI implementations. A status tells them apart: the actual
+ * source and tag, or a negative source if nothing was received.
+ */
+static void resolve_receive(MPICall* call, int src, int tag) {
+    if(call->rpeer == PEER_NULL)
+        return;
+    if(src < 0) {
+        call->rpeer = PEER_NULL;
+        return;
+    }
+    if(call->rpeer < 0) call->rpeer = src;
+    if(call->rtag < 0) call->rtag = tag;
+}
+
+
+static void read_completion(DecodeContext* ctx, const MPIFuncDesc* d, const Record* R, RecordView* v) {
+    // A test call that completed nothing
+    if(d->flag_arg >= 0 && parse_int(R->args[d->flag_arg]) == 0)
+        return;
+
+    vector<string> reqs;
+    parse_list(R->args[d->req_arg], reqs);
+    Completion c = { (int) v->seq_id, R->func_id, R->level, v->tend, false, -1, -1 };
+    if(d->status_arg >= 0)
+        c.has_status = parse_status(R->args[d->status_arg], &c.src, &c.tag);
+
+    if(d->index_arg < 0) {
+        for(const string& req : reqs)
+            ctx->completions[req].push_back(c);
+        return;
+    }
+    vector<string> indices;
+    parse_list(R->args[d->index_arg], indices);
+    for(const string& index : indices) {
+        int i = parse_int(index.c_str());
+        if(i >= 0 && i < (int) reqs.size())
+            ctx->completions[reqs[i]].push_back(c);
+    }
+}
+
+static void read_mpi_call(DecodeContext* ctx, const MPIFuncDesc* d, const Record* R, RecordView* v) {
+    int seq = (int) v->seq_id;
+    if(d->newrank_arg >= 0) {
+        int newrank = parse_int(R->args[d->newrank_arg]);
+        if(newrank >= 0)
+            ctx->calls->comms.push_back(make_pair(string(R->args[d->comm_arg]), newrank));
+    }
+    if(d->kind == MPI_KIND_COMPLETE) {
+        read_completion(ctx, d, R, v);
+        return;
+    }
+    if(d->kind == MPI_KIND_COLL && d->coll == MPI_MATCH_NONE)
+        return;
+
+    MPICall call;
+    call.seq = seq;
+    call.desc = d;
+    call.peer = call.tag = call.rpeer = call.rtag = -1;
+    call.complete = -1;
+    call.func_id = call.complete_func_id = R->func_id;
+    call.level = call.complete_level = R->level;
+    call.tstart = v->tstart;
+    call.tend = v->tend;
+    call.handle = R->args[d->file_arg >= 0 ? d->file_arg : d->comm_arg];
+    if(d->req_arg >= 0)
+        call.req = R->args[d->req_arg];
+
+    if(d->kind == MPI_KIND_RECV) {
+        call.rpeer = parse_int(R->args[d->peer_arg]);
+        call.rtag = parse_int(R->args[d->tag_arg]);
+    } else if(d->peer_arg >= 0) {
+        call.peer = parse_int(R->args[d->peer_arg]);
+        if(d->tag_arg >= 0)
+            call.tag = parse_int(R->args[d->tag_arg]);
+    }
+    if(d->kind == MPI_KIND_SENDRECV) {
+        call.rpeer = parse_int(R->args[8]);
+        call.rtag = parse_int(R->args[9]);
+    }
+
+    int src, tag;
+    if(d->status_arg >= 0 && parse_status(R->args[d->status_arg], &src, &tag))
+        resolve_receive(&call, src, tag);
+    ctx->calls->calls.push_back(call);
+}
+
+static void decode_begin_rank(int rank, void* arg) {
+    DecodeContext* ctx = (DecodeContext*) arg;
+    ctx->calls = &(*ctx->ranks)[rank];
+    ctx->completions.clear();
+}
+
+static void decode_record(RecordView* v, void* arg) {
+    DecodeContext* ctx = (DecodeContext*) arg;
+    const MPIFuncDesc* d = ctx->descs[v->tmpl->func_id];
+    if(d)
+        read_mpi_call(ctx, d, v->tmpl, v);
+}
+
+/*
+ * A nonblocking call is completed by the first wait/test call
+ * after it with its request, requests are reused once completed.
+ */
+static void decode_end_rank(int rank, void* arg) {
+    DecodeContext* ctx = (DecodeContext*) arg;
+    for(MPICall& call : ctx->calls->calls) {
+        if(call.req.empty())
+            continue;
+        auto it = ctx->completions.find(call.req);
+        if(it != ctx->completions.end()) {
+            const vector<Completion>& cs = it->second;
+            auto c = upper_bound(cs.begin(), cs.end(), call.seq,
+                                 [](int seq, const Completion& c) { return seq < c.seq; });
+            if(c != cs.end()) {
+                call.complete = c->seq;
+                call.complete_func_id = c->func_id;
+                call.complete_level = c->level;
+                call.tend = c->tend;
+                if(c->has_status && call.desc->kind == MPI_KIND_RECV)
+                    resolve_receive(&call, c->src, c->tag);
+            }
+        }
+        string().swap(call.req);
+    }
+    ctx->completions.clear();
+}
+
+static void read_mpi_calls(RecorderReader* reader, vector<RankCalls>& ranks) {
+    const MPIFuncDesc* descs[256] = { NULL };
+    for(int func_id = 0; func_id < 256; func_id++) {
+        for(size_t i = 0; i < sizeof(mpi_descs)/sizeof(mpi_descs[0]); i++) {
+            if(strcmp(reader->func_list[func_id], mpi_descs[i].name) == 0) {
+                descs[func_id] = &mpi_descs[i];
+                break;
+            }
+        }
+    }
+
+    int nthreads = max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+    vector<DecodeContext> contexts(nthreads);
+    vector<void*> ctxs(nthreads);
+    for(int t = 0; t < nthreads; t++) {
+        contexts[t].descs = descs;
+        contexts[t].ranks = &ranks;
+        ctxs[t] = &contexts[t];
+    }
+    RecorderRankOps ops = { decode_begin_rank, decode_record, decode_end_rank };
+    recorder_decode_ranks_parallel(reader, NULL, 0, nthreads, &ops, ctxs.data());
+}
+
+
+/*
+ * Ranks of communicators, <id, world rank of each local rank>
+ */
+typedef unordered_map<string, vector<int>> CommTable;
+
+static void build_comm_table(const vector<RankCalls>& ranks, CommTable& table) {
+    for(int rank = 0; rank < (int) ranks.size(); rank++) {
+        for(const pair<string, int>& comm : ranks[rank].comms) {
+            vector<int>& world = table[comm.first];
+            if((int) world.size() <= comm.second)
+                world.resize(comm.second + 1, -1);
+            world[comm.second] = rank;
+        }
+    }
+}
+
+static int local2global(const CommTable& table, const string& comm, int local, int rank) {
+    if(local < 0 || comm == "MPI_COMM_WORLD")
+        return local;
+    if(comm == "MPI_COMM_SELF")
+        return rank;
+    auto it = table.find(comm);
+    if(it != table.end() && local < (int) it->second.size() && it->second[local] >= 0)
+        return it->second[local];
+    return local;
+}
+
+// Small integer ids of communicators and file handles
+static int intern(unordered_map<string, int>& ids, const string& s) {
+    auto it = ids.find(s);
+    if(it == ids.end())
+        it = ids.insert(make_pair(s, (int) ids.size())).first;
+    return it->second;
+}
+
+
+/*
+ * The matches found so far, copied to an MPIMatches at the end
+ */
+typedef struct MatchList_t {
+    vector<MPIMatch> matches;
+    vector<MPIMatchNode> nodes;
+    size_t unmatched_sends, unmatched_recvs, mismatched_colls;
+} MatchList;
+
+// (comm, src, dst, tag), or (comm, -1, dst, -1) for all messages to dst
+typedef struct MsgKey_t {
+    int comm, src, dst, tag;
+    bool operator==(const MsgKey_t& o) const {
+        return comm == o.comm && src == o.src && dst == o.dst && tag == o.tag;
+    }
+} MsgKey;
+
+struct MsgKeyHash {
+    size_t operator()(const MsgKey& k) const {
+        uint64_t h = (uint32_t) k.comm;
+        h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) k.src;
+        h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) k.dst;
+        h = h * 0x9E3779B97F4A7C15ULL + (uint32_t) k.tag;
+        return (size_t) (h ^ (h >> 29));
+    }
+};
+
+typedef struct PendingSend_t {
+    int rank;
+    const MPICall* call;
+} PendingSend;
+
+typedef unordered_map<MsgKey, deque<PendingSend>, MsgKeyHash> SendQueues;
+
+static void add_pt2pt(MatchList* list, const PendingSend& send, int rank, const MPICall* recv) {
+    MPIMatchNode tail = match_node(rank, recv);
+    if(tail.seq_id < 0)
+        return;
+    // A MPI_Sendrecv sends before it receives
+    unsigned char flags = MPI_MATCH_SYNCHRONIZING;
+    if(recv->desc->kind == MPI_KIND_SENDRECV)
+        flags |= MPI_MATCH_TAILS_AFTER;
+    MPIMatch m = { MPI_MATCH_POINT_TO_POINT, flags, 1, 1, list->nodes.size() };
+    list->matches.push_back(m);
+    list->nodes.push_back({ send.rank, send.call->seq, send.call->func_id, send.call->level });
+    list->nodes.push_back(tail);
+}
+
+/*
+ * Receives of a rank take the messages in the order they are posted.
+ * A message is the first send of its key not received yet, as
+ * messages of a key are not overtaking. A wildcard receive takes,
+ * among the keys it accepts, the message that arrived first.
+ */
+static void match_pt2pt(const vector<RankCalls>& ranks, const CommTable& table,
+                        unordered_map<string, int>& comm_ids, MatchList* list) {
+    int num_ranks = ranks.size();
+    SendQueues sends;
+    // <(comm, dst), queues of the messages to dst>, for wildcard receives
+    unordered_map<MsgKey, vector<deque<PendingSend>*>, MsgKeyHash> queues_to;
+
+    for(int rank = 0; rank < num_ranks; rank++) {
+        for(const MPICall& call : ranks[rank].calls) {
+            if(call.desc->kind != MPI_KIND_SEND && call.desc->kind != MPI_KIND_SENDRECV)
+                continue;
+            int dst = local2global(table, call.handle, call.peer, rank);
+            if(dst < 0)                     // MPI_PROC_NULL
+                continue;
+            if(dst >= num_ranks) {          // not translated to a world rank
+                list->unmatched_sends++;
+                continue;
+            }
+            int comm = intern(comm_ids, call.handle);
+            auto it = sends.find({ comm, rank, dst, call.tag });
+            if(it == sends.end()) {
+                it = sends.insert(make_pair(MsgKey{ comm, rank, dst, call.tag }, deque<PendingSend>())).first;
+                queues_to[{ comm, -1, dst, -1 }].push_back(&it->second);
+            }
+            it->second.push_back({ rank, &call });
+        }
+    }
+
+    for(int rank = 0; rank < num_ranks; rank++) {
+        for(const MPICall& call : ranks[rank].calls) {
+            if(call.desc->kind != MPI_KIND_RECV && call.desc->kind != MPI_KIND_SENDRECV)
+                continue;
+            if(call.rpeer == PEER_NULL)
+                continue;
+            int comm = intern(comm_ids, call.handle);
+            int src = local2global(table, call.handle, call.rpeer, rank);
+            if(src >= num_ranks) {          // not translated to a world rank
+                list->unmatched_recvs++;
+                continue;
+            }
+
+            deque<PendingSend>* q = NULL;
+            if(src >= 0 && call.rtag >= 0) {
+                auto it = sends.find({ comm, src, rank, call.rtag });
+                if(it != sends.end() && !it->second.empty())
+                    q = &it->second;
+            } else {
+                auto it = queues_to.find({ comm, -1, rank, -1 });
+                if(it != queues_to.end()) {
+                    for(deque<PendingSend>* c : it->second) {
+                        if(c->empty())
+                            continue;
+                        const PendingSend& send = c->front();
+                        if((src >= 0 && send.rank != src) || (call.rtag >= 0 && send.call->tag != call.rtag))
+                            continue;
+                        if(send.call->tstart > call.tend)   // sent after it was received
+                            continue;
+                        if(q == NULL || send.call->tstart < q->front().call->tstart)
+                            q = c;
+                    }
+                }
+            }
+            if(q == NULL) {
+                list->unmatched_recvs++;
+                continue;
+            }
+            add_pt2pt(list, q->front(), rank, &call);
+            q->pop_front();
+        }
+    }
+
+    for(auto& it : sends)
+        list->unmatched_sends += it.second.size();
+}
+
+typedef struct CollGroup_t {
+    const MPIFuncDesc* desc;
+    vector<MPIMatchNode> heads, tails;
+} CollGroup;
+
+static void match_collectives(const vector<RankCalls>& ranks, const CommTable& table,
+                              unordered_map<string, int>& comm_ids, MatchList* list) {
+    unordered_map<string, int> file_ids;
+    unordered_map<uint64_t, size_t> index;      // <(handle, sequence number), group>
+    vector<CollGroup> groups;
+
+    for(int rank = 0; rank < (int) ranks.size(); rank++) {
+        unordered_map<int, uint32_t> next;      // <handle, sequence number>
+        for(const MPICall& call : ranks[rank].calls) {
+            const MPIFuncDesc* d = call.desc;
+            if(d->kind != MPI_KIND_COLL)
+                continue;
+            // Nothing to match across ranks
+            if(call.handle == "MPI_COMM_SELF" || call.handle == "MPI_COMM_NULL" ||
+               call.handle == "MPI_COMM_UNKNOWN" || call.handle == "MPI_FILE_NULL" ||
+               call.handle == "MPI_FILE_UNKNOWN")
+                continue;
+
+            // File handles and communicators have ids of the same form
+            int handle = (d->file_arg >= 0) ? -1 - intern(file_ids, call.handle)
+                                             : intern(comm_ids, call.handle);
+            uint64_t key = ((uint64_t) (uint32_t) handle << 32) | next[handle]++;
+            auto it = index.find(key);
+            if(it == index.end()) {
+                it = index.insert(make_pair(key, groups.size())).first;
+                groups.push_back(CollGroup());
+                groups.back().desc = d;
+            }
+            CollGroup& group = groups[it->second];
+            if(group.desc != d)
+                list->mismatched_colls++;
+
+            MPIMatchNode node = match_node(rank, &call);
+            if(node.seq_id < 0)
+                continue;
+            bool is_root = (call.peer >= 0) && (local2global(table, call.handle, call.peer, rank) == rank);
+            if(group.desc->coll == MPI_MATCH_ALL_TO_ALL)
+                group.heads.push_back(node);
+            else if(group.desc->coll == MPI_MATCH_ONE_TO_MANY)
+                (is_root ? group.heads : group.tails).push_back(node);
+            else
+                (is_root ? group.tails : group.heads).push_back(node);
+        }
+    }
+
+    for(const CollGroup& group : groups) {
+        unsigned char type = group.desc->coll;
+        if(type == MPI_MATCH_ALL_TO_ALL && group.heads.size() <= 1)
+            continue;
+        if(type != MPI_MATCH_ALL_TO_ALL && (group.heads.empty() || group.tails.empty()))
+            continue;
+        MPIMatch m = { type, (unsigned char) (group.desc->sync ? MPI_MATCH_SYNCHRONIZING : 0),
+                       (int) group.heads.size(), (int) group.tails.size(), list->nodes.size() };
+        list->matches.push_back(m);
+        list->nodes.insert(list->nodes.end(), group.heads.begin(), group.heads.end());
+        list->nodes.insert(list->nodes.end(), group.tails.begin(), group.tails.end());
+    }
+}
+
+MPIMatches* match_mpi_calls(RecorderReader* reader) {
+    vector<RankCalls> ranks(reader->metadata.total_ranks);
+    read_mpi_calls(reader, ranks);
+
+    CommTable table;
+    build_comm_table(ranks, table);
+    unordered_map<string, int> comm_ids;
+    MatchList list;
+    list.unmatched_sends = list.unmatched_recvs = list.mismatched_colls = 0;
+    match_pt2pt(ranks, table, comm_ids, &list);
+    match_collectives(ranks, table, comm_ids, &list);
+    vector<RankCalls>().swap(ranks);
+
+    MPIMatches* m = (MPIMatches*) malloc(sizeof(MPIMatches));
+    m->num_matches = list.matches.size();
+    m->num_nodes = list.nodes.size();
+    m->matches = (MPIMatch*) malloc(sizeof(MPIMatch) * (m->num_matches + 1));
+    m->nodes = (MPIMatchNode*) malloc(sizeof(MPIMatchNode) * (m->num_nodes + 1));
+    if(m->num_matches)
+        memcpy(m->matches, list.matches.data(), sizeof(MPIMatch) * m->num_matches);
+    if(m->num_nodes)
+        memcpy(m->nodes, list.nodes.data(), sizeof(MPIMatchNode) * m->num_nodes);
+    m->unmatched_sends = list.unmatched_sends;
+    m->unmatched_recvs = list.unmatched_recvs;
+    m->mismatched_colls = list.mismatched_colls;
+    return m;
+}
+
+void free_mpi_matches(MPIMatches* m) {
+    free(m->matches);
+    free(m->nodes);
+    free(m);
+}
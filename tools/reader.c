@@ -3,8 +3,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "./reader.h"
 
+static void free_time_index(TimeIndex* index);
+static RankCache* rank_cache_create(int nprocs);
+static void rank_cache_free(RecorderReader* reader);
+
+/*
+ * Map a whole file read-only.
+ * Return NULL if the file can not be opened or is empty.
+ */
+static void* map_file(const char* filename, size_t* size) {
+    *size = 0;
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+
+    struct stat st;
+    void* addr = NULL;
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED)
+            addr = NULL;
+        else
+            *size = st.st_size;
+    }
+    close(fd);
+    return addr;
+}
+
+/*
+ * Anonymous mapping for data that does not come from
+ * a file as is, so it can be released the same way.
+ */
+static void* map_anonymous(size_t size) {
+    void* addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    assert(addr != MAP_FAILED);
+    return addr;
+}
+
 void check_version(RecorderReader* reader) {
     char version_file[1024];
     snprintf(version_file, sizeof(version_file), "%s/VERSION", reader->logs_dir);
@@ -21,6 +63,190 @@ void check_version(RecorderReader* reader) {
     fclose(fp);
 }
 
+/*
+ * POSIX functions, arguments are laid out as in lib/recorder-posix.c
+ * {name, op, file, offset, count, size, whence, flags, mode}
+ * Calls at the file pointer have the offset appended, if logged.
+ * It is relative, see recorder_get_io_offset().
+ */
+typedef struct FuncDescEntry_t {
+    const char* name;
+    RecorderFuncDesc desc;
+} FuncDescEntry;
+
+#define POSIX_DESC(name, op, file, offset, count, size, whence, flags, mode) \
+    { name, { RECORDER_POSIX, op, file, offset, count, size, whence, flags, mode, false } }
+#define POSIX_POINTER_DESC(name, op, file, offset, count, size) \
+    { name, { RECORDER_POSIX, op, file, offset, count, size, -1, -1, -1, true } }
+
+static const FuncDescEntry posix_descs[] = {
+    POSIX_DESC("creat",       RECORDER_OP_OPEN,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("creat64",     RECORDER_OP_OPEN,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("open",        RECORDER_OP_OPEN,   0, -1, -1, -1, -1,  1, -1),
+    POSIX_DESC("open64",      RECORDER_OP_OPEN,   0, -1, -1, -1, -1,  1, -1),
+    POSIX_DESC("fopen",       RECORDER_OP_OPEN,   0, -1, -1, -1, -1, -1,  1),
+    POSIX_DESC("fopen64",     RECORDER_OP_OPEN,   0, -1, -1, -1, -1, -1,  1),
+    POSIX_DESC("fdopen",      RECORDER_OP_OPEN,   0, -1, -1, -1, -1, -1,  1),
+    POSIX_DESC("tmpfile",     RECORDER_OP_OPEN,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("close",       RECORDER_OP_CLOSE,  0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("fclose",      RECORDER_OP_CLOSE,  0, -1, -1, -1, -1, -1, -1),
+    POSIX_POINTER_DESC("read",     RECORDER_OP_READ,   0,  3,  2, -1),
+    POSIX_POINTER_DESC("write",    RECORDER_OP_WRITE,  0,  3,  2, -1),
+    POSIX_DESC("pread",       RECORDER_OP_READ,   0,  3,  2, -1, -1, -1, -1),
+    POSIX_DESC("pread64",     RECORDER_OP_READ,   0,  3,  2, -1, -1, -1, -1),
+    POSIX_DESC("pwrite",      RECORDER_OP_WRITE,  0,  3,  2, -1, -1, -1, -1),
+    POSIX_DESC("pwrite64",    RECORDER_OP_WRITE,  0,  3,  2, -1, -1, -1, -1),
+    POSIX_POINTER_DESC("readv",    RECORDER_OP_READ,   0,  3,  1, -1),
+    POSIX_POINTER_DESC("writev",   RECORDER_OP_WRITE,  0,  3,  1, -1),
+    POSIX_POINTER_DESC("fread",    RECORDER_OP_READ,   3,  4,  2,  1),
+    POSIX_POINTER_DESC("fwrite",   RECORDER_OP_WRITE,  3,  4,  2,  1),
+    POSIX_POINTER_DESC("vfprintf", RECORDER_OP_WRITE,  0,  2,  1, -1),
+    POSIX_DESC("lseek",       RECORDER_OP_SEEK,   0,  1, -1, -1,  2, -1, -1),
+    POSIX_DESC("lseek64",     RECORDER_OP_SEEK,   0,  1, -1, -1,  2, -1, -1),
+    POSIX_DESC("fseek",       RECORDER_OP_SEEK,   0,  1, -1, -1,  2, -1, -1),
+    POSIX_DESC("fseeko",      RECORDER_OP_SEEK,   0,  1, -1, -1,  2, -1, -1),
+    POSIX_DESC("ftell",       RECORDER_OP_SEEK,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("ftello",      RECORDER_OP_SEEK,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("fsync",       RECORDER_OP_SYNC,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("fdatasync",   RECORDER_OP_SYNC,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("msync",       RECORDER_OP_SYNC,  -1, -1,  1, -1, -1, -1, -1),
+    POSIX_DESC("mmap",        RECORDER_OP_META,   4,  5,  1, -1, -1, -1, -1),
+    POSIX_DESC("mmap64",      RECORDER_OP_META,   4,  5,  1, -1, -1, -1, -1),
+    POSIX_DESC("__xstat",     RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("__xstat64",   RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("__lxstat",    RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("__lxstat64",  RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("__fxstat",    RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("__fxstat64",  RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("mknod",       RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("mknodat",     RECORDER_OP_META,   2, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("linkat",      RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("symlinkat",   RECORDER_OP_META,   2, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("readlinkat",  RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("faccessat",   RECORDER_OP_META,   1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("truncate",    RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("ftruncate",   RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    // Path or fd first
+    POSIX_DESC("mkdir",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("rmdir",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("chdir",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("link",        RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("unlink",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("symlink",     RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("readlink",    RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("rename",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("chmod",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("chown",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("lchown",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("utime",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("opendir",     RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("fcntl",       RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("mkfifo",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("fileno",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("access",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("remove",      RECORDER_OP_META,   0, -1, -1, -1, -1, -1, -1),
+    // No file name recorded
+    POSIX_DESC("getcwd",      RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("readdir",     RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("closedir",    RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("rewinddir",   RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("dup",         RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("dup2",        RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("umask",       RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+    POSIX_DESC("pipe",        RECORDER_OP_META,  -1, -1, -1, -1, -1, -1, -1),
+};
+
+/*
+ * MPI-IO functions follow one layout (see lib/recorder-mpi.c): the
+ * file handle first, then the offset for the explicit offset ones
+ * (*_at*), the buffer and the count in elements.
+ */
+static void describe_mpiio_function(const char* name, RecorderFuncDesc* desc) {
+    const char* op = name + strlen("MPI_File_");
+    if(*op == 'i')                  // nonblocking
+        op++;
+    bool is_read = (strncmp(op, "read", 4) == 0);
+    bool is_write = (strncmp(op, "write", 5) == 0);
+
+    desc->file_arg = 0;
+    if(is_read || is_write) {
+        bool explicit_offset = (strstr(op, "_at") != NULL);
+        desc->op = is_read ? RECORDER_OP_READ : RECORDER_OP_WRITE;
+        desc->offset_arg = explicit_offset ? 1 : -1;
+        desc->count_arg = explicit_offset ? 3 : 2;
+    } else if(strcmp(op, "open") == 0) {
+        desc->op = RECORDER_OP_OPEN;
+        desc->file_arg = 4;
+        desc->flags_arg = 2;
+    } else if(strcmp(op, "close") == 0) {
+        desc->op = RECORDER_OP_CLOSE;
+    } else if(strcmp(op, "sync") == 0) {
+        desc->op = RECORDER_OP_SYNC;
+    } else if(strncmp(op, "seek", 4) == 0) {
+        desc->op = RECORDER_OP_SEEK;
+        desc->offset_arg = 1;
+        desc->whence_arg = 2;
+    } else {                        // set_view, set_size, get_size
+        desc->op = RECORDER_OP_META;
+    }
+}
+
+static void describe_hdf5_function(const char* name, RecorderFuncDesc* desc) {
+    if(strcmp(name, "H5Dread") == 0 || strcmp(name, "H5Aread") == 0)
+        desc->op = RECORDER_OP_READ;
+    else if(strcmp(name, "H5Dwrite") == 0 || strcmp(name, "H5Awrite") == 0)
+        desc->op = RECORDER_OP_WRITE;
+    else if(strcmp(name, "H5Fcreate") == 0 || strcmp(name, "H5Fopen") == 0)
+        desc->op = RECORDER_OP_OPEN;
+    else if(strcmp(name, "H5Fclose") == 0)
+        desc->op = RECORDER_OP_CLOSE;
+    else if(strcmp(name, "H5Fflush") == 0)
+        desc->op = RECORDER_OP_SYNC;
+    else if(name[1] != 'P' && name[1] != 'S' && name[1] != 'T')
+        desc->op = RECORDER_OP_META;    // not property lists, dataspaces or datatypes
+}
+
+/*
+ * Called once func_list is read, functions are matched by name
+ * so the table does not depend on their order in the trace.
+ */
+static void build_func_descs(RecorderReader* reader, int num_funcs) {
+    for(int func_id = 0; func_id < 256; func_id++) {
+        RecorderFuncDesc* desc = &reader->func_descs[func_id];
+        memset(desc, -1, sizeof(*desc));
+        desc->op = RECORDER_OP_OTHER;
+        desc->at_pointer = false;
+        desc->layer = RECORDER_HDF5;
+        if(func_id < reader->mpi_start_idx)
+            desc->layer = RECORDER_POSIX;
+        else if(func_id < reader->hdf5_start_idx)
+            desc->layer = RECORDER_MPI;
+        if(func_id >= num_funcs)
+            continue;
+
+        const char* name = reader->func_list[func_id];
+        if(desc->layer == RECORDER_POSIX) {
+            for(int i = 0; i < sizeof(posix_descs)/sizeof(posix_descs[0]); i++) {
+                if(strcmp(name, posix_descs[i].name) == 0) {
+                    *desc = posix_descs[i].desc;
+                    break;
+                }
+            }
+        } else if(desc->layer == RECORDER_MPI) {
+            if(strncmp(name, "MPI_File_", 9) == 0) {
+                desc->layer = RECORDER_MPIIO;
+                describe_mpiio_function(name, desc);
+            }
+        } else {
+            describe_hdf5_function(name, desc);
+        }
+    }
+
+    RecorderFuncDesc* user = &reader->func_descs[RECORDER_USER_FUNCTION];
+    user->layer = RECORDER_FTRACE;
+    user->op = RECORDER_OP_OTHER;
+}
+
 void read_metadata(RecorderReader* reader) {
     char metadata_file[4096];
     snprintf(metadata_file, sizeof(metadata_file), "%s/recorder.mt", reader->logs_dir);
@@ -59,6 +285,7 @@ void read_metadata(RecorderReader* reader) {
     }
 
     fclose(fp);
+    build_func_descs(reader, func_id);
 }
 
 void recorder_init_reader(const char* logs_dir, RecorderReader *reader) {
@@ -69,7 +296,6 @@ void recorder_init_reader(const char* logs_dir, RecorderReader *reader) {
     strcpy(reader->logs_dir, logs_dir);
     reader->mpi_start_idx = -1;
     reader->hdf5_start_idx = -1;
-    reader->prev_tstart = 0.0;
 
     check_version(reader);
 
@@ -80,6 +306,7 @@ void recorder_init_reader(const char* logs_dir, RecorderReader *reader) {
 	reader->ug_ids = malloc(sizeof(int) * nprocs);
 	reader->csts   = malloc(sizeof(CST*) * nprocs);
 	reader->cfgs   = malloc(sizeof(CFG*) * nprocs);
+	reader->time_indexes = calloc(nprocs, sizeof(TimeIndex*));
 
 	for(int i = 0; i < nprocs; i++) {
 		reader->ug_ids[i] = i;
@@ -87,10 +314,30 @@ void recorder_init_reader(const char* logs_dir, RecorderReader *reader) {
 		reader->cfgs[i] = NULL;
 	}
 
+	// The program did not finalize, fall back to
+	// per-process checkpoints, see recorder_read_checkpoint()
+	if(reader->metadata.interprocess_compression) {
+		char ug_metadata_fname[1024] = {0}, cst_fname[1024] = {0};
+		sprintf(ug_metadata_fname, "%s/ug.mt", reader->logs_dir);
+		sprintf(cst_fname, "%s/0.cst", reader->logs_dir);
+		if(access(ug_metadata_fname, F_OK) != 0 || access(cst_fname, F_OK) != 0) {
+			fprintf(stderr, "[Recorder] incomplete trace, recovering from checkpoints\n");
+			reader->metadata.interprocess_compression = 0;
+		}
+	}
+
+	if(!reader->metadata.interprocess_compression)
+		reader->cache = rank_cache_create(nprocs);
+
 	if(reader->metadata.interprocess_compression) {
 		recorder_read_cst(reader, 0);
-		for(int i = 1; i < nprocs; i++)
-			reader->csts[i] = reader->csts[0];
+		// Each rank has its own CST (for its rank), they
+		// all share the call signatures of the merged CST
+		for(int i = 1; i < nprocs; i++) {
+			reader->csts[i] = malloc(sizeof(CST));
+			*(reader->csts[i]) = *(reader->csts[0]);
+			reader->csts[i]->rank = i;
+		}
 
 		char ug_metadata_fname[1024] = {0};
 		sprintf(ug_metadata_fname, "%s/ug.mt", reader->logs_dir);
@@ -107,16 +354,24 @@ void recorder_init_reader(const char* logs_dir, RecorderReader *reader) {
 
 void recorder_free_reader(RecorderReader *reader) {
     assert(reader);
-	free(reader->ug_ids);
 
 	if(reader->metadata.interprocess_compression) {
 		recorder_free_cst(reader->csts[0]);
-		free(reader->csts[0]);
+		for(int i = 0; i < reader->metadata.total_ranks; i++)
+			free(reader->csts[i]);
 		for(int i = 0; i < reader->num_ugs; i++) {
 			recorder_free_cfg(reader->cfgs[i]);
 			free(reader->cfgs[i]);
 		}
+	} else {
+		rank_cache_free(reader);
 	}
+	free(reader->ug_ids);
+
+	for(int i = 0; i < reader->metadata.total_ranks; i++)
+		if(reader->time_indexes[i])
+			free_time_index(reader->time_indexes[i]);
+	free(reader->time_indexes);
 
 	free(reader->csts);
 	free(reader->cfgs);
@@ -124,31 +379,24 @@ void recorder_free_reader(RecorderReader *reader) {
     memset(reader, 0, sizeof(*reader));
 }
 
-const char* recorder_get_func_name(RecorderReader* reader, Record* record) {
+const char* recorder_get_func_name(RecorderReader* reader, const Record* record) {
     if(record->func_id == RECORDER_USER_FUNCTION)
         return record->args[1];
     return reader->func_list[record->func_id];
 }
 
-int recorder_get_func_type(RecorderReader* reader, Record* record) {
-    if(record->func_id < reader->mpi_start_idx)
-        return RECORDER_POSIX;
-    if(record->func_id < reader->hdf5_start_idx) {
-        const char* func_name = recorder_get_func_name(reader, record);
-        if(strncmp(func_name, "MPI_File", 8) == 0)
-            return RECORDER_MPIIO;
-        return RECORDER_MPI;
-    }
-    if(record->func_id == RECORDER_USER_FUNCTION)
-        return RECORDER_FTRACE;
-    return RECORDER_HDF5;
+int recorder_get_func_type(RecorderReader* reader, const Record* record) {
+    return reader->func_descs[record->func_id].layer;
 }
 
-// Caller needs to free the record after use
-// with the recorder_free_record() call.
-Record* recorder_cs_to_record(CallSignature *cs) {
+const RecorderFuncDesc* recorder_get_func_desc(RecorderReader* reader, const Record* record) {
+    return &reader->func_descs[record->func_id];
+}
 
-    Record *record = malloc(sizeof(Record));
+static void parse_call_signature(CallSignature *cs, Record *record) {
+    memset(record, 0, sizeof(Record));
+    if(cs->key == NULL)             // missing in a recovered CST
+        return;
 
     char* key = cs->key;
 
@@ -179,22 +427,48 @@ Record* recorder_cs_to_record(CallSignature *cs) {
     }
 
     assert(ai == record->arg_count);
+}
+
+// Caller needs to free the record after use
+// with the recorder_free_record() call.
+Record* recorder_cs_to_record(CallSignature *cs) {
+    Record *record = malloc(sizeof(Record));
+    parse_call_signature(cs, record);
     return record;
 }
 
-void recorder_free_cst(CST* cst) {
+/*
+ * Parse every call signature once, decoded
+ * records refer to these templates.
+ */
+static void build_record_templates(CST* cst) {
+    cst->templates = malloc(sizeof(Record) * cst->entries);
     for(int i = 0; i < cst->entries; i++)
-        free(cst->cs_list[i].key);
+        parse_call_signature(&cst->cs_list[i], &cst->templates[i]);
+}
+
+void recorder_free_cst(CST* cst) {
+    for(int i = 0; i < cst->entries; i++) {
+        Record* r = &cst->templates[i];
+        for(int j = 0; j < r->arg_count; j++)
+            free(r->args[j]);
+        free(r->args);
+    }
+    free(cst->templates);
     free(cst->cs_list);
+    if(cst->map)
+        munmap(cst->map, cst->map_size);
 }
 
 void recorder_free_cfg(CFG* cfg) {
-    RuleHash *r, *tmp;
-    HASH_ITER(hh, cfg->cfg_head, r, tmp) {
-        HASH_DEL(cfg->cfg_head, r);
-        free(r->rule_body);
-        free(r);
-    }
+    HASH_CLEAR(hh, cfg->cfg_head);
+    for(int i = 0; i < cfg->rules; i++)
+        free(cfg->rule_list[i].terminals);
+    free(cfg->rule_list);
+    free(cfg->rule_table);
+    free(cfg->post_order);
+    if(cfg->map)
+        munmap(cfg->map, cfg->map_size);
 }
 
 void recorder_free_record(Record* r) {
@@ -204,6 +478,37 @@ void recorder_free_record(Record* r) {
     free(r);
 }
 
+static void read_cst_file(CST* cst, const char* cst_filename) {
+    cst->map = map_file(cst_filename, &cst->map_size);
+    assert(cst->map != NULL);
+
+    const char* ptr = cst->map;
+    memcpy(&cst->entries, ptr, sizeof(int));
+    ptr += sizeof(int);
+
+	// cst->cs_list will be stored in the terminal_id order.
+    cst->cs_list = malloc(cst->entries * sizeof(CallSignature));
+
+    for(int i = 0; i < cst->entries; i++) {
+		int terminal_id;
+        memcpy(&terminal_id, ptr, sizeof(int));
+		assert(terminal_id < cst->entries);
+
+		CallSignature* cs = &(cst->cs_list[terminal_id]);
+		cs->terminal_id = terminal_id;
+
+        memcpy(&(cs->rank), ptr+1*sizeof(int), sizeof(int));
+        memcpy(&(cs->key_len), ptr+2*sizeof(int), sizeof(int));
+        memcpy(&(cs->count), ptr+3*sizeof(int), sizeof(int));
+        ptr += 4*sizeof(int);
+
+        cs->key = (void*) ptr;
+        ptr += cs->key_len;
+    }
+
+    build_record_templates(cst);
+}
+
 void recorder_read_cst(RecorderReader *reader, int rank) {
 	reader->csts[rank] = malloc(sizeof(CST));
 	CST* cst = reader->csts[rank];
@@ -211,33 +516,139 @@ void recorder_read_cst(RecorderReader *reader, int rank) {
     cst->rank = rank;
     char cst_filename[1096] = {0};
     sprintf(cst_filename, "%s/%d.cst", reader->logs_dir, rank);
+    read_cst_file(cst, cst_filename);
+}
 
-    FILE* f = fopen(cst_filename, "rb");
+#define TERMINAL_START_ID   0
+#define MAX_FLAT_TERMINALS  64      // expansions kept for rules up to this length
 
-    int key_len;
-    fread(&cst->entries, sizeof(int), 1, f);
+static inline RuleHash* get_rule(CFG* cfg, int rule_id) {
+    assert(rule_id < TERMINAL_START_ID && -rule_id < cfg->rule_table_size);
+    RuleHash* rule = cfg->rule_table[-rule_id];
+    assert(rule != NULL);
+    return rule;
+}
 
-	// cst->cs_list will be stored in the terminal_id order.
-    cst->cs_list = malloc(cst->entries * sizeof(CallSignature));
+/*
+ * Compute the expanded length of every rule and keep the
+ * expansion of short rules, so decoding does not need to walk
+ * through them. Rules are visited in post-order with an explicit
+ * stack, as grammars can be nested deeper than the call stack allows.
+ */
+static void compile_cfg(CFG* cfg) {
+    int max_rule_id = 0;
+    for(int i = 0; i < cfg->rules; i++)
+        if(-cfg->rule_list[i].rule_id > max_rule_id)
+            max_rule_id = -cfg->rule_list[i].rule_id;
+    cfg->rule_table_size = max_rule_id + 1;
+    cfg->rule_table = calloc(cfg->rule_table_size, sizeof(RuleHash*));
+    for(int i = 0; i < cfg->rules; i++) {
+        RuleHash* rule = &cfg->rule_list[i];
+        cfg->rule_table[-rule->rule_id] = rule;
+        rule->length = 0;
+        rule->terminals = NULL;
+    }
 
-    for(int i = 0; i < cst->entries; i++) {
-		int terminal_id;
-        fread(&terminal_id, sizeof(int), 1, f);
-		assert(terminal_id < cst->entries);
+    // 0: not visited, 1: on the stack, 2: done
+    char* state = calloc(cfg->rule_table_size, 1);
+    RuleHash** stack = malloc(sizeof(RuleHash*) * cfg->rules);
+    int* next_symbol = malloc(sizeof(int) * cfg->rules);
+    int done = 0;
+    cfg->post_order = malloc(sizeof(RuleHash*) * cfg->rules);
 
-		CallSignature* cs = &(cst->cs_list[terminal_id]);
-		cs->terminal_id = terminal_id;
+    for(int i = 0; i < cfg->rules; i++) {
+        if(state[-cfg->rule_list[i].rule_id])
+            continue;
+
+        int top = 0;
+        stack[0] = &cfg->rule_list[i];
+        next_symbol[0] = 0;
+        state[-stack[0]->rule_id] = 1;
+
+        while(top >= 0) {
+            RuleHash* rule = stack[top];
+
+            // Descend into the first sub-rule not done yet
+            bool descended = false;
+            while(next_symbol[top] < rule->symbols) {
+                int sym_val = rule->rule_body[2*next_symbol[top]];
+                next_symbol[top]++;
+                if(sym_val >= TERMINAL_START_ID)
+                    continue;
+                RuleHash* sub = get_rule(cfg, sym_val);
+                assert(state[-sym_val] != 1);       // grammars are acyclic
+                if(state[-sym_val] == 0) {
+                    state[-sym_val] = 1;
+                    top++;
+                    stack[top] = sub;
+                    next_symbol[top] = 0;
+                    descended = true;
+                    break;
+                }
+            }
+            if(descended)
+                continue;
+
+            // All sub-rules are done
+            for(int j = 0; j < rule->symbols; j++) {
+                int sym_val = rule->rule_body[2*j+0];
+                int sym_exp = rule->rule_body[2*j+1];
+                size_t len = (sym_val >= TERMINAL_START_ID) ? 1 : get_rule(cfg, sym_val)->length;
+                rule->length += len * sym_exp;
+            }
+            if(rule->length <= MAX_FLAT_TERMINALS) {
+                rule->terminals = malloc(sizeof(int) * rule->length);
+                size_t k = 0;
+                for(int j = 0; j < rule->symbols; j++) {
+                    int sym_val = rule->rule_body[2*j+0];
+                    int sym_exp = rule->rule_body[2*j+1];
+                    for(int e = 0; e < sym_exp; e++) {
+                        if(sym_val >= TERMINAL_START_ID) {
+                            rule->terminals[k++] = sym_val;
+                        } else {
+                            RuleHash* sub = get_rule(cfg, sym_val);
+                            memcpy(rule->terminals+k, sub->terminals, sizeof(int) * sub->length);
+                            k += sub->length;
+                        }
+                    }
+                }
+            }
+            state[-rule->rule_id] = 2;
+            cfg->post_order[done++] = rule;
+            top--;
+        }
+    }
 
-        fread(&(cs->rank), sizeof(int), 1, f);
-        fread(&(cs->key_len), sizeof(int), 1, f);
-        fread(&(cs->count), sizeof(int), 1, f);
+    free(state);
+    free(stack);
+    free(next_symbol);
+}
 
-        cs->key = malloc(cs->key_len);
-        fread(cs->key, 1, cs->key_len, f);
+/*
+ * Build the rule table of a grammar serialized as in
+ * serialize_grammar(), rule bodies point into data.
+ */
+static void parse_cfg(CFG* cfg, int* data) {
+    int k = 0;
+    cfg->rules = data[k++];
+    cfg->rule_list = malloc(sizeof(RuleHash) * cfg->rules);
+    cfg->cfg_head = NULL;
+    for(int i = 0; i < cfg->rules; i++) {
+        RuleHash *rule = &cfg->rule_list[i];
+        rule->rule_id = data[k++];
+        rule->symbols = data[k++];
+        rule->rule_body = data + k;
+        k += rule->symbols*2;
+        HASH_ADD_INT(cfg->cfg_head, rule_id, rule);
     }
-    fclose(f);
+    compile_cfg(cfg);
 }
 
+static void read_cfg_file(CFG* cfg, const char* cfg_filename) {
+    cfg->map = map_file(cfg_filename, &cfg->map_size);
+    assert(cfg->map != NULL);
+    parse_cfg(cfg, (int*) cfg->map);
+}
 
 void recorder_read_cfg(RecorderReader *reader, int rank) {
 	reader->cfgs[rank] = malloc(sizeof(CFG));
@@ -246,35 +657,378 @@ void recorder_read_cfg(RecorderReader *reader, int rank) {
     cfg->rank = rank;
     char cfg_filename[1096] = {0};
     sprintf(cfg_filename, "%s/%d.cfg", reader->logs_dir, rank);
+    read_cfg_file(cfg, cfg_filename);
+}
 
-    FILE* f = fopen(cfg_filename, "rb");
+int recorder_get_num_segments(RecorderReader *reader, int rank) {
+    int segments = 0;
+    char cst_filename[1096] = {0};
+    while(true) {
+        sprintf(cst_filename, "%s/%d.%d.cst", reader->logs_dir, rank, segments);
+        if(access(cst_filename, F_OK) != 0)
+            break;
+        segments++;
+    }
+    return segments;
+}
 
-    fread(&cfg->rules, sizeof(int), 1, f);
+void recorder_read_segment(RecorderReader *reader, int rank, int segment, CST* cst, CFG* cfg) {
+    char filename[1096] = {0};
+    cst->rank = rank;
+    sprintf(filename, "%s/%d.%d.cst", reader->logs_dir, rank, segment);
+    read_cst_file(cst, filename);
 
-    cfg->cfg_head = NULL;
-    for(int i = 0; i < cfg->rules; i++) {
-        RuleHash *rule = malloc(sizeof(RuleHash));
+    cfg->rank = rank;
+    sprintf(filename, "%s/%d.%d.cfg", reader->logs_dir, rank, segment);
+    read_cfg_file(cfg, filename);
+}
 
-        fread(&(rule->rule_id), sizeof(int), 1, f);
-        fread(&(rule->symbols), sizeof(int), 1, f);
-        //printf("rule id: %d, symbols: %d\n", rule->rule_id, rule->symbols);
+/*
+ * Recover the CST and CFG of a rank from its checkpoint
+ * file (<rank>.ckpt) if the program did not finalize.
+ *
+ * Frames after the last complete commit, or after a
+ * corrupted frame, are ignored. The checkpoint only describes
+ * the last segment, saved segments are decoded before it.
+ * The timestamps of all records described by the committed
+ * grammar are guaranteed to be in the .ts file.
+ * With no committed checkpoint, the rank has no records.
+ */
+void recorder_read_checkpoint(RecorderReader *reader, int rank) {
+	CST* cst = malloc(sizeof(CST));
+	CFG* cfg = malloc(sizeof(CFG));
+	reader->csts[rank] = cst;
+	reader->cfgs[rank] = cfg;
+	cst->rank = rank;
+	cst->entries = 0;
+	cst->cs_list = NULL;
+	cst->templates = NULL;
+	cfg->rank = rank;
+
+	// Keys of the recovered CST point into the checkpoint file
+	char ckpt_filename[1096] = {0};
+	sprintf(ckpt_filename, "%s/%d.ckpt", reader->logs_dir, rank);
+	cst->map = map_file(ckpt_filename, &cst->map_size);
+	size_t fsize = cst->map_size;
+	char* data = cst->map;
+
+	// Scan frames, remember what the last commit covers
+	size_t pos = 0, committed_end = 0;
+	char* grammar = NULL, *committed_grammar = NULL;
+	size_t grammar_size = 0, committed_grammar_size = 0;
+	int segments = recorder_get_num_segments(reader, rank);
+	while(pos + sizeof(CheckpointFrame) + sizeof(uint32_t) <= fsize) {
+		CheckpointFrame frame;
+		memcpy(&frame, data+pos, sizeof(frame));
+		if(frame.magic != CKPT_MAGIC ||
+		   pos + sizeof(frame) + frame.size + sizeof(uint32_t) > fsize)
+			break;
+
+		char* payload = data + pos + sizeof(frame);
+		uint32_t checksum;
+		memcpy(&checksum, payload+frame.size, sizeof(uint32_t));
+		if(checksum != ckpt_checksum(CKPT_CHECKSUM_INIT, payload, frame.size))
+			break;
+
+		pos += sizeof(frame) + frame.size + sizeof(uint32_t);
+		if(frame.type == CKPT_GRAMMAR) {
+			grammar = payload;
+			grammar_size = frame.size;
+		}
+		if(frame.type == CKPT_COMMIT) {
+			// Ignore the checkpoint of a segment that
+			// has been saved (crashed before truncating)
+			int segment;
+			memcpy(&segment, payload+sizeof(int64_t), sizeof(int));
+			if(segment != segments)
+				break;
+			committed_end = pos;
+			committed_grammar = grammar;
+			committed_grammar_size = grammar_size;
+		}
+	}
 
-        rule->rule_body = (int*) malloc(sizeof(int)*rule->symbols*2);
-        fread(rule->rule_body, sizeof(int), rule->symbols*2, f);
-        HASH_ADD_INT(cfg->cfg_head, rule_id, rule);
+	// CST: entries of all committed CST frames
+	int max_terminal_id = -1;
+	for(int pass = 0; pass < 2; pass++) {
+		pos = 0;
+		while(pos < committed_end) {
+			CheckpointFrame frame;
+			memcpy(&frame, data+pos, sizeof(frame));
+			char* ptr = data + pos + sizeof(frame);
+			char* end = ptr + frame.size;
+			pos += sizeof(frame) + frame.size + sizeof(uint32_t);
+			if(frame.type != CKPT_CST)
+				continue;
+
+			while(ptr < end) {
+				int terminal_id, cs_rank, key_len;
+				memcpy(&terminal_id, ptr, sizeof(int));
+				memcpy(&cs_rank, ptr+sizeof(int), sizeof(int));
+				memcpy(&key_len, ptr+2*sizeof(int), sizeof(int));
+				ptr += 3*sizeof(int);
+				if(pass == 0) {
+					if(terminal_id > max_terminal_id)
+						max_terminal_id = terminal_id;
+				} else {
+					CallSignature* cs = &(cst->cs_list[terminal_id]);
+					cs->terminal_id = terminal_id;
+					cs->rank = cs_rank;
+					cs->key_len = key_len;
+					cs->count = 0;
+					cs->key = ptr;
+				}
+				ptr += key_len;
+			}
+		}
+		if(pass == 0) {
+			cst->entries = max_terminal_id + 1;
+			cst->cs_list = calloc(cst->entries, sizeof(CallSignature));
+		}
+	}
+	build_record_templates(cst);
+
+	// CFG: the last committed grammar, copied as frames
+	// in the checkpoint file are not aligned. With no
+	// commit, the grammar only has an empty start rule.
+	int empty_grammar[] = {1, -1, 0};
+	if(committed_grammar == NULL) {
+		committed_grammar = (char*) empty_grammar;
+		committed_grammar_size = sizeof(empty_grammar);
+	}
+	cfg->map_size = committed_grammar_size;
+	cfg->map = map_anonymous(cfg->map_size);
+	memcpy(cfg->map, committed_grammar, cfg->map_size);
+	parse_cfg(cfg, (int*) cfg->map);
+}
+
+/*
+ * Without interprocess compression, the CST and CFG of each rank
+ * are read on demand. Ranks in use are reference counted, unused
+ * ones stay loaded in an LRU list of at most `capacity` ranks.
+ * Optionally, a thread reads the `prefetch` ranks following the
+ * last requested one, to overlap I/O with decoding.
+ */
+#define RANK_CACHE_DEFAULT_CAPACITY 64
+
+typedef enum RankState_t { RANK_EMPTY, RANK_LOADING, RANK_LOADED } RankState;
+
+typedef struct RankEntry_t {
+    RankState state;
+    int refcount;
+    bool cached;                // in the LRU list
+    int lru_prev, lru_next;
+} RankEntry;
+
+struct RankCache_t {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;      // a rank finished loading
+    pthread_cond_t requested;   // wakes up the prefetch thread
+    RankEntry* entries;
+    int lru_head, lru_tail;     // least recently used first
+    int lru_size;
+    int capacity;               // < 0: unbounded
+    int prefetch;
+    int last_requested;
+    bool prefetching;
+    bool stop;
+    pthread_t prefetch_thread;
+};
+
+static void load_rank_tables(RecorderReader* reader, int rank) {
+	char cst_filename[1096] = {0};
+	sprintf(cst_filename, "%s/%d.cst", reader->logs_dir, rank);
+	if(access(cst_filename, F_OK) != 0)
+		recorder_read_checkpoint(reader, rank);
+
+	if(reader->csts[rank] == NULL)
+		recorder_read_cst(reader, rank);
+	if(reader->cfgs[rank] == NULL)
+		recorder_read_cfg(reader, rank);
+}
+
+static void free_rank_tables(RecorderReader* reader, int rank) {
+	if(reader->csts[rank]) {
+		recorder_free_cst(reader->csts[rank]);
+		free(reader->csts[rank]);
+		reader->csts[rank] = NULL;
+	}
+	if(reader->cfgs[rank]) {
+		recorder_free_cfg(reader->cfgs[rank]);
+		free(reader->cfgs[rank]);
+		reader->cfgs[rank] = NULL;
+	}
+}
+
+static void lru_remove(RankCache* cache, int rank) {
+    RankEntry* e = &cache->entries[rank];
+    if(e->lru_prev >= 0) cache->entries[e->lru_prev].lru_next = e->lru_next;
+    else cache->lru_head = e->lru_next;
+    if(e->lru_next >= 0) cache->entries[e->lru_next].lru_prev = e->lru_prev;
+    else cache->lru_tail = e->lru_prev;
+    e->cached = false;
+    cache->lru_size--;
+}
+
+static void lru_evict(RecorderReader* reader) {
+    RankCache* cache = reader->cache;
+    while(cache->capacity >= 0 && cache->lru_size > cache->capacity) {
+        int victim = cache->lru_head;
+        lru_remove(cache, victim);
+        cache->entries[victim].state = RANK_EMPTY;
+        free_rank_tables(reader, victim);
+    }
+}
+
+/*
+ * A rank is no longer in use, keep it as the most recently
+ * used one and evict the least recently used ones.
+ * Caller needs to hold cache->lock.
+ */
+static void lru_append(RecorderReader* reader, int rank) {
+    RankCache* cache = reader->cache;
+    RankEntry* e = &cache->entries[rank];
+    e->cached = true;
+    e->lru_prev = cache->lru_tail;
+    e->lru_next = -1;
+    if(cache->lru_tail >= 0) cache->entries[cache->lru_tail].lru_next = rank;
+    else cache->lru_head = rank;
+    cache->lru_tail = rank;
+    cache->lru_size++;
+
+    lru_evict(reader);
+}
+
+/*
+ * Caller needs to hold cache->lock, which is released
+ * while the files are read.
+ */
+static void cache_load(RecorderReader* reader, int rank) {
+    RankCache* cache = reader->cache;
+    cache->entries[rank].state = RANK_LOADING;
+    pthread_mutex_unlock(&cache->lock);
+    load_rank_tables(reader, rank);
+    pthread_mutex_lock(&cache->lock);
+    cache->entries[rank].state = RANK_LOADED;
+    pthread_cond_broadcast(&cache->loaded);
+}
+
+static void* prefetch_thread_main(void* arg) {
+    RecorderReader* reader = (RecorderReader*) arg;
+    RankCache* cache = reader->cache;
+
+    pthread_mutex_lock(&cache->lock);
+    while(!cache->stop) {
+        int rank = -1;
+        for(int i = 1; i <= cache->prefetch && rank < 0; i++) {
+            int r = cache->last_requested + i;
+            if(r < reader->metadata.total_ranks && cache->entries[r].state == RANK_EMPTY)
+                rank = r;
+        }
+        if(rank < 0) {
+            pthread_cond_wait(&cache->requested, &cache->lock);
+            continue;
+        }
+        cache_load(reader, rank);
+        if(cache->entries[rank].refcount == 0)
+            lru_append(reader, rank);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+static RankCache* rank_cache_create(int nprocs) {
+    RankCache* cache = calloc(1, sizeof(RankCache));
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    pthread_cond_init(&cache->requested, NULL);
+    cache->entries = calloc(nprocs, sizeof(RankEntry));
+    cache->lru_head = cache->lru_tail = -1;
+    cache->capacity = RANK_CACHE_DEFAULT_CAPACITY;
+    cache->last_requested = -1;
+    return cache;
+}
+
+static void rank_cache_free(RecorderReader* reader) {
+    RankCache* cache = reader->cache;
+    if(cache->prefetching) {
+        pthread_mutex_lock(&cache->lock);
+        cache->stop = true;
+        pthread_cond_signal(&cache->requested);
+        pthread_mutex_unlock(&cache->lock);
+        pthread_join(cache->prefetch_thread, NULL);
+    }
+
+    // Ranks still referenced are freed too
+    for(int i = 0; i < reader->metadata.total_ranks; i++)
+        free_rank_tables(reader, i);
+
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->loaded);
+    pthread_cond_destroy(&cache->requested);
+    free(cache->entries);
+    free(cache);
+    reader->cache = NULL;
+}
+
+void recorder_reader_set_cache(RecorderReader* reader, int capacity, int prefetch) {
+    RankCache* cache = reader->cache;
+    if(cache == NULL)       // interprocess compression, all loaded already
+        return;
+
+    // Prefetched ranks must not be evicted before use
+    if(capacity >= 0 && capacity < prefetch)
+        capacity = prefetch;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->capacity = capacity;
+    cache->prefetch = prefetch;
+    lru_evict(reader);
+    if(prefetch > 0 && !cache->prefetching) {
+        cache->prefetching = true;
+        pthread_create(&cache->prefetch_thread, NULL, prefetch_thread_main, reader);
     }
-    fclose(f);
+    pthread_cond_signal(&cache->requested);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Drop a reference taken by recorder_get_cst_cfg().
+ * Nothing to do with interprocess compression, CSTs and CFGs
+ * are shared by all ranks and freed by recorder_free_reader().
+ */
+void recorder_release_cst_cfg(RecorderReader* reader, int rank) {
+	RankCache* cache = reader->cache;
+	if(cache == NULL)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+	RankEntry* e = &cache->entries[rank];
+	if(e->refcount > 0 && --e->refcount == 0 && e->state == RANK_LOADED)
+		lru_append(reader, rank);
+	pthread_mutex_unlock(&cache->lock);
 }
 
 void recorder_get_cst_cfg(RecorderReader* reader, int rank, CST** cst, CFG** cfg) {
-	if(reader->metadata.interprocess_compression) {
-		// Do nothing, as we have already read
-		// csts and cfgs during initialization
-	} else {
-		if(reader->csts[rank] == NULL)
-			recorder_read_cst(reader, rank);
-		if(reader->cfgs[rank] == NULL)
-			recorder_read_cfg(reader, rank);
+	RankCache* cache = reader->cache;
+
+	// With interprocess compression, csts and
+	// cfgs have been read during initialization
+	if(cache) {
+		pthread_mutex_lock(&cache->lock);
+		cache->last_requested = rank;
+		if(cache->prefetching)
+			pthread_cond_signal(&cache->requested);
+
+		RankEntry* e = &cache->entries[rank];
+		while(e->state == RANK_LOADING)
+			pthread_cond_wait(&cache->loaded, &cache->lock);
+		if(e->state == RANK_EMPTY)
+			cache_load(reader, rank);
+		if(e->cached)
+			lru_remove(cache, rank);
+		e->refcount++;
+		pthread_mutex_unlock(&cache->lock);
 	}
 
 	*cst = reader->csts[rank];
@@ -282,56 +1036,869 @@ void recorder_get_cst_cfg(RecorderReader* reader, int rank, CST** cst, CFG** cfg
 }
 
 
-#define TERMINAL_START_ID 0
+/*
+ * Expansion state of one rule: the symbol being expanded
+ * and how many repetitions of it are done. For rules with
+ * a precomputed expansion, symbol is the next terminal.
+ */
+typedef struct ExpandFrame_t {
+    RuleHash* rule;
+    int symbol;
+    int repetition;
+} ExpandFrame;
 
-void rule_application(RecorderReader* reader, CFG* cfg, CST* cst, int rule_id, FILE* ts_file,
-                      void (*user_op)(Record*, void*), void* user_arg, int free_record) {
+#define DECODE_BATCH_SIZE   1024
 
-    RuleHash *rule = NULL;
-    HASH_FIND_INT(cfg->cfg_head, &rule_id, rule);
-    assert(rule != NULL);
+/*
+ * Resumable, non-recursive expansion of a grammar
+ */
+typedef struct Expander_t {
+    CFG* cfg;
+    ExpandFrame* stack;
+    int capacity;
+    int top;                // -1 when the grammar is fully expanded
+
+    // Only used by expander_next_filtered()
+    const char* rule_match;         // indexed by -rule_id
+    const char* terminal_match;
+    size_t skipped;                 // terminals skipped since the last one returned
+} Expander;
+
+static void expander_push(Expander* exp, RuleHash* rule) {
+    if(exp->top+1 == exp->capacity) {
+        exp->capacity *= 2;
+        exp->stack = realloc(exp->stack, sizeof(ExpandFrame) * exp->capacity);
+    }
+    exp->top++;
+    exp->stack[exp->top].rule = rule;
+    exp->stack[exp->top].symbol = 0;
+    exp->stack[exp->top].repetition = 0;
+}
 
-    for(int i = 0; i < rule->symbols; i++) {
-        int sym_val = rule->rule_body[2*i+0];
-        int sym_exp = rule->rule_body[2*i+1];
-        if (sym_val >= TERMINAL_START_ID) { // terminal
-            for(int j = 0; j < sym_exp; j++) {
-                Record* record = recorder_cs_to_record(&(cst->cs_list[sym_val]));
+static void expander_reset(Expander* exp, CFG* cfg) {
+    if(exp->stack == NULL) {
+        exp->capacity = 64;
+        exp->stack = malloc(sizeof(ExpandFrame) * exp->capacity);
+    }
+    exp->cfg = cfg;
+    exp->top = -1;
+    exp->skipped = 0;
+    expander_push(exp, get_rule(cfg, -1));
+}
 
-                // Fill in timestamps
-                uint32_t ts[2];
-                fread(ts, sizeof(uint32_t), 2, ts_file);
-                record->tstart = ts[0] * reader->metadata.time_resolution + reader->prev_tstart;
-                record->tend   = ts[1] * reader->metadata.time_resolution + reader->prev_tstart;
-                reader->prev_tstart = record->tstart;
+static void expander_free(Expander* exp) {
+    free(exp->stack);
+    exp->stack = NULL;
+}
 
-                user_op(record, user_arg);
+/*
+ * Expand up to n terminals into out.
+ * Return the number of terminals, 0 at the end of the grammar.
+ */
+static int expander_next(Expander* exp, int* out, int n) {
+    int k = 0;
+    while(k < n && exp->top >= 0) {
+        ExpandFrame* frame = &exp->stack[exp->top];
+        RuleHash* rule = frame->rule;
+
+        if(rule->terminals) {
+            int m = rule->length - frame->symbol;
+            if(m > n-k) m = n-k;
+            memcpy(out+k, rule->terminals+frame->symbol, sizeof(int) * m);
+            frame->symbol += m;
+            k += m;
+            if(frame->symbol == rule->length)
+                exp->top--;
+            continue;
+        }
+        if(frame->symbol == rule->symbols) {
+            exp->top--;
+            continue;
+        }
 
-                if(free_record)
-                    recorder_free_record(record);
+        int sym_val = rule->rule_body[2*frame->symbol+0];
+        int sym_exp = rule->rule_body[2*frame->symbol+1];
+        if(sym_val >= TERMINAL_START_ID) {          // terminal
+            int m = sym_exp - frame->repetition;
+            if(m > n-k) m = n-k;
+            for(int j = 0; j < m; j++)
+                out[k++] = sym_val;
+            frame->repetition += m;
+        } else if(frame->repetition < sym_exp) {    // non-terminal (i.e., rule)
+            RuleHash* sub = get_rule(exp->cfg, sym_val);
+            frame->repetition++;
+            if(sub->terminals && sub->length <= n-k) {
+                memcpy(out+k, sub->terminals, sizeof(int) * sub->length);
+                k += sub->length;
+            } else {
+                expander_push(exp, sub);            // invalidates frame
+                continue;
             }
-        } else {                            // non-terminal (i.e., rule)
-            for(int j = 0; j < sym_exp; j++)
-                rule_application(reader, cfg, cst, sym_val, ts_file, user_op, user_arg, free_record);
+        }
+
+        if(frame->repetition == sym_exp) {
+            frame->repetition = 0;
+            frame->symbol++;
         }
     }
+    return k;
 }
 
+/*
+ * Skip up to n terminals, whole rules are skipped using their length.
+ * Return the number of terminals skipped.
+ */
+static size_t expander_skip(Expander* exp, size_t n) {
+    size_t k = 0;
+    while(k < n && exp->top >= 0) {
+        ExpandFrame* frame = &exp->stack[exp->top];
+        RuleHash* rule = frame->rule;
+
+        if(rule->terminals) {
+            size_t m = rule->length - frame->symbol;
+            if(m > n-k) m = n-k;
+            frame->symbol += m;
+            k += m;
+            if(frame->symbol == rule->length)
+                exp->top--;
+            continue;
+        }
+        if(frame->symbol == rule->symbols) {
+            exp->top--;
+            continue;
+        }
 
-// Decode all records for one rank
-// one record at a time
-void recorder_decode_records_core(RecorderReader *reader, CST *cst, CFG *cfg,
-                             void (*user_op)(Record*, void*), void* user_arg, bool free_record) {
+        int sym_val = rule->rule_body[2*frame->symbol+0];
+        int sym_exp = rule->rule_body[2*frame->symbol+1];
+        size_t len = (sym_val >= TERMINAL_START_ID) ? 1 : get_rule(exp->cfg, sym_val)->length;
+        size_t m = (len == 0) ? (size_t)(sym_exp - frame->repetition) : (n-k) / len;
+        if(m > (size_t)(sym_exp - frame->repetition))
+            m = sym_exp - frame->repetition;
+        frame->repetition += m;
+        k += m * len;
+
+        if(frame->repetition == sym_exp) {
+            frame->repetition = 0;
+            frame->symbol++;
+        } else if(k < n) {
+            // Less than a whole repetition of the sub-rule left
+            frame->repetition++;
+            expander_push(exp, get_rule(exp->cfg, sym_val));
+        }
+    }
+    return k;
+}
+
+
+/*
+ * Same as expander_next(), but only returns terminals set in
+ * terminal_match. Rules not in rule_match have no such terminal
+ * and are skipped as a whole. skips[i] is the number of terminals
+ * skipped before out[i], the ones skipped after the last terminal
+ * returned are kept in exp->skipped.
+ */
+static int expander_next_filtered(Expander* exp, int* out, size_t* skips, int n) {
+    int k = 0;
+    while(k < n && exp->top >= 0) {
+        ExpandFrame* frame = &exp->stack[exp->top];
+        RuleHash* rule = frame->rule;
+
+        if(rule->terminals) {
+            while(k < n && frame->symbol < rule->length) {
+                int terminal = rule->terminals[frame->symbol++];
+                if(exp->terminal_match[terminal]) {
+                    out[k] = terminal;
+                    skips[k++] = exp->skipped;
+                    exp->skipped = 0;
+                } else {
+                    exp->skipped++;
+                }
+            }
+            if(frame->symbol == rule->length)
+                exp->top--;
+            continue;
+        }
+        if(frame->symbol == rule->symbols) {
+            exp->top--;
+            continue;
+        }
+
+        int sym_val = rule->rule_body[2*frame->symbol+0];
+        int sym_exp = rule->rule_body[2*frame->symbol+1];
+        if(sym_val >= TERMINAL_START_ID) {          // terminal
+            if(exp->terminal_match[sym_val]) {
+                int m = sym_exp - frame->repetition;
+                if(m > n-k) m = n-k;
+                for(int j = 0; j < m; j++) {
+                    out[k] = sym_val;
+                    skips[k++] = exp->skipped;
+                    exp->skipped = 0;
+                }
+                frame->repetition += m;
+            } else {
+                exp->skipped += sym_exp - frame->repetition;
+                frame->repetition = sym_exp;
+            }
+        } else if(!exp->rule_match[-sym_val]) {     // nothing to return in the rule
+            exp->skipped += (sym_exp - frame->repetition) * get_rule(exp->cfg, sym_val)->length;
+            frame->repetition = sym_exp;
+        } else if(frame->repetition < sym_exp) {
+            frame->repetition++;
+            expander_push(exp, get_rule(exp->cfg, sym_val));    // invalidates frame
+            continue;
+        }
+
+        if(frame->repetition == sym_exp) {
+            frame->repetition = 0;
+            frame->symbol++;
+        }
+    }
+    return k;
+}
 
-    reader->prev_tstart = 0.0;
+
+/*
+ * Decoding state of one rank. Segments saved when the memory budget
+ * was hit come first, they all share the same timestamps file.
+ */
+struct RecorderCursor_t {
+    RecorderReader* reader;
+    CST* cst;               // final CST and CFG of the rank
+    CFG* cfg;
+
+    int segments;
+    int segment;            // segments: decoding the final CST and CFG
+    CST seg_cst;
+    CFG seg_cfg;
+    bool seg_loaded;
+
+    Expander exp;
+    CST* current_cst;
+
+    uint32_t* ts_map;
+    size_t ts_size;
+    TimestampCursor ts;
+    double prev_tstart;
+    size_t record_idx;
+    bool done;
+
+    bool filtered;
+    RecorderFilter filter;
+    char* terminal_match;   // of the current CST and CFG
+    char* rule_match;
+
+    struct ArrowDictionary_t* arrow_dict;   // args of the CST of arrow_dict_segment
+    int arrow_dict_segment;
+
+    bool referenced;        // holds a reference to the rank's CST and CFG
+};
+
+static void arrow_dictionary_unref(struct ArrowDictionary_t* dict);
+
+static bool filter_match(RecorderFilter* filter, const Record* tmpl) {
+    bool any_func = !(filter->funcs[0] | filter->funcs[1] | filter->funcs[2] | filter->funcs[3]);
+    if(!any_func && !(filter->funcs[tmpl->func_id/64] & (1ULL << (tmpl->func_id%64))))
+        return false;
+    return filter->match == NULL || filter->match(tmpl, filter->match_arg);
+}
+
+/*
+ * Evaluate the filter once per call signature, then mark the rules
+ * that can produce a matching terminal, sub-rules first.
+ */
+static void cursor_compute_matches(RecorderCursor* cursor) {
+    CST* cst = cursor->current_cst;
+    CFG* cfg = cursor->exp.cfg;
+
+    free(cursor->terminal_match);
+    free(cursor->rule_match);
+    cursor->terminal_match = malloc(cst->entries > 0 ? cst->entries : 1);
+    cursor->rule_match = calloc(cfg->rule_table_size, 1);
+
+    for(int i = 0; i < cst->entries; i++)
+        cursor->terminal_match[i] = filter_match(&cursor->filter, &cst->templates[i]);
+
+    for(int i = 0; i < cfg->rules; i++) {
+        RuleHash* rule = cfg->post_order[i];
+        char match = 0;
+        for(int j = 0; j < rule->symbols && !match; j++) {
+            int sym_val = rule->rule_body[2*j+0];
+            match = (sym_val >= TERMINAL_START_ID) ?
+                    cursor->terminal_match[sym_val] : cursor->rule_match[-sym_val];
+        }
+        cursor->rule_match[-rule->rule_id] = match;
+    }
+
+    cursor->exp.terminal_match = cursor->terminal_match;
+    cursor->exp.rule_match = cursor->rule_match;
+}
+
+static void cursor_enter_segment(RecorderCursor* cursor, int segment) {
+    if(cursor->seg_loaded) {
+        recorder_free_cst(&cursor->seg_cst);
+        recorder_free_cfg(&cursor->seg_cfg);
+        cursor->seg_loaded = false;
+    }
+
+    cursor->segment = segment;
+    if(segment < cursor->segments) {
+        recorder_read_segment(cursor->reader, cursor->cst->rank, segment, &cursor->seg_cst, &cursor->seg_cfg);
+        cursor->seg_loaded = true;
+        cursor->current_cst = &cursor->seg_cst;
+        expander_reset(&cursor->exp, &cursor->seg_cfg);
+    } else {
+        cursor->current_cst = cursor->cst;
+        expander_reset(&cursor->exp, cursor->cfg);
+    }
+
+    if(cursor->filtered)
+        cursor_compute_matches(cursor);
+}
+
+static void cursor_rewind(RecorderCursor* cursor) {
+    cursor->ts.ptr = cursor->ts_map;
+    cursor->prev_tstart = 0.0;
+    cursor->record_idx = 0;
+    cursor->done = (cursor->ts_map == NULL);
+    cursor_enter_segment(cursor, 0);
+}
+
+/*
+ * Move over n records without decoding them, timestamps are
+ * deltas to the previous record's tstart so they still need to
+ * be accumulated. Return false if the timestamps file ends first.
+ */
+static bool cursor_skip_records(RecorderCursor* cursor, size_t n) {
+    double time_resolution = cursor->reader->metadata.time_resolution;
+    size_t available = (cursor->ts.end - cursor->ts.ptr) / 2;
+    bool complete = (n <= available);
+    if(!complete)
+        n = available;
+
+    for(size_t i = 0; i < n; i++)
+        cursor->prev_tstart = cursor->ts.ptr[2*i] * time_resolution + cursor->prev_tstart;
+    cursor->ts.ptr += 2*n;
+    cursor->record_idx += n;
+    return complete;
+}
+
+static RecorderCursor* cursor_open(RecorderReader* reader, CST* cst, CFG* cfg) {
+    RecorderCursor* cursor = calloc(1, sizeof(RecorderCursor));
+    cursor->reader = reader;
+    cursor->cst = cst;
+    cursor->cfg = cfg;
+    cursor->segments = recorder_get_num_segments(reader, cst->rank);
 
     char ts_filename[1096] = {0};
     sprintf(ts_filename, "%s/%d.ts", reader->logs_dir, cst->rank);
-    FILE* ts_file = fopen(ts_filename, "rb");
+    cursor->ts_map = map_file(ts_filename, &cursor->ts_size);
+    if(cursor->ts_map)
+        madvise(cursor->ts_map, cursor->ts_size, MADV_SEQUENTIAL);
+    cursor->ts.end = cursor->ts_map + cursor->ts_size / sizeof(uint32_t);
+
+    cursor_rewind(cursor);
+    return cursor;
+}
 
-    rule_application(reader, cfg, cst, -1, ts_file, user_op, user_arg, free_record);
+RecorderCursor* recorder_cursor_open(RecorderReader* reader, int rank) {
+    CST* cst;
+    CFG* cfg;
+    recorder_get_cst_cfg(reader, rank, &cst, &cfg);
+    RecorderCursor* cursor = cursor_open(reader, cst, cfg);
+    cursor->referenced = true;
+    return cursor;
+}
 
-    fclose(ts_file);
+void recorder_cursor_set_filter(RecorderCursor* cursor, const RecorderFilter* filter) {
+    cursor->filtered = (filter != NULL);
+    if(filter) {
+        cursor->filter = *filter;
+        cursor_compute_matches(cursor);
+    }
+}
+
+void recorder_cursor_close(RecorderCursor* cursor) {
+    if(cursor->seg_loaded) {
+        recorder_free_cst(&cursor->seg_cst);
+        recorder_free_cfg(&cursor->seg_cfg);
+    }
+    expander_free(&cursor->exp);
+    if(cursor->ts_map)
+        munmap(cursor->ts_map, cursor->ts_size);
+    free(cursor->terminal_match);
+    free(cursor->rule_match);
+    if(cursor->arrow_dict)
+        arrow_dictionary_unref(cursor->arrow_dict);
+    if(cursor->referenced)
+        recorder_release_cst_cfg(cursor->reader, cursor->cst->rank);
+    free(cursor);
+}
+
+/*
+ * If stop_at_segment is set, return 0 when entering a new segment so
+ * the caller can tell views of different segments (CSTs) apart, the
+ * cursor is done only if cursor->done is set.
+ */
+static size_t cursor_next_views(RecorderCursor* cursor, RecordView* views, size_t n, bool stop_at_segment) {
+    int terminals[DECODE_BATCH_SIZE];
+    size_t skips[DECODE_BATCH_SIZE];
+    double time_resolution = cursor->reader->metadata.time_resolution;
+    size_t k = 0;
+
+    while(k < n && !cursor->done) {
+        int want = (n-k < DECODE_BATCH_SIZE) ? n-k : DECODE_BATCH_SIZE;
+        int got = cursor->filtered ?
+                  expander_next_filtered(&cursor->exp, terminals, skips, want) :
+                  expander_next(&cursor->exp, terminals, want);
+
+        if(got == 0) {
+            // Records skipped at the end of the grammar
+            if(cursor->filtered && cursor->exp.skipped > 0) {
+                if(!cursor_skip_records(cursor, cursor->exp.skipped))
+                    cursor->done = true;
+                cursor->exp.skipped = 0;
+            }
+            // A batch does not span segments, views
+            // refer to the templates of the current one
+            if(cursor->segment < cursor->segments && k == 0 && !cursor->done) {
+                cursor_enter_segment(cursor, cursor->segment+1);
+                if(stop_at_segment)
+                    break;
+            } else if(cursor->segment == cursor->segments)
+                cursor->done = true;
+            if(k > 0)
+                break;
+            continue;
+        }
+
+        for(int i = 0; i < got; i++) {
+            if(cursor->filtered && skips[i] > 0 && !cursor_skip_records(cursor, skips[i])) {
+                cursor->done = true;        // incomplete trace
+                break;
+            }
+
+            // Fill in timestamps
+            if(cursor->ts.end - cursor->ts.ptr < 2) {
+                cursor->done = true;        // incomplete trace
+                break;
+            }
+            uint32_t ts_start = cursor->ts.ptr[0], ts_end = cursor->ts.ptr[1];
+            cursor->ts.ptr += 2;
+
+            RecordView* view = &views[k++];
+            view->seq_id = cursor->record_idx++;
+            view->tmpl   = &(cursor->current_cst->templates[terminals[i]]);
+            view->tstart = ts_start * time_resolution + cursor->prev_tstart;
+            view->tend   = ts_end * time_resolution + cursor->prev_tstart;
+            cursor->prev_tstart = view->tstart;
+        }
+    }
+
+    return k;
+}
+
+size_t recorder_cursor_next_batch(RecorderCursor* cursor, RecordView* views, size_t n) {
+    return cursor_next_views(cursor, views, n, false);
+}
+
+/*
+ * Move the grammar expansion to the record_idx-th record. If
+ * prev_tstart (the tstart of the record before) is known, the
+ * timestamps pointer is moved directly, otherwise deltas are summed.
+ */
+static bool cursor_seek(RecorderCursor* cursor, size_t record_idx, const double* prev_tstart) {
+    cursor_rewind(cursor);
+    if(cursor->done)
+        return record_idx == 0;
+
+    size_t skipped = 0;
+    while(true) {
+        skipped += expander_skip(&cursor->exp, record_idx - skipped);
+        if(skipped == record_idx || cursor->segment == cursor->segments)
+            break;
+        cursor_enter_segment(cursor, cursor->segment+1);
+    }
+
+    if(prev_tstart && skipped == record_idx && 2*skipped <= (size_t)(cursor->ts.end - cursor->ts.ptr)) {
+        cursor->ts.ptr += 2*skipped;
+        cursor->record_idx = skipped;
+        cursor->prev_tstart = *prev_tstart;
+        return true;
+    }
+
+    if(!cursor_skip_records(cursor, skipped) || skipped < record_idx) {
+        cursor->done = true;
+        return false;
+    }
+    return true;
+}
+
+bool recorder_cursor_seek(RecorderCursor* cursor, size_t record_idx) {
+    return cursor_seek(cursor, record_idx, NULL);
+}
+
+/*
+ * Timestamps checkpoints of a rank, taken every TIME_INDEX_INTERVAL
+ * records. tstart is non-decreasing in record order but tend is not,
+ * so the running maximum of tend is kept to find the first record
+ * that may still be running at a given time.
+ */
+#define TIME_INDEX_INTERVAL 4096
+
+struct TimeIndex_t {
+    size_t entries;
+    double* prev_tstart;    // tstart of the record before record i*TIME_INDEX_INTERVAL
+    double* max_tend;       // max tend of records [0, (i+1)*TIME_INDEX_INTERVAL)
+};
+
+static TimeIndex* build_time_index(RecorderCursor* cursor) {
+    double time_resolution = cursor->reader->metadata.time_resolution;
+    const uint32_t* ts = cursor->ts_map;
+    size_t records = cursor->ts_map ? (cursor->ts.end - cursor->ts_map) / 2 : 0;
+
+    TimeIndex* index = malloc(sizeof(TimeIndex));
+    index->entries = (records + TIME_INDEX_INTERVAL - 1) / TIME_INDEX_INTERVAL;
+    index->prev_tstart = malloc(sizeof(double) * (index->entries+1));
+    index->max_tend = malloc(sizeof(double) * (index->entries+1));
+
+    double prev_tstart = 0.0, max_tend = 0.0;
+    for(size_t i = 0; i < records; i++) {
+        if(i % TIME_INDEX_INTERVAL == 0)
+            index->prev_tstart[i / TIME_INDEX_INTERVAL] = prev_tstart;
+        double tend = ts[2*i+1] * time_resolution + prev_tstart;
+        if(tend > max_tend)
+            max_tend = tend;
+        prev_tstart = ts[2*i] * time_resolution + prev_tstart;
+        if(i % TIME_INDEX_INTERVAL == TIME_INDEX_INTERVAL-1 || i == records-1)
+            index->max_tend[i / TIME_INDEX_INTERVAL] = max_tend;
+    }
+    return index;
+}
+
+static void free_time_index(TimeIndex* index) {
+    free(index->prev_tstart);
+    free(index->max_tend);
+    free(index);
+}
+
+bool recorder_cursor_seek_time(RecorderCursor* cursor, double t) {
+    // Built once per rank, then kept by the reader
+    RecorderReader* reader = cursor->reader;
+    int rank = cursor->cst->rank;
+    if(reader->time_indexes[rank] == NULL)
+        reader->time_indexes[rank] = build_time_index(cursor);
+    TimeIndex* index = reader->time_indexes[rank];
+
+    // First block with a record ending at or after t
+    size_t lo = 0, hi = index->entries;
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(index->max_tend[mid] >= t)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    if(lo == index->entries) {
+        cursor_seek(cursor, index->entries * TIME_INDEX_INTERVAL, NULL);
+        cursor->done = true;
+        return false;
+    }
+    return cursor_seek(cursor, lo * TIME_INDEX_INTERVAL, &index->prev_tstart[lo]);
+}
+
+size_t recorder_cursor_tell(RecorderCursor* cursor) {
+    return cursor->record_idx;
+}
+
+
+// Decode all records for one rank
+// one record at a time
+void recorder_decode_record_views_core(RecorderReader *reader, CST *cst, CFG *cfg,
+                             void (*view_op)(RecordView*, void*), void* user_arg) {
+
+    RecordView views[DECODE_BATCH_SIZE];
+    RecorderCursor* cursor = cursor_open(reader, cst, cfg);
+
+    size_t n;
+    while((n = recorder_cursor_next_batch(cursor, views, DECODE_BATCH_SIZE)) > 0) {
+        for(size_t i = 0; i < n; i++)
+            view_op(&views[i], user_arg);
+    }
+
+    recorder_cursor_close(cursor);
+}
+
+void recorder_decode_record_views_filtered(RecorderReader *reader, int rank, const RecorderFilter* filter,
+                             void (*view_op)(RecordView*, void*), void* user_arg) {
+    RecordView views[DECODE_BATCH_SIZE];
+    RecorderCursor* cursor = recorder_cursor_open(reader, rank);
+    recorder_cursor_set_filter(cursor, filter);
+
+    size_t n;
+    while((n = recorder_cursor_next_batch(cursor, views, DECODE_BATCH_SIZE)) > 0) {
+        for(size_t i = 0; i < n; i++)
+            view_op(&views[i], user_arg);
+    }
+
+    recorder_cursor_close(cursor);
+}
+
+/*
+ * Records overlapping [t0, t1]. The cursor jumps to the block of the
+ * first record that ends at or after t0 and stops at the first record
+ * starting after t1, since tstart is non-decreasing.
+ */
+void recorder_decode_window(RecorderReader *reader, int rank, double t0, double t1,
+                             void (*view_op)(RecordView*, void*), void* user_arg) {
+    RecordView views[DECODE_BATCH_SIZE];
+    RecorderCursor* cursor = recorder_cursor_open(reader, rank);
+
+    bool in_window = recorder_cursor_seek_time(cursor, t0);
+    while(in_window) {
+        size_t n = recorder_cursor_next_batch(cursor, views, DECODE_BATCH_SIZE);
+        if(n == 0)
+            break;
+        for(size_t i = 0; i < n; i++) {
+            if(views[i].tstart > t1) {
+                in_window = false;
+                break;
+            }
+            if(views[i].tend >= t0)
+                view_op(&views[i], user_arg);
+        }
+    }
+
+    recorder_cursor_close(cursor);
+}
+
+/*
+ * Global time order merge, a min-heap of the ranks
+ * keyed on their next record.
+ */
+#define MERGE_BATCH_SIZE 64
+
+typedef struct MergeSource_t {
+    int rank;
+    RecorderCursor* cursor;
+    RecordView views[MERGE_BATCH_SIZE];
+    size_t count, pos;
+} MergeSource;
+
+struct RecorderMerge_t {
+    MergeSource* sources;   // one per rank
+    int num_sources;
+    MergeSource** heap;
+    int heap_size;
+    bool refill_top;        // the top source has returned its last buffered view
+};
+
+static inline bool merge_before(MergeSource* a, MergeSource* b) {
+    RecordView* va = &a->views[a->pos];
+    RecordView* vb = &b->views[b->pos];
+    if(va->tstart != vb->tstart)
+        return va->tstart < vb->tstart;
+    if(a->rank != b->rank)
+        return a->rank < b->rank;
+    return va->seq_id < vb->seq_id;
+}
+
+static void merge_sift_down(RecorderMerge* merge, int i) {
+    MergeSource** heap = merge->heap;
+    while(true) {
+        int min = i, l = 2*i+1, r = 2*i+2;
+        if(l < merge->heap_size && merge_before(heap[l], heap[min]))
+            min = l;
+        if(r < merge->heap_size && merge_before(heap[r], heap[min]))
+            min = r;
+        if(min == i)
+            break;
+        MergeSource* tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+static bool merge_source_fill(MergeSource* source) {
+    source->pos = 0;
+    source->count = recorder_cursor_next_batch(source->cursor, source->views, MERGE_BATCH_SIZE);
+    return source->count > 0;
+}
+
+RecorderMerge* recorder_merge_open(RecorderReader* reader, const RecorderFilter* filter) {
+    int nprocs = reader->metadata.total_ranks;
+    RecorderMerge* merge = malloc(sizeof(RecorderMerge));
+    merge->sources = malloc(sizeof(MergeSource) * nprocs);
+    merge->num_sources = nprocs;
+    merge->heap = malloc(sizeof(MergeSource*) * nprocs);
+    merge->heap_size = 0;
+    merge->refill_top = false;
+
+    for(int rank = 0; rank < nprocs; rank++) {
+        MergeSource* source = &merge->sources[rank];
+        source->rank = rank;
+        source->cursor = recorder_cursor_open(reader, rank);
+        if(filter)
+            recorder_cursor_set_filter(source->cursor, filter);
+        if(merge_source_fill(source))
+            merge->heap[merge->heap_size++] = source;
+    }
+
+    for(int i = merge->heap_size/2 - 1; i >= 0; i--)
+        merge_sift_down(merge, i);
+    return merge;
+}
+
+bool recorder_merge_next(RecorderMerge* merge, RecordView* view, int* rank) {
+    // Refilled only now, as the previous view may refer
+    // to the templates of a segment the cursor releases
+    if(merge->refill_top) {
+        merge->refill_top = false;
+        if(!merge_source_fill(merge->heap[0]))
+            merge->heap[0] = merge->heap[--merge->heap_size];
+        merge_sift_down(merge, 0);
+    }
+
+    if(merge->heap_size == 0)
+        return false;
+
+    MergeSource* top = merge->heap[0];
+    *view = top->views[top->pos++];
+    *rank = top->rank;
+
+    if(top->pos == top->count)
+        merge->refill_top = true;
+    else
+        merge_sift_down(merge, 0);
+    return true;
+}
+
+void recorder_merge_close(RecorderMerge* merge) {
+    for(int i = 0; i < merge->num_sources; i++)
+        recorder_cursor_close(merge->sources[i].cursor);
+    free(merge->sources);
+    free(merge->heap);
+    free(merge);
+}
+
+void recorder_filter_add_function(RecorderFilter* filter, int func_id) {
+    filter->funcs[func_id/64] |= (1ULL << (func_id%64));
+}
+
+void recorder_decode_record_views(RecorderReader *reader, int rank,
+                             void (*view_op)(RecordView*, void*), void* user_arg) {
+	CST* cst;
+	CFG* cfg;
+	recorder_get_cst_cfg(reader, rank, &cst, &cfg);
+    recorder_decode_record_views_core(reader, cst, cfg, view_op, user_arg);
+	recorder_release_cst_cfg(reader, rank);
+}
+
+
+/*
+ * Multi-threaded decoding, threads take the next rank to decode
+ * from a shared counter. CSTs and CFGs are read and released
+ * through the rank cache, the only part of the reader written.
+ */
+typedef struct ParallelDecode_t {
+    RecorderReader* reader;
+    const int* ranks;
+    int num_ranks;
+    int next;
+    RecorderRankOps* ops;
+} ParallelDecode;
+
+typedef struct DecodeThread_t {
+    ParallelDecode* pd;
+    void* ctx;
+} DecodeThread;
+
+static void* decode_thread_main(void* arg) {
+    DecodeThread* t = (DecodeThread*) arg;
+    ParallelDecode* pd = t->pd;
+    RecorderReader* reader = pd->reader;
+
+    while(true) {
+        int i = __atomic_fetch_add(&pd->next, 1, __ATOMIC_RELAXED);
+        if(i >= pd->num_ranks)
+            break;
+        int rank = pd->ranks ? pd->ranks[i] : i;
+
+        if(pd->ops->begin)
+            pd->ops->begin(rank, t->ctx);
+        recorder_decode_record_views(reader, rank, pd->ops->view_op, t->ctx);
+        if(pd->ops->end)
+            pd->ops->end(rank, t->ctx);
+    }
+    return NULL;
+}
+
+void recorder_decode_ranks_parallel(RecorderReader* reader, const int* ranks, int num_ranks,
+                                    int nthreads, RecorderRankOps* ops, void** ctxs) {
+    if(ranks == NULL)
+        num_ranks = reader->metadata.total_ranks;
+    if(nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads > num_ranks)
+        nthreads = num_ranks;
+    if(nthreads < 1)
+        nthreads = 1;
+
+    ParallelDecode pd = { .reader = reader, .ranks = ranks, .num_ranks = num_ranks, .next = 0, .ops = ops };
+    DecodeThread threads[nthreads];
+    pthread_t tids[nthreads];
+    for(int t = 0; t < nthreads; t++) {
+        threads[t].pd = &pd;
+        threads[t].ctx = ctxs ? ctxs[t] : NULL;
+    }
+
+    // The calling thread is one of the workers
+    for(int t = 1; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, decode_thread_main, &threads[t]);
+    decode_thread_main(&threads[0]);
+    for(int t = 1; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+}
+
+
+/*
+ * Record based decoding on top of record views
+ */
+typedef struct RecordOp_t {
+    void (*user_op)(Record*, void*);
+    void* user_arg;
+    bool free_record;
+} RecordOp;
+
+static void view_to_record(RecordView* view, void* arg) {
+    RecordOp* op = (RecordOp*) arg;
+
+    // The record is freed after user_op(), no need
+    // to copy the arguments out of the template
+    if(op->free_record) {
+        Record record = *(view->tmpl);
+        record.tstart = view->tstart;
+        record.tend   = view->tend;
+        op->user_op(&record, op->user_arg);
+        return;
+    }
+
+    // user_op() takes the ownership
+    Record* record = malloc(sizeof(Record));
+    *record = *(view->tmpl);
+    record->tstart = view->tstart;
+    record->tend   = view->tend;
+    record->args = malloc(sizeof(char*) * record->arg_count);
+    for(int i = 0; i < record->arg_count; i++)
+        record->args[i] = strdup(view->tmpl->args[i]);
+    op->user_op(record, op->user_arg);
+}
+
+void recorder_decode_records_core(RecorderReader *reader, CST *cst, CFG *cfg,
+                             void (*user_op)(Record*, void*), void* user_arg, bool free_record) {
+    RecordOp op = { .user_op = user_op, .user_arg = user_arg, .free_record = free_record };
+    recorder_decode_record_views_core(reader, cst, cfg, view_to_record, &op);
 }
 
 void recorder_decode_records(RecorderReader *reader, int rank,
@@ -341,32 +1908,471 @@ void recorder_decode_records(RecorderReader *reader, int rank,
 	CFG* cfg;
 	recorder_get_cst_cfg(reader, rank, &cst, &cfg);
     recorder_decode_records_core(reader, cst, cfg, user_op, user_arg, true);
+	recorder_release_cst_cfg(reader, rank);
 }
 
 
 
 /**
- * Similar to rule application, but only calcuate
- * the total number of calls if uncompressed.
+ * The total number of calls if uncompressed,
+ * computed when the grammar was loaded (see compile_cfg())
  */
 size_t get_uncompressed_count(RecorderReader* reader, CFG* cfg, int rule_id) {
-    RuleHash *rule = NULL;
-    HASH_FIND_INT(cfg->cfg_head, &rule_id, rule);
-    assert(rule != NULL);
+    return get_rule(cfg, rule_id)->length;
+}
+
+size_t recorder_get_num_records(RecorderReader* reader, int rank) {
+    // A start and an end delta per record,
+    // segments share the timestamps file
+    char ts_filename[1096] = {0};
+    sprintf(ts_filename, "%s/%d.ts", reader->logs_dir, rank);
+    struct stat st;
+    if(stat(ts_filename, &st) == 0)
+        return st.st_size / (2*sizeof(uint32_t));
+
+    CST* cst;
+    CFG* cfg;
+    recorder_get_cst_cfg(reader, rank, &cst, &cfg);
+    size_t count = get_uncompressed_count(reader, cfg, -1);
+    recorder_release_cst_cfg(reader, rank);
+    int segments = recorder_get_num_segments(reader, rank);
+    for(int seg = 0; seg < segments; seg++) {
+        CST seg_cst;
+        CFG seg_cfg;
+        recorder_read_segment(reader, rank, seg, &seg_cst, &seg_cfg);
+        count += get_uncompressed_count(reader, &seg_cfg, -1);
+        recorder_free_cst(&seg_cst);
+        recorder_free_cfg(&seg_cfg);
+    }
+    return count;
+}
+
+typedef struct PlanRank_t {
+    size_t count;
+    int rank;
+} PlanRank;
+
+static int compare_plan_ranks(const void* a, const void* b) {
+    const PlanRank* ra = a;
+    const PlanRank* rb = b;
+    if(ra->count != rb->count)
+        return ra->count > rb->count ? -1 : 1;
+    return ra->rank - rb->rank;
+}
+
+typedef struct PlanPart_t {
+    size_t load;
+    int part;
+} PlanPart;
+
+static bool plan_part_less(const PlanPart* a, const PlanPart* b) {
+    return a->load < b->load || (a->load == b->load && a->part < b->part);
+}
 
-    size_t count = 0;
+int recorder_plan_ranks(const size_t* counts, int num_ranks, int num_parts, int part, int* ranks) {
+    PlanRank* order = malloc(sizeof(PlanRank) * num_ranks);
+    for(int i = 0; i < num_ranks; i++) {
+        order[i].count = counts[i];
+        order[i].rank = i;
+    }
+    qsort(order, num_ranks, sizeof(PlanRank), compare_plan_ranks);
+
+    // Min-heap of parts by load, ties go to the lowest part
+    PlanPart* heap = malloc(sizeof(PlanPart) * num_parts);
+    for(int p = 0; p < num_parts; p++) {
+        heap[p].load = 0;
+        heap[p].part = p;
+    }
 
-    for(int i = 0; i < rule->symbols; i++) {
-        int sym_val = rule->rule_body[2*i+0];
-        int sym_exp = rule->rule_body[2*i+1];
-        if (sym_val >= TERMINAL_START_ID) { // terminal
-            count += sym_exp;
-        } else {                            // non-terminal (i.e., rule)
-            count += sym_exp * get_uncompressed_count(reader, cfg, sym_val);
+    int n = 0;
+    for(int i = 0; i < num_ranks; i++) {
+        if(heap[0].part == part)
+            ranks[n++] = order[i].rank;
+        // Every rank costs at least one, so empty ranks are spread too
+        heap[0].load += order[i].count + 1;
+
+        int j = 0;
+        while(true) {
+            int l = 2*j+1, r = 2*j+2, min = j;
+            if(l < num_parts && plan_part_less(&heap[l], &heap[min])) min = l;
+            if(r < num_parts && plan_part_less(&heap[r], &heap[min])) min = r;
+            if(min == j)
+                break;
+            PlanPart tmp = heap[j];
+            heap[j] = heap[min];
+            heap[min] = tmp;
+            j = min;
         }
     }
 
-    return count;
+    free(heap);
+    free(order);
+    return n;
+}
+
+
+
+/**
+ * Grammar-level analytics
+ *
+ * Aggregates are computed once per rule, bottom-up, and
+ * repeated symbols are folded with O(log exp) combines,
+ * so the cost is O(grammar size) instead of O(records).
+ */
+static void monoid_repeat(RecorderMonoid* m, void* acc, const void* value, size_t n,
+                          void* arg, char* power, char* tmp) {
+    if(n == 0)
+        return;
+    if(m->repeat) {
+        m->repeat(acc, value, n, arg);
+        return;
+    }
+    if(n == 1) {
+        m->combine(acc, value, arg);
+        return;
+    }
+    // Powers of the same value commute, this is
+    // correct for non-commutative monoids as well
+    memcpy(power, value, m->value_size);
+    while(n > 0) {
+        if(n & 1)
+            m->combine(acc, power, arg);
+        n >>= 1;
+        if(n > 0) {
+            memcpy(tmp, power, m->value_size);
+            m->combine(power, tmp, arg);
+        }
+    }
+}
+
+void recorder_evaluate_grammar(RecorderReader* reader, CST* cst, CFG* cfg,
+                               RecorderMonoid* m, void* arg, void* result) {
+    size_t vs = m->value_size;
+    char* terminal_values = malloc(vs * (cst->entries > 0 ? cst->entries : 1));
+    char* rule_values = malloc(vs * cfg->rule_table_size);
+    char* power = malloc(vs);
+    char* tmp = malloc(vs);
+
+    for(int i = 0; i < cst->entries; i++)
+        m->from_record(&cst->templates[i], terminal_values + i*vs, arg);
+
+    for(int i = 0; i < cfg->rules; i++) {
+        RuleHash* rule = cfg->post_order[i];
+        char* value = rule_values + (-rule->rule_id)*vs;
+        m->identity(value, arg);
+        for(int j = 0; j < rule->symbols; j++) {
+            int sym_val = rule->rule_body[2*j+0];
+            int sym_exp = rule->rule_body[2*j+1];
+            const char* sym_value = (sym_val >= TERMINAL_START_ID) ?
+                                    terminal_values + sym_val*vs : rule_values + (-sym_val)*vs;
+            monoid_repeat(m, value, sym_value, sym_exp, arg, power, tmp);
+        }
+    }
+    memcpy(result, rule_values + 1*vs, vs);
+
+    free(terminal_values);
+    free(rule_values);
+    free(power);
+    free(tmp);
+}
+
+/*
+ * Call fn() with each (segment and final) CST and CFG of a rank, in order
+ */
+static void for_each_grammar(RecorderReader* reader, int rank,
+                             void (*fn)(CST*, CFG*, void*), void* fn_arg) {
+    int segments = recorder_get_num_segments(reader, rank);
+    for(int seg = 0; seg < segments; seg++) {
+        CST seg_cst;
+        CFG seg_cfg;
+        recorder_read_segment(reader, rank, seg, &seg_cst, &seg_cfg);
+        fn(&seg_cst, &seg_cfg, fn_arg);
+        recorder_free_cst(&seg_cst);
+        recorder_free_cfg(&seg_cfg);
+    }
+
+    CST* cst;
+    CFG* cfg;
+    recorder_get_cst_cfg(reader, rank, &cst, &cfg);
+    fn(cst, cfg, fn_arg);
+    recorder_release_cst_cfg(reader, rank);
+}
+
+typedef struct EvaluateArgs_t {
+    RecorderReader* reader;
+    RecorderMonoid* m;
+    void* arg;
+    void* result;
+    void* value;
+} EvaluateArgs;
+
+static void evaluate_one_grammar(CST* cst, CFG* cfg, void* fn_arg) {
+    EvaluateArgs* ea = (EvaluateArgs*) fn_arg;
+    recorder_evaluate_grammar(ea->reader, cst, cfg, ea->m, ea->arg, ea->value);
+    ea->m->combine(ea->result, ea->value, ea->arg);
+}
+
+void recorder_evaluate_rank(RecorderReader* reader, int rank,
+                            RecorderMonoid* m, void* arg, void* result) {
+    EvaluateArgs ea = { reader, m, arg, result, malloc(m->value_size) };
+    m->identity(result, arg);
+    for_each_grammar(reader, rank, evaluate_one_grammar, &ea);
+    free(ea.value);
+}
+
+/*
+ * Top-down: the number of times each rule is expanded is the
+ * sum over its uses of (expansions of the user * exponent).
+ */
+void recorder_count_signatures(CST* cst, CFG* cfg, size_t* counts) {
+    size_t* expansions = calloc(cfg->rule_table_size, sizeof(size_t));
+    expansions[1] = 1;      // start rule
+    for(int i = cfg->rules-1; i >= 0; i--) {
+        RuleHash* rule = cfg->post_order[i];
+        size_t n = expansions[-rule->rule_id];
+        if(n == 0)
+            continue;
+        for(int j = 0; j < rule->symbols; j++) {
+            int sym_val = rule->rule_body[2*j+0];
+            int sym_exp = rule->rule_body[2*j+1];
+            if(sym_val >= TERMINAL_START_ID)
+                counts[sym_val] += n * sym_exp;
+            else
+                expansions[-sym_val] += n * sym_exp;
+        }
+    }
+    free(expansions);
+}
+
+/*
+ * Bytes requested by a POSIX read/write call,
+ * see func_descs for where the arguments are
+ */
+bool recorder_get_io_bytes(RecorderReader* reader, const Record* record,
+                           const char** filename, size_t* bytes, bool* is_read) {
+    const RecorderFuncDesc* desc = &reader->func_descs[record->func_id];
+    if(desc->layer != RECORDER_POSIX)
+        return false;
+    if(desc->op != RECORDER_OP_READ && desc->op != RECORDER_OP_WRITE)
+        return false;
+    // e.g., missing from a recovered CST
+    if(record->arg_count <= desc->file_arg || record->arg_count <= desc->count_arg ||
+       record->arg_count <= desc->size_arg)
+        return false;
+
+    *is_read = (desc->op == RECORDER_OP_READ);
+    *filename = record->args[desc->file_arg];
+    *bytes = strtoull(record->args[desc->count_arg], NULL, 10);
+    if(desc->size_arg >= 0)
+        *bytes *= strtoull(record->args[desc->size_arg], NULL, 10);
+    return true;
+}
+
+/*
+ * Predefined MPI datatypes by the names lib/recorder-mpi.c logs
+ * (MPI_Type_get_name). Derived datatypes have no size in the trace.
+ */
+typedef struct MPITypeSize_t {
+    const char* name;
+    size_t size;
+} MPITypeSize;
+
+static const MPITypeSize mpi_type_sizes[] = {
+    { "MPI_CHAR", 1 }, { "MPI_SIGNED_CHAR", 1 }, { "MPI_UNSIGNED_CHAR", 1 },
+    { "MPI_BYTE", 1 }, { "MPI_PACKED", 1 }, { "MPI_CHARACTER", 1 },
+    { "MPI_SHORT", sizeof(short) }, { "MPI_UNSIGNED_SHORT", sizeof(short) },
+    { "MPI_INT", sizeof(int) }, { "MPI_UNSIGNED", sizeof(int) },
+    { "MPI_LONG", sizeof(long) }, { "MPI_UNSIGNED_LONG", sizeof(long) },
+    { "MPI_LONG_LONG", sizeof(long long) }, { "MPI_LONG_LONG_INT", sizeof(long long) },
+    { "MPI_UNSIGNED_LONG_LONG", sizeof(long long) },
+    { "MPI_FLOAT", sizeof(float) }, { "MPI_DOUBLE", sizeof(double) },
+    { "MPI_LONG_DOUBLE", sizeof(long double) }, { "MPI_C_BOOL", sizeof(bool) },
+    { "MPI_INT8_T", 1 }, { "MPI_INT16_T", 2 }, { "MPI_INT32_T", 4 }, { "MPI_INT64_T", 8 },
+    { "MPI_UINT8_T", 1 }, { "MPI_UINT16_T", 2 }, { "MPI_UINT32_T", 4 }, { "MPI_UINT64_T", 8 },
+    { "MPI_AINT", 8 }, { "MPI_OFFSET", 8 }, { "MPI_COUNT", 8 },
+    { "MPI_C_FLOAT_COMPLEX", 2*sizeof(float) }, { "MPI_C_COMPLEX", 2*sizeof(float) },
+    { "MPI_C_DOUBLE_COMPLEX", 2*sizeof(double) },
+    // Fortran, default kinds
+    { "MPI_INTEGER", 4 }, { "MPI_REAL", 4 }, { "MPI_LOGICAL", 4 },
+    { "MPI_DOUBLE_PRECISION", 8 }, { "MPI_COMPLEX", 8 }, { "MPI_DOUBLE_COMPLEX", 16 },
+    { "MPI_INTEGER1", 1 }, { "MPI_INTEGER2", 2 }, { "MPI_INTEGER4", 4 }, { "MPI_INTEGER8", 8 },
+    { "MPI_REAL4", 4 }, { "MPI_REAL8", 8 },
+};
+
+static size_t mpi_type_size(const char* name) {
+    for(int i = 0; i < sizeof(mpi_type_sizes)/sizeof(mpi_type_sizes[0]); i++) {
+        if(strcmp(name, mpi_type_sizes[i].name) == 0)
+            return mpi_type_sizes[i].size;
+    }
+    return 0;
+}
+
+bool recorder_get_layer_io_bytes(RecorderReader* reader, const Record* record,
+                                 size_t* bytes, bool* sized, bool* is_read) {
+    const RecorderFuncDesc* desc = &reader->func_descs[record->func_id];
+    if(desc->op != RECORDER_OP_READ && desc->op != RECORDER_OP_WRITE)
+        return false;
+
+    *is_read = (desc->op == RECORDER_OP_READ);
+    *bytes = 0;
+    *sized = false;
+    const char* filename;
+    bool posix_read;
+    if(desc->layer == RECORDER_POSIX) {
+        *sized = recorder_get_io_bytes(reader, record, &filename, bytes, &posix_read);
+    } else if(desc->layer == RECORDER_MPIIO) {
+        // The datatype follows the count
+        int type_arg = desc->count_arg + 1;
+        if(record->arg_count > type_arg) {
+            size_t size = mpi_type_size(record->args[type_arg]);
+            *bytes = strtoull(record->args[desc->count_arg], NULL, 10) * size;
+            *sized = (size > 0);
+        }
+    }
+    return true;
+}
+
+/*
+ * Where the last call at the file pointer on each file ended,
+ * as lib/recorder-logger.c keeps it while tracing.
+ */
+typedef struct FileEnd_t {
+    char* filename;
+    long long end;
+    UT_hash_handle hh;
+} FileEnd;
+
+struct RecorderFileOffsets_t {
+    FileEnd* ends;
+    bool lost;                  // a record without arguments, see below
+};
+
+RecorderFileOffsets* recorder_new_file_offsets() {
+    return calloc(1, sizeof(RecorderFileOffsets));
+}
+
+void recorder_free_file_offsets(RecorderFileOffsets* offsets) {
+    FileEnd *fe, *tmp;
+    HASH_ITER(hh, offsets->ends, fe, tmp) {
+        HASH_DEL(offsets->ends, fe);
+        free(fe->filename);
+        free(fe);
+    }
+    free(offsets);
+}
+
+bool recorder_get_io_offset(RecorderReader* reader, RecorderFileOffsets* offsets,
+                            const Record* record, size_t* offset) {
+    const RecorderFuncDesc* desc = &reader->func_descs[record->func_id];
+    if(desc->layer != RECORDER_POSIX)
+        return false;
+    if(desc->op != RECORDER_OP_READ && desc->op != RECORDER_OP_WRITE)
+        return false;
+    // Missing from a recovered CST, the offsets after it are unknown
+    if(desc->at_pointer && record->arg_count == 0)
+        offsets->lost = true;
+    if(desc->offset_arg < 0 || record->arg_count <= desc->offset_arg)
+        return false;
+
+    const char* arg = record->args[desc->offset_arg];
+    if(!desc->at_pointer) {
+        *offset = strtoull(arg, NULL, 10);
+        return true;
+    }
+    // The position was unknown when the call was made
+    if(arg[0] == '?' || offsets->lost)
+        return false;
+
+    FileEnd* fe = NULL;
+    const char* filename = record->args[desc->file_arg];
+    HASH_FIND_STR(offsets->ends, filename, fe);
+    if(!fe) {
+        fe = malloc(sizeof(FileEnd));
+        fe->filename = strdup(filename);
+        fe->end = 0;
+        HASH_ADD_KEYPTR(hh, offsets->ends, fe->filename, strlen(fe->filename), fe);
+    }
+
+    long long start = fe->end + strtoll(arg, NULL, 10);
+    long long bytes = strtoll(record->args[desc->count_arg], NULL, 10);
+    if(desc->size_arg >= 0)
+        bytes *= strtoll(record->args[desc->size_arg], NULL, 10);
+    fe->end = start + bytes;
+    *offset = start;
+    return true;
+}
+
+typedef struct VisitArgs_t {
+    void (*op)(const Record* tmpl, size_t count, void* arg);
+    void* arg;
+} VisitArgs;
+
+static void visit_one_grammar(CST* cst, CFG* cfg, void* fn_arg) {
+    VisitArgs* va = (VisitArgs*) fn_arg;
+    size_t* counts = calloc(cst->entries > 0 ? cst->entries : 1, sizeof(size_t));
+    recorder_count_signatures(cst, cfg, counts);
+    for(int i = 0; i < cst->entries; i++) {
+        if(counts[i] > 0)
+            va->op(&cst->templates[i], counts[i], va->arg);
+    }
+    free(counts);
+}
+
+void recorder_visit_signatures(RecorderReader* reader, int rank,
+                               void (*op)(const Record* tmpl, size_t count, void* arg), void* arg) {
+    VisitArgs va = { op, arg };
+    for_each_grammar(reader, rank, visit_one_grammar, &va);
+}
+
+typedef struct SummaryArgs_t {
+    RecorderReader* reader;
+    size_t* func_counts;
+    FileIOStat** files;
+} SummaryArgs;
+
+static void summarize_one_signature(const Record* record, size_t count, void* arg) {
+    SummaryArgs* sa = (SummaryArgs*) arg;
+    if(sa->func_counts)
+        sa->func_counts[record->func_id] += count;
+
+    const char* filename;
+    size_t bytes;
+    bool is_read;
+    if(sa->files && recorder_get_io_bytes(sa->reader, record, &filename, &bytes, &is_read)) {
+        FileIOStat* f = NULL;
+        HASH_FIND_STR(*(sa->files), filename, f);
+        if(f == NULL) {
+            f = calloc(1, sizeof(FileIOStat));
+            f->filename = strdup(filename);
+            HASH_ADD_KEYPTR(hh, *(sa->files), f->filename, strlen(f->filename), f);
+        }
+        if(is_read) {
+            f->reads += count;
+            f->bytes_read += count * bytes;
+        } else {
+            f->writes += count;
+            f->bytes_written += count * bytes;
+        }
+    }
+}
+
+void recorder_count_functions(RecorderReader* reader, int rank, size_t* counts) {
+    SummaryArgs sa = { reader, counts, NULL };
+    recorder_visit_signatures(reader, rank, summarize_one_signature, &sa);
+}
+
+void recorder_count_file_io(RecorderReader* reader, int rank, FileIOStat** files) {
+    SummaryArgs sa = { reader, NULL, files };
+    recorder_visit_signatures(reader, rank, summarize_one_signature, &sa);
+}
+
+void recorder_free_file_io(FileIOStat** files) {
+    FileIOStat *f, *tmp;
+    HASH_ITER(hh, *files, f, tmp) {
+        HASH_DEL(*files, f);
+        free(f->filename);
+        free(f);
+    }
 }
 
 
@@ -412,6 +2418,15 @@ PyRecord** read_all_records(char* traces_dir, size_t* counts, RecorderMetadata *
         recorder_get_cst_cfg(&reader, rank, &cst, &cfg);
 
         counts[rank] = get_uncompressed_count(&reader, cfg, -1);
+        int segments = recorder_get_num_segments(&reader, rank);
+        for(int seg = 0; seg < segments; seg++) {
+            CST seg_cst;
+            CFG seg_cfg;
+            recorder_read_segment(&reader, rank, seg, &seg_cst, &seg_cfg);
+            counts[rank] += get_uncompressed_count(&reader, &seg_cfg, -1);
+            recorder_free_cst(&seg_cst);
+            recorder_free_cfg(&seg_cfg);
+        }
         records[rank] = malloc(sizeof(PyRecord)* counts[rank]);
 
         records_with_idx_t ri;
@@ -419,9 +2434,215 @@ PyRecord** read_all_records(char* traces_dir, size_t* counts, RecorderMetadata *
         ri.idx = 0;
 
         recorder_decode_records_core(&reader, cst, cfg, insert_one_record, &ri, false);
+        counts[rank] = ri.idx;      // less than expected for an incomplete trace
+        recorder_release_cst_cfg(&reader, rank);
     }
 
     recorder_free_reader(&reader);
 
     return records;
 }
+
+
+/*
+ * Arrow C Data Interface export, also for recorder-viz
+ *
+ * Every exported array owns its buffers and can be released on its
+ * own (consumers are allowed to move children out of a batch). The
+ * args dictionary is shared by all batches of the same CST.
+ */
+#define ARROW_BATCH_COLUMNS 7
+
+typedef struct ArrowDictionary_t {
+    int refcount;
+    int64_t length;
+    int32_t* offsets;
+    char* chars;
+} ArrowDictionary;
+
+typedef struct ArrowPrivate_t {
+    const void* buffers[3];
+    void* owned;                // values buffer
+    ArrowDictionary* dict;      // args dictionary, shared
+} ArrowPrivate;
+
+static void arrow_dictionary_unref(ArrowDictionary* dict) {
+    if(__atomic_sub_fetch(&dict->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    free(dict->offsets);
+    free(dict->chars);
+    free(dict);
+}
+
+/*
+ * Arguments of every call signature of the CST, separated by
+ * spaces as in recorder2text. User functions have none.
+ */
+static ArrowDictionary* arrow_dictionary_create(CST* cst) {
+    ArrowDictionary* dict = malloc(sizeof(ArrowDictionary));
+    dict->refcount = 1;
+    dict->length = cst->entries;
+    dict->offsets = malloc(sizeof(int32_t) * (cst->entries+1));
+
+    size_t total = 0;
+    for(int i = 0; i < cst->entries; i++) {
+        const Record* tmpl = &cst->templates[i];
+        for(int j = 0; tmpl->func_id != RECORDER_USER_FUNCTION && j < tmpl->arg_count; j++)
+            total += strlen(tmpl->args[j]) + (j > 0);
+    }
+
+    dict->chars = malloc(total > 0 ? total : 1);
+    int32_t pos = 0;
+    for(int i = 0; i < cst->entries; i++) {
+        const Record* tmpl = &cst->templates[i];
+        dict->offsets[i] = pos;
+        for(int j = 0; tmpl->func_id != RECORDER_USER_FUNCTION && j < tmpl->arg_count; j++) {
+            if(j > 0)
+                dict->chars[pos++] = ' ';
+            size_t len = strlen(tmpl->args[j]);
+            memcpy(dict->chars+pos, tmpl->args[j], len);
+            pos += len;
+        }
+    }
+    dict->offsets[cst->entries] = pos;
+    return dict;
+}
+
+static void arrow_release_array(struct ArrowArray* array) {
+    ArrowPrivate* priv = array->private_data;
+    for(int64_t i = 0; i < array->n_children; i++) {
+        if(array->children[i]->release)
+            array->children[i]->release(array->children[i]);
+        free(array->children[i]);
+    }
+    free(array->children);
+    if(array->dictionary) {
+        if(array->dictionary->release)
+            array->dictionary->release(array->dictionary);
+        free(array->dictionary);
+    }
+    free(priv->owned);
+    if(priv->dict)
+        arrow_dictionary_unref(priv->dict);
+    free(priv);
+    array->release = NULL;
+}
+
+static void arrow_init_array(struct ArrowArray* array, int64_t length, int64_t n_buffers, void* owned) {
+    ArrowPrivate* priv = calloc(1, sizeof(ArrowPrivate));
+    priv->owned = owned;
+    priv->buffers[1] = owned;
+    memset(array, 0, sizeof(struct ArrowArray));
+    array->length = length;
+    array->n_buffers = n_buffers;
+    array->buffers = priv->buffers;
+    array->private_data = priv;
+    array->release = arrow_release_array;
+}
+
+static void arrow_release_schema(struct ArrowSchema* schema) {
+    for(int64_t i = 0; i < schema->n_children; i++) {
+        if(schema->children[i]->release)
+            schema->children[i]->release(schema->children[i]);
+        free(schema->children[i]);
+    }
+    free(schema->children);
+    if(schema->dictionary) {
+        if(schema->dictionary->release)
+            schema->dictionary->release(schema->dictionary);
+        free(schema->dictionary);
+    }
+    schema->release = NULL;
+}
+
+static void arrow_init_schema(struct ArrowSchema* schema, const char* format, const char* name, int64_t n_children) {
+    memset(schema, 0, sizeof(struct ArrowSchema));
+    schema->format = format;
+    schema->name = name;
+    schema->n_children = n_children;
+    if(n_children > 0) {
+        schema->children = malloc(sizeof(struct ArrowSchema*) * n_children);
+        for(int64_t i = 0; i < n_children; i++)
+            schema->children[i] = malloc(sizeof(struct ArrowSchema));
+    }
+    schema->release = arrow_release_schema;
+}
+
+void recorder_arrow_schema(struct ArrowSchema* schema) {
+    static const char* formats[ARROW_BATCH_COLUMNS] = { "i", "g", "g", "C", "C", "L", "i" };
+    static const char* names[ARROW_BATCH_COLUMNS] = { "rank", "tstart", "tend", "func_id", "level", "tid", "args" };
+
+    arrow_init_schema(schema, "+s", "", ARROW_BATCH_COLUMNS);
+    for(int i = 0; i < ARROW_BATCH_COLUMNS; i++)
+        arrow_init_schema(schema->children[i], formats[i], names[i], 0);
+
+    struct ArrowSchema* args = schema->children[ARROW_BATCH_COLUMNS-1];
+    args->dictionary = malloc(sizeof(struct ArrowSchema));
+    arrow_init_schema(args->dictionary, "u", "", 0);
+}
+
+bool recorder_cursor_next_arrow_batch(RecorderCursor* cursor, size_t max_records, struct ArrowArray* batch) {
+    RecordView views[DECODE_BATCH_SIZE];
+    int32_t* rank    = malloc(sizeof(int32_t) * max_records);
+    double*  tstart  = malloc(sizeof(double) * max_records);
+    double*  tend    = malloc(sizeof(double) * max_records);
+    uint8_t* func_id = malloc(max_records);
+    uint8_t* level   = malloc(max_records);
+    uint64_t* tid    = malloc(sizeof(uint64_t) * max_records);
+    int32_t* args    = malloc(sizeof(int32_t) * max_records);
+
+    // All views of a batch come from the same
+    // segment, so they share the args dictionary
+    size_t rows = 0;
+    while(rows < max_records && !cursor->done) {
+        size_t want = max_records - rows;
+        size_t n = cursor_next_views(cursor, views, want < DECODE_BATCH_SIZE ? want : DECODE_BATCH_SIZE, true);
+        if(n == 0) {
+            if(rows > 0)
+                break;
+            continue;
+        }
+        if(rows == 0 && (cursor->arrow_dict == NULL || cursor->arrow_dict_segment != cursor->segment)) {
+            if(cursor->arrow_dict)
+                arrow_dictionary_unref(cursor->arrow_dict);
+            cursor->arrow_dict = arrow_dictionary_create(cursor->current_cst);
+            cursor->arrow_dict_segment = cursor->segment;
+        }
+        for(size_t i = 0; i < n; i++, rows++) {
+            const Record* tmpl = views[i].tmpl;
+            rank[rows]    = cursor->cst->rank;
+            tstart[rows]  = views[i].tstart;
+            tend[rows]    = views[i].tend;
+            func_id[rows] = tmpl->func_id;
+            level[rows]   = tmpl->level;
+            tid[rows]     = (uint64_t) tmpl->tid;
+            args[rows]    = tmpl - cursor->current_cst->templates;
+        }
+    }
+
+    if(rows == 0) {
+        free(rank); free(tstart); free(tend); free(func_id);
+        free(level); free(tid); free(args);
+        return false;
+    }
+
+    void* columns[ARROW_BATCH_COLUMNS] = { rank, tstart, tend, func_id, level, tid, args };
+    arrow_init_array(batch, rows, 1, NULL);
+    batch->n_children = ARROW_BATCH_COLUMNS;
+    batch->children = malloc(sizeof(struct ArrowArray*) * ARROW_BATCH_COLUMNS);
+    for(int i = 0; i < ARROW_BATCH_COLUMNS; i++) {
+        batch->children[i] = malloc(sizeof(struct ArrowArray));
+        arrow_init_array(batch->children[i], rows, 2, columns[i]);
+    }
+
+    ArrowDictionary* dict = cursor->arrow_dict;
+    __atomic_add_fetch(&dict->refcount, 1, __ATOMIC_ACQ_REL);
+    struct ArrowArray* dictionary = malloc(sizeof(struct ArrowArray));
+    arrow_init_array(dictionary, dict->length, 3, NULL);
+    ArrowPrivate* priv = dictionary->private_data;
+    priv->dict = dict;
+    priv->buffers[1] = dict->offsets;
+    priv->buffers[2] = dict->chars;
+    batch->children[ARROW_BATCH_COLUMNS-1]->dictionary = dictionary;
+    return true;
+}
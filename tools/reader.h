@@ -12,6 +12,7 @@
 #define POSIX_SEMANTICS 	0
 #define COMMIT_SEMANTICS 	1
 #define SESSION_SEMANTICS	2
+#define MPIIO_SEMANTICS		3
 
 #ifdef __cplusplus
 extern "C"
@@ -38,44 +39,149 @@ typedef struct IntervalsMap_t {
     Interval *intervals;    // Pointer to Interval, copied from vector<Interval>
 } IntervalsMap;
 
+/*
+ * CST and CFG files are mmap-ed, call signature keys
+ * and rule bodies point directly into the mapping.
+ */
 typedef struct CST_t {
     int rank;
     int entries;
     CallSignature *cs_list; // CallSignature is defined in recorder-logger.h
+    Record *templates;      // templates[i]: parsed cs_list[i], without timestamps
+    void* map;              // keys point into it
+    size_t map_size;
 } CST;
 
 typedef struct RuleHash_t {
     int rule_id;
     int *rule_body;         // 2i+0: val of symbol i,  2i+1: exp of symbol i
     int symbols;            // There are a total of 2*symbols integers in the rule body
+    size_t length;          // number of terminals of the fully expanded rule
+    int *terminals;         // the expanded rule, only kept for short rules
     UT_hash_handle hh;
 } RuleHash;
 
+/*
+ * Rule ids are negative (-1 is the start rule),
+ * rule_table[-rule_id] gives the rule without a hash lookup.
+ */
 typedef struct CFG_t {
     int rank;
     int rules;
     RuleHash* cfg_head;
+    RuleHash* rule_list;    // all rules, cfg_head hashes them by rule_id
+    RuleHash** rule_table;
+    int rule_table_size;
+    RuleHash** post_order;  // sub-rules come before the rules using them
+    void* map;              // rule bodies point into it
+    size_t map_size;
 } CFG;
 
+/*
+ * Position in the mmap-ed timestamps (.ts) file of a rank,
+ * two uint32_t (tstart, tend) per record.
+ */
+typedef struct TimestampCursor_t {
+    uint32_t* ptr;
+    uint32_t* end;
+} TimestampCursor;
+
+typedef struct TimeIndex_t TimeIndex;
+typedef struct RankCache_t RankCache;
+
+/**
+ * What a function does, built once per trace from func_list
+ * so tools classify a record with reader->func_descs[func_id].
+ *
+ * Argument indices are positions in Record.args, -1 if absent:
+ *  file_arg:   the file, its name for POSIX calls (fd, stream or
+ *              path), the file handle id for MPI-IO calls
+ *  offset_arg: explicit offset (pread, MPI_File_write_at, lseek, ...),
+ *              for POSIX calls at the file pointer (read, fwrite, ...)
+ *              the offset logged by Recorder, only if arg_count > offset_arg,
+ *              relative, see recorder_get_io_offset()
+ *  count_arg:  bytes, items for fread/fwrite, elements for MPI-IO
+ *  size_arg:   item size of fread/fwrite
+ *  whence_arg: of seek calls
+ *  flags_arg:  open(2) flags
+ *  mode_arg:   fopen() mode string
+ *  at_pointer: a POSIX call at the file pointer
+ */
+typedef enum RecorderOpClass_t {
+    RECORDER_OP_OTHER = 0,
+    RECORDER_OP_READ,           // data read
+    RECORDER_OP_WRITE,          // data write
+    RECORDER_OP_OPEN,
+    RECORDER_OP_CLOSE,
+    RECORDER_OP_SEEK,           // file position: seek, tell
+    RECORDER_OP_SYNC,
+    RECORDER_OP_META,           // other metadata: stat, mkdir, unlink, ...
+} RecorderOpClass;
+
+typedef struct RecorderFuncDesc_t {
+    unsigned char layer;        // RECORDER_POSIX, RECORDER_MPIIO, ...
+    unsigned char op;           // RecorderOpClass
+    signed char file_arg, offset_arg, count_arg, size_arg;
+    signed char whence_arg, flags_arg, mode_arg;
+    bool at_pointer;
+} RecorderFuncDesc;
+
 typedef struct RecorderReader_t {
 
     RecorderMetadata metadata;
 
     char func_list[256][64];
+    RecorderFuncDesc func_descs[256];
     char logs_dir[1024];
 
     int mpi_start_idx;
     int hdf5_start_idx;
 
-    double prev_tstart;
-
     int   num_ugs;	// number of unique grammars
     int*  ug_ids;	// index of unique grammar in cfgs
     CST** csts;
     CFG** cfgs;
+    TimeIndex** time_indexes;   // per rank, built by the first time based seek
+    RankCache* cache;           // per-rank CSTs and CFGs, without interprocess compression
 } RecorderReader;
 
 
+/**
+ * A decoded record: the template of its call signature
+ * (see CST.templates) and its own timestamps. Templates are
+ * shared by all records of the same call signature, they
+ * must not be modified and are only valid until the CST is freed.
+ * seq_id is the index of the record among all records of its
+ * rank, filtered out ones included.
+ */
+typedef struct RecordView_t {
+    const Record* tmpl;
+    double tstart, tend;
+    size_t seq_id;
+} RecordView;
+
+
+/**
+ * Filtered decoding: only records matching the filter are returned.
+ * A record matches if its function is in funcs (any function if
+ * funcs is all zeros) and match() returns true (if not NULL).
+ * match() is called once per call signature. Rules that can not
+ * produce a matching record are skipped without being expanded.
+ *
+ * e.g., write calls to one file:
+ *     RecorderFilter filter = {0};
+ *     recorder_filter_add_function(&filter, write_func_id);
+ *     filter.match = same_file; filter.match_arg = "/path/to/file";
+ */
+typedef struct RecorderFilter_t {
+    uint64_t funcs[4];      // bit func_id is set: keep the function
+    bool (*match)(const Record* tmpl, void* arg);
+    void* match_arg;
+} RecorderFilter;
+
+void recorder_filter_add_function(RecorderFilter* filter, int func_id);
+
+
 /**
  * Similar but simplified structure
  * for use by recorder-viz
@@ -91,6 +197,55 @@ typedef struct PyRecord_t {
 
 
 
+/**
+ * Arrow C Data Interface, the ABI defined by the specification
+ * (https://arrow.apache.org/docs/format/CDataInterface.html),
+ * no Arrow library is needed.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+
+
 void recorder_init_reader(const char* logs_dir, RecorderReader *reader);
 void recorder_free_reader(RecorderReader *reader);
 
@@ -111,10 +266,47 @@ void recorder_free_reader(RecorderReader *reader);
  */
 void recorder_read_cst(RecorderReader *reader, int rank);
 void recorder_read_cfg(RecorderReader *reader, int rank);
+void recorder_read_checkpoint(RecorderReader *reader, int rank);
+
+/**
+ * With RECORDER_MEMORY_BUDGET, the CST and CFG of a rank can be split
+ * into segments (<rank>.<segment>.cst/cfg) that come before the final
+ * ones. recorder_decode_records*() decode them transparently.
+ */
+int  recorder_get_num_segments(RecorderReader *reader, int rank);
+void recorder_read_segment(RecorderReader *reader, int rank, int segment, CST* cst, CFG* cfg);
 void recorder_free_cst(CST *cst);
 void recorder_free_cfg(CFG *cfg);
 
+/**
+ * recorder_get_cst_cfg() returns the CST and CFG of a rank and takes
+ * a reference, recorder_release_cst_cfg() drops it. Without
+ * interprocess compression, they are read on demand and unreferenced
+ * ones are kept in an LRU cache of 64 ranks by default.
+ *
+ * recorder_reader_set_cache() sets how many unreferenced ranks are
+ * kept (-1 for all of them), and how many ranks following the last
+ * requested one are read ahead by a background thread (0 for none).
+ * Everything is freed by recorder_free_reader().
+ */
 void recorder_get_cst_cfg(RecorderReader* reader, int rank, CST** cst, CFG** cfg);
+void recorder_release_cst_cfg(RecorderReader* reader, int rank);
+void recorder_reader_set_cache(RecorderReader* reader, int capacity, int prefetch);
+
+/**
+ * Load balancing for tools that split the ranks among processes
+ *
+ * recorder_get_num_records() returns the number of records of a
+ * rank, from the size of its timestamps file so nothing is decoded.
+ *
+ * recorder_plan_ranks() assigns every rank to one of num_parts parts,
+ * largest ranks first, each to the least loaded part so far. The plan
+ * only depends on the counts, all processes compute the same one.
+ * The ranks of `part` are stored in `ranks`, largest first, and their
+ * number is returned.
+ */
+size_t recorder_get_num_records(RecorderReader* reader, int rank);
+int recorder_plan_ranks(const size_t* counts, int num_ranks, int num_parts, int part, int* ranks);
 
 
 Record* recorder_cs_to_record(CallSignature *cs);
@@ -137,11 +329,129 @@ void recorder_decode_records(RecorderReader* reader, int rank,
                              void (*user_op)(Record* r, void* user_arg), void* user_arg);
 
 
+/**
+ * Same as above, but without allocating a Record per decoded
+ * record: view_op() receives a RecordView, which is only valid
+ * during the call. Prefer these when the record is not kept.
+ */
+void recorder_decode_record_views_core(RecorderReader* reader, CST *cst, CFG *cfg,
+                             void (*view_op)(RecordView* v, void* user_arg), void* user_arg);
+void recorder_decode_record_views(RecorderReader* reader, int rank,
+                             void (*view_op)(RecordView* v, void* user_arg), void* user_arg);
+void recorder_decode_record_views_filtered(RecorderReader* reader, int rank, const RecorderFilter* filter,
+                             void (*view_op)(RecordView* v, void* user_arg), void* user_arg);
+
+/**
+ * Decode only the records of a rank overlapping the time window [t0, t1]
+ * (in seconds, as Record.tstart), i.e., tstart <= t1 and tend >= t0.
+ * The cost is proportional to the window, not to the whole trace.
+ */
+void recorder_decode_window(RecorderReader* reader, int rank, double t0, double t1,
+                             void (*view_op)(RecordView* v, void* user_arg), void* user_arg);
+
+
+/**
+ * Pull-based decoding of one rank
+ *
+ * recorder_cursor_next_batch() decodes up to n records into views
+ * and returns how many, 0 at the end. It may return fewer than n
+ * before the end. Views are valid until the next call on the cursor.
+ *
+ * recorder_cursor_seek() moves to the record_idx-th record of the
+ * rank, whole rules are skipped without being expanded. Return false
+ * if the rank has fewer records. Record indices and tell() count
+ * all records of the rank, including the ones filtered out.
+ *
+ * recorder_cursor_set_filter() applies a filter (RecorderFilter) from the
+ * current position on, NULL removes it. The filter is copied.
+ *
+ * recorder_cursor_seek_time() moves to at most a few thousand records
+ * before the first record still running at time t (tend >= t), return
+ * false if there is none. The first call for a rank scans its
+ * timestamps once to build an index kept by the reader, later calls
+ * jump directly. Cursors of the same rank must not seek concurrently
+ * before the index is built.
+ */
+typedef struct RecorderCursor_t RecorderCursor;
+
+RecorderCursor* recorder_cursor_open(RecorderReader* reader, int rank);
+size_t recorder_cursor_next_batch(RecorderCursor* cursor, RecordView* views, size_t n);
+bool   recorder_cursor_seek(RecorderCursor* cursor, size_t record_idx);
+size_t recorder_cursor_tell(RecorderCursor* cursor);
+void   recorder_cursor_set_filter(RecorderCursor* cursor, const RecorderFilter* filter);
+bool   recorder_cursor_seek_time(RecorderCursor* cursor, double t);
+void   recorder_cursor_close(RecorderCursor* cursor);
+
+
+/**
+ * Columnar export of a cursor, for pyarrow, polars, duckdb, etc.
+ * to import the records without copying.
+ *
+ * recorder_arrow_schema() describes a batch: a struct array with the
+ * columns rank (int32), tstart, tend (float64), func_id, level (uint8),
+ * tid (uint64) and args (utf8, dictionary-encoded with int32 indices,
+ * one dictionary entry per call signature).
+ *
+ * recorder_cursor_next_arrow_batch() exports the next (at most
+ * max_records) records of the cursor, and returns false if there are
+ * none. The batch is independent of the cursor and the reader, the
+ * consumer calls its release callback.
+ */
+void recorder_arrow_schema(struct ArrowSchema* schema);
+bool recorder_cursor_next_arrow_batch(RecorderCursor* cursor, size_t max_records, struct ArrowArray* batch);
+
+
+/**
+ * Records of all ranks in global time order
+ *
+ * One cursor per rank, merged with a heap keyed on tstart (ties
+ * broken by rank, then seq_id). tstart never decreases within a rank,
+ * so the order is exact while only a small batch of records per rank
+ * is held in memory.
+ *
+ * recorder_merge_open() takes an optional filter, applied to every
+ * rank. recorder_merge_next() returns false once all ranks are done.
+ * The view is only valid until the next call.
+ */
+typedef struct RecorderMerge_t RecorderMerge;
+
+RecorderMerge* recorder_merge_open(RecorderReader* reader, const RecorderFilter* filter);
+bool recorder_merge_next(RecorderMerge* merge, RecordView* view, int* rank);
+void recorder_merge_close(RecorderMerge* merge);
+
+
+/**
+ * Decode multiple ranks with a pool of nthreads threads
+ * (0: one per core), each rank is decoded by one thread.
+ *
+ * ranks: ranks to decode, NULL for all ranks (num_ranks is ignored)
+ * ctxs:  ctxs[t] is passed as ctx to all callbacks run by thread t,
+ *        so no synchronization is needed if they only use it.
+ *        ctxs can be NULL.
+ *
+ * begin() and end() are optional, they are called before
+ * and after decoding a rank by the thread that decodes it.
+ * The CST and CFG of a rank are released after it is decoded.
+ *
+ * Decoding functions above can also be called from multiple
+ * threads as long as they decode different ranks.
+ */
+typedef struct RecorderRankOps_t {
+    void (*begin)(int rank, void* ctx);
+    void (*view_op)(RecordView* v, void* ctx);
+    void (*end)(int rank, void* ctx);
+} RecorderRankOps;
+
+void recorder_decode_ranks_parallel(RecorderReader* reader, const int* ranks, int num_ranks,
+                                    int nthreads, RecorderRankOps* ops, void** ctxs);
+
+
 void recorder_decode_records2(RecorderReader *reader, CST *cst, CFG *cfg,
                              void (*user_op)(Record* r, void* user_arg), void* user_arg);
 
 
-const char* recorder_get_func_name(RecorderReader* reader, Record* record);
+const char* recorder_get_func_name(RecorderReader* reader, const Record* record);
+const RecorderFuncDesc* recorder_get_func_desc(RecorderReader* reader, const Record* record);
 
 /*
  * Return one of the follows (mutual exclusive) :
@@ -151,11 +461,143 @@ const char* recorder_get_func_name(RecorderReader* reader, Record* record);
  *  - RECORDER_HDF5
  *  - RECORDER_FTRACE
  */
-int recorder_get_func_type(RecorderReader* reader, Record* record);
+int recorder_get_func_type(RecorderReader* reader, const Record* record);
+
+
+/**
+ * Grammar-level analytics, computed from the CST and CFG
+ * without decoding records (timestamps are not available).
+ * For an incomplete trace, records described by the grammar
+ * but without timestamps are included.
+ *
+ * RecorderMonoid describes an aggregate of fixed size (value_size
+ * bytes, copied with memcpy) with an associative combine() and
+ * an identity. from_record() gives the aggregate of one record.
+ * repeat() is optional: acc = acc + n times value, e.g., a
+ * multiplication for counters. Otherwise it is done by doubling.
+ *
+ * recorder_evaluate_grammar(): result = aggregate of all records of the grammar
+ * recorder_evaluate_rank():    same, for a rank, including its segments
+ */
+typedef struct RecorderMonoid_t {
+    size_t value_size;
+    void (*identity)(void* value, void* arg);
+    void (*from_record)(const Record* tmpl, void* value, void* arg);
+    void (*combine)(void* acc, const void* value, void* arg);
+    void (*repeat)(void* acc, const void* value, size_t n, void* arg);
+} RecorderMonoid;
+
+void recorder_evaluate_grammar(RecorderReader* reader, CST* cst, CFG* cfg,
+                               RecorderMonoid* m, void* arg, void* result);
+void recorder_evaluate_rank(RecorderReader* reader, int rank,
+                            RecorderMonoid* m, void* arg, void* result);
+
+/*
+ * Built-in aggregates, results are added to what is passed in
+ *
+ * recorder_count_signatures(): counts[i] += occurrences of cst->cs_list[i]
+ * recorder_count_functions():  counts[func_id] += calls of the rank (256 entries)
+ * recorder_count_file_io():    per-file POSIX reads/writes of the rank
+ * recorder_visit_signatures(): op() for each call signature of the rank with its
+ *                              number of calls, once per segment it is used in
+ */
+typedef struct FileIOStat_t {
+    char* filename;
+    size_t reads, writes;
+    size_t bytes_read, bytes_written;
+    UT_hash_handle hh;
+} FileIOStat;
+
+void recorder_count_signatures(CST* cst, CFG* cfg, size_t* counts);
+void recorder_count_functions(RecorderReader* reader, int rank, size_t* counts);
+void recorder_count_file_io(RecorderReader* reader, int rank, FileIOStat** files);
+void recorder_free_file_io(FileIOStat** files);
+void recorder_visit_signatures(RecorderReader* reader, int rank,
+                               void (*op)(const Record* tmpl, size_t count, void* arg), void* arg);
+
+/*
+ * If the record is a POSIX read or write, return true and
+ * set the file name, bytes requested and the direction.
+ */
+bool recorder_get_io_bytes(RecorderReader* reader, const Record* record,
+                           const char** filename, size_t* bytes, bool* is_read);
+
+/*
+ * If the record is a read or write of any layer, return true and set
+ * the direction and the bytes. MPI-IO bytes are the count times the
+ * size of the datatype, known for predefined datatypes only. HDF5
+ * calls do not log the size of the selection. If the bytes are not
+ * known, *sized is false and *bytes 0.
+ */
+bool recorder_get_layer_io_bytes(RecorderReader* reader, const Record* record,
+                                 size_t* bytes, bool* sized, bool* is_read);
+
+/*
+ * If the record is a POSIX read or write whose starting offset
+ * is in the trace, return true and set it. Calls at the file
+ * pointer have it unless traced with RECORDER_LOG_OFFSET=0.
+ *
+ * Their offset is logged relative to where the previous call at
+ * the file pointer of the rank on the same file ended, so offsets
+ * are kept per rank: give all records of a rank in order.
+ */
+typedef struct RecorderFileOffsets_t RecorderFileOffsets;
+RecorderFileOffsets* recorder_new_file_offsets();
+void recorder_free_file_offsets(RecorderFileOffsets* offsets);
+bool recorder_get_io_offset(RecorderReader* reader, RecorderFileOffsets* offsets,
+                            const Record* record, size_t* offset);
 
 
 IntervalsMap* build_offset_intervals(RecorderReader *reader, int *num_files);
 
+
+/*
+ * Matched MPI calls of all ranks (match_mpi_calls.cpp)
+ *
+ * A match has heads and tails, the heads happen before the tails:
+ *  - point-to-point: the send, and the receive (the wait/test call
+ *    completing it for nonblocking receives)
+ *  - all-to-all:     all participants are heads, no tails
+ *  - one-to-many:    the root, and the other participants
+ *  - many-to-one:    the other participants, and the root
+ * Nonblocking collectives are represented by their completing call.
+ *
+ * The nodes of match i are nodes[begin, begin+num_heads) for the heads,
+ * followed by its num_tails tails. A node has the func_id and level
+ * of its record, MPI calls made inside other calls have level > 0.
+ */
+#define MPI_MATCH_POINT_TO_POINT    0
+#define MPI_MATCH_ALL_TO_ALL        1
+#define MPI_MATCH_ONE_TO_MANY       2
+#define MPI_MATCH_MANY_TO_ONE       3
+
+#define MPI_MATCH_SYNCHRONIZING     0x1     // point-to-point, or a collective synchronizing all processes
+#define MPI_MATCH_TAILS_AFTER       0x2     // the tails receive after they sent (MPI_Sendrecv)
+
+typedef struct MPIMatchNode_t {
+    int rank;
+    int seq_id;
+    unsigned char func_id, level;
+} MPIMatchNode;
+
+typedef struct MPIMatch_t {
+    unsigned char type;     // MPI_MATCH_POINT_TO_POINT, ...
+    unsigned char flags;
+    int num_heads, num_tails;
+    size_t begin;
+} MPIMatch;
+
+typedef struct MPIMatches_t {
+    size_t num_matches, num_nodes;
+    MPIMatch* matches;
+    MPIMatchNode* nodes;
+    size_t unmatched_sends, unmatched_recvs;
+    size_t mismatched_colls;    // collectives matched with another function
+} MPIMatches;
+
+MPIMatches* match_mpi_calls(RecorderReader *reader);
+void free_mpi_matches(MPIMatches *matches);
+
 #ifdef __cplusplus
 }
 #endif
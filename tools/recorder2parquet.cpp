@@ -1,200 +1,228 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "reader.h"
 #include <parquet/arrow/writer.h>
 #include <arrow/api.h>
 #include <arrow/io/api.h>
-#include <stdint-gcc.h>
 #include <mpi.h>
 
+#define MAX_ARGS                10
+#define DEFAULT_ROW_GROUP_SIZE  (1024*1024)
+
+RecorderReader reader;
+static std::shared_ptr<arrow::Schema> schema;
+static int64_t row_group_size = DEFAULT_ROW_GROUP_SIZE;
+static char parquet_file_dir[256];
+static int mpi_rank;
+
+
+/*
+ * Arguments are kept as strings in args_<i>. The ones described by
+ * reader.func_descs (see reader.h) are also written to typed columns,
+ * e.g., the offset of pwrite and of MPI_File_write_at both go to
+ * "offset", and are null for functions without them.
+ * Strings and function names are dictionary-encoded.
+ */
+#define NUM_BASE_COLUMNS    9
+#define NUM_TYPED_COLUMNS   5
+#define NUM_COLUMNS         (NUM_BASE_COLUMNS + MAX_ARGS + NUM_TYPED_COLUMNS)
+
+static std::shared_ptr<arrow::Schema> make_schema() {
+    auto dict_utf8 = arrow::dictionary(arrow::int32(), arrow::utf8());
+    arrow::FieldVector fields = {
+        arrow::field("rank", arrow::int32()),
+        arrow::field("seq_id", arrow::int64()),
+        arrow::field("thread_id", arrow::uint64()),
+        arrow::field("cat", arrow::int32()),
+        arrow::field("tstart", arrow::float64()),
+        arrow::field("tend", arrow::float64()),
+        arrow::field("func", dict_utf8),
+        arrow::field("level", arrow::int32()),
+        arrow::field("arg_count", arrow::int32()),
+    };
+    for(int i = 1; i <= MAX_ARGS; i++)
+        fields.push_back(arrow::field("args_" + std::to_string(i), dict_utf8));
+    fields.push_back(arrow::field("file", dict_utf8));
+    fields.push_back(arrow::field("offset", arrow::int64()));
+    fields.push_back(arrow::field("count", arrow::int64()));
+    fields.push_back(arrow::field("size", arrow::int64()));
+    fields.push_back(arrow::field("flags", arrow::int64()));
+    return arrow::schema(fields);
+}
+
+/*
+ * One output file per thread, records are buffered in
+ * column builders and written out one row group at a time.
+ */
 struct ParquetWriter {
     int rank;
-    char* base_file;
-    int64_t index;
-    arrow::Int32Builder indexBuilder, categoryBuilder, rankBuilder, threadBuilder, arg_countBuilder, levelBuilder;
-    arrow::FloatBuilder tstartBuilder, tendBuilder;
-    arrow::StringBuilder func_idBuilder, args_Builder[10];
-
-    std::shared_ptr<arrow::Array> indexArray, categoryArray, rankArray, threadArray, arg_countArray, levelArray, tstartArray, tendArray,
-            func_idArray, argsArray[10];
-
-    std::shared_ptr<arrow::Schema> schema;
-    const int64_t chunk_size = 1024;
-    const int64_t NUM_ROWS = 1024*1024*64; // 1B
-    int64_t row_group = 0;
-    ParquetWriter(int, char*);
-
-    void finish();
-};
+    RecorderFileOffsets* offsets;   // of the current rank
+    int64_t rows;
+    std::unique_ptr<parquet::arrow::FileWriter> file;
 
-ParquetWriter::ParquetWriter(int _rank, char* _path) {
-    rank = _rank;
-    row_group = 0;
-
-    base_file = _path;
-    schema = arrow::schema(
-            {arrow::field("index", arrow::int32()), arrow::field("rank", arrow::int32()),
-             arrow::field("thread_id", arrow::int32()), arrow::field("cat", arrow::int32()),
-             arrow::field("tstart", arrow::float32()), arrow::field("tend", arrow::float32()),
-             arrow::field("func_id", arrow::utf8()), arrow::field("level", arrow::int32()),
-             arrow::field("arg_count", arrow::int32()), arrow::field("args_1", arrow::utf8()),
-             arrow::field("args_2", arrow::utf8()), arrow::field("args_3", arrow::utf8()),
-             arrow::field("args_4", arrow::utf8()), arrow::field("args_5", arrow::utf8()),
-             arrow::field("args_6", arrow::utf8()), arrow::field("args_7", arrow::utf8()),
-             arrow::field("args_8", arrow::utf8()), arrow::field("args_9", arrow::utf8()),
-             arrow::field("args_10", arrow::utf8())});
-    index = 0;
-
-    indexBuilder = arrow::Int32Builder();
-    indexArray.reset();
-    rankBuilder = arrow::Int32Builder();
-    rankArray.reset();
-    threadBuilder = arrow::Int32Builder();
-    threadArray.reset();
-    categoryBuilder = arrow::Int32Builder();
-    categoryArray.reset();
-    arg_countBuilder = arrow::Int32Builder();
-    arg_countArray.reset();
-    levelBuilder = arrow::Int32Builder();
-    levelArray.reset();
-
-    tstartBuilder = arrow::FloatBuilder();
-    tstartArray.reset();
-    tendBuilder = arrow::FloatBuilder();
-    tendArray.reset();
-
-
-    func_idBuilder = arrow::StringBuilder();
-    func_idArray.reset();
-    for (int i =0; i< 10; i++){
-        args_Builder[i] = arrow::StringBuilder();
-        argsArray[i].reset();
-    }
-}
+    arrow::Int32Builder rankBuilder, categoryBuilder, levelBuilder, arg_countBuilder;
+    arrow::Int64Builder seq_idBuilder;
+    arrow::UInt64Builder threadBuilder;
+    arrow::DoubleBuilder tstartBuilder, tendBuilder;
+    arrow::StringDictionary32Builder funcBuilder;
+    arrow::StringDictionary32Builder argsBuilder[MAX_ARGS];
+    arrow::StringDictionary32Builder fileBuilder;
+    arrow::Int64Builder offsetBuilder, countBuilder, sizeBuilder, flagsBuilder;
 
-void ParquetWriter::finish(void) {
-    indexBuilder.Finish(&indexArray);
-    rankBuilder.Finish(&rankArray);
-    threadBuilder.Finish(&threadArray);
-    tstartBuilder.Finish(&tstartArray);
-    tendBuilder.Finish(&tendArray);
-    func_idBuilder.Finish(&func_idArray);
-    levelBuilder.Finish(&levelArray);
-    categoryBuilder.Finish(&categoryArray);
-    arg_countBuilder.Finish(&arg_countArray);
-    for (int arg_id = 0; arg_id < 10; arg_id++) {
-        args_Builder[arg_id].Finish(&argsArray[arg_id]);
-    }
+    void open(int thread);
+    void append(const RecordView* view);
+    void write_row_group();
+    void close();
+};
 
-    auto table = arrow::Table::Make(schema, {indexArray, rankArray,threadArray,categoryArray,
-                                             tstartArray, tendArray,
-                                             func_idArray, levelArray, arg_countArray  ,
-                                             argsArray[0], argsArray[1], argsArray[2],
-                                             argsArray[3], argsArray[4], argsArray[5],
-                                             argsArray[6], argsArray[7], argsArray[8],
-                                             argsArray[9] });
-    char path[256];
-    sprintf(path, "%s_%d.parquet" , base_file, row_group);
+void ParquetWriter::open(int thread) {
+    char path[512];
+    sprintf(path, "%s/%d_%d.parquet", parquet_file_dir, mpi_rank, thread);
     PARQUET_ASSIGN_OR_THROW(auto outfile, arrow::io::FileOutputStream::Open(path));
-    PARQUET_THROW_NOT_OK(parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), outfile, 1024));
-}
 
-RecorderReader reader;
+    auto props = parquet::WriterProperties::Builder()
+                    .max_row_group_length(row_group_size)
+                    ->build();
+    // Keep the Arrow schema so dictionary columns are read back as such
+    auto arrow_props = parquet::ArrowWriterProperties::Builder().store_schema()->build();
+    PARQUET_ASSIGN_OR_THROW(file, parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(),
+                                                                   outfile, props, arrow_props));
+    rows = 0;
+}
 
-void handle_one_record(Record* record, void* arg) {
-    ParquetWriter *writer = (ParquetWriter*) arg;
+static void append_int_arg(arrow::Int64Builder& builder, const Record* record, int arg_count, int arg) {
+    if(arg >= 0 && arg < arg_count)
+        PARQUET_THROW_NOT_OK(builder.Append(strtoll(record->args[arg], NULL, 10)));
+    else
+        PARQUET_THROW_NOT_OK(builder.AppendNull());
+}
 
-    writer->rankBuilder.Append(writer->rank);
-    writer->threadBuilder.Append(record->tid);
-    writer->tstartBuilder.Append(record->tstart);
-    writer->tendBuilder.Append(record->tend);
+void ParquetWriter::append(const RecordView* view) {
+    const Record* record = view->tmpl;
     int cat = recorder_get_func_type(&reader, record);
-    if (cat == RECORDER_FTRACE){
-        writer->func_idBuilder.Append(record->args[0]);
-        record->arg_count = 0;
-    }else {
-        writer->func_idBuilder.Append(recorder_get_func_name(&reader, record));
+    int arg_count = record->arg_count;
+
+    PARQUET_THROW_NOT_OK(rankBuilder.Append(rank));
+    PARQUET_THROW_NOT_OK(seq_idBuilder.Append(view->seq_id));
+    PARQUET_THROW_NOT_OK(threadBuilder.Append((uint64_t) record->tid));
+    PARQUET_THROW_NOT_OK(categoryBuilder.Append(cat));
+    PARQUET_THROW_NOT_OK(tstartBuilder.Append(view->tstart));
+    PARQUET_THROW_NOT_OK(tendBuilder.Append(view->tend));
+    if(cat == RECORDER_FTRACE) {
+        PARQUET_THROW_NOT_OK(funcBuilder.Append(record->args[0]));
+        arg_count = 0;
+    } else {
+        PARQUET_THROW_NOT_OK(funcBuilder.Append(recorder_get_func_name(&reader, record)));
     }
-    writer->categoryBuilder.Append(cat);
-    writer->levelBuilder.Append(record->level);
-    writer->arg_countBuilder.Append(record->arg_count);
+    PARQUET_THROW_NOT_OK(levelBuilder.Append(record->level));
+    PARQUET_THROW_NOT_OK(arg_countBuilder.Append(arg_count));
 
-    for (int arg_id = 0; arg_id < 10; arg_id++) {
-        if(arg_id < record->arg_count)
-            writer->args_Builder[arg_id].Append(record->args[arg_id]);
+    for(int i = 0; i < MAX_ARGS; i++) {
+        if(i < arg_count)
+            PARQUET_THROW_NOT_OK(argsBuilder[i].Append(record->args[i]));
         else
-            writer->args_Builder[arg_id].Append("");
+            PARQUET_THROW_NOT_OK(argsBuilder[i].AppendNull());
     }
-    writer->index ++;
-    writer->indexBuilder.Append(writer->index);
-    if(writer->index % writer->NUM_ROWS == 0) {
-        writer->indexBuilder.Finish(&writer->indexArray);
-        writer->rankBuilder.Finish(&writer->rankArray);
-        writer->threadBuilder.Finish(&writer->threadArray);
-        writer->categoryBuilder.Finish(&writer->categoryArray);
-        writer->tstartBuilder.Finish(&writer->tstartArray);
-        writer->tendBuilder.Finish(&writer->tendArray);
-        writer->func_idBuilder.Finish(&writer->func_idArray);
-        writer->levelBuilder.Finish(&writer->levelArray);
-        writer->arg_countBuilder.Finish(&writer->arg_countArray);
-        for (int arg_id = 0; arg_id < 10; arg_id++) {
-            writer->args_Builder[arg_id].Finish(&writer->argsArray[arg_id]);
-        }
 
-        auto table = arrow::Table::Make(writer->schema, {writer->indexArray, writer->rankArray,writer->threadArray, writer->categoryArray,
-                                                         writer->tstartArray, writer->tendArray,
-                                                         writer->func_idArray, writer->levelArray, writer->arg_countArray  ,
-                                                         writer->argsArray[0], writer->argsArray[1], writer->argsArray[2],
-                                                         writer->argsArray[3], writer->argsArray[4], writer->argsArray[5],
-                                                         writer->argsArray[6], writer->argsArray[7], writer->argsArray[8],
-                                                         writer->argsArray[9] });
-        char path[256];
-        sprintf(path, "%s_%d.parquet" , writer->base_file, writer->row_group);
-        PARQUET_ASSIGN_OR_THROW(auto outfile, arrow::io::FileOutputStream::Open(path));
-        PARQUET_THROW_NOT_OK(parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), outfile, 1024*1024*128));
-
-        writer->row_group++;
-        writer->indexBuilder = arrow::Int32Builder();
-        writer->indexArray.reset();
-        writer->rankBuilder = arrow::Int32Builder();
-        writer->rankArray.reset();
-        writer->threadBuilder = arrow::Int32Builder();
-        writer->threadArray.reset();
-        writer->categoryBuilder = arrow::Int32Builder();
-        writer->categoryArray.reset();
-        writer->arg_countBuilder = arrow::Int32Builder();
-        writer->arg_countArray.reset();
-        writer->levelBuilder = arrow::Int32Builder();
-        writer->levelArray.reset();
-
-        writer->tstartBuilder = arrow::FloatBuilder();
-        writer->tstartArray.reset();
-        writer->tendBuilder = arrow::FloatBuilder();
-        writer->tendArray.reset();
-
-
-        writer->func_idBuilder = arrow::StringBuilder();
-        writer->func_idArray.reset();
-        for (int i =0; i< 10; i++){
-            writer->args_Builder[i] = arrow::StringBuilder();
-            writer->argsArray[i].reset();
-        }
+    // arg_count is 0 for user functions, their typed columns are null
+    const RecorderFuncDesc* desc = &reader.func_descs[record->func_id];
+    if(desc->file_arg >= 0 && desc->file_arg < arg_count)
+        PARQUET_THROW_NOT_OK(fileBuilder.Append(record->args[desc->file_arg]));
+    else
+        PARQUET_THROW_NOT_OK(fileBuilder.AppendNull());
+    // Calls at the file pointer log it relative to the previous one
+    size_t offset;
+    if(!desc->at_pointer)
+        append_int_arg(offsetBuilder, record, arg_count, desc->offset_arg);
+    else if(recorder_get_io_offset(&reader, offsets, record, &offset))
+        PARQUET_THROW_NOT_OK(offsetBuilder.Append((int64_t) offset));
+    else
+        PARQUET_THROW_NOT_OK(offsetBuilder.AppendNull());
+    append_int_arg(countBuilder, record, arg_count, desc->count_arg);
+    append_int_arg(sizeBuilder, record, arg_count, desc->size_arg);
+    append_int_arg(flagsBuilder, record, arg_count, desc->flags_arg);
+
+    if(++rows == row_group_size)
+        write_row_group();
+}
+
+void ParquetWriter::write_row_group() {
+    if(rows == 0)
+        return;
+
+    std::shared_ptr<arrow::Array> arrays[NUM_COLUMNS];
+    PARQUET_THROW_NOT_OK(rankBuilder.Finish(&arrays[0]));
+    PARQUET_THROW_NOT_OK(seq_idBuilder.Finish(&arrays[1]));
+    PARQUET_THROW_NOT_OK(threadBuilder.Finish(&arrays[2]));
+    PARQUET_THROW_NOT_OK(categoryBuilder.Finish(&arrays[3]));
+    PARQUET_THROW_NOT_OK(tstartBuilder.Finish(&arrays[4]));
+    PARQUET_THROW_NOT_OK(tendBuilder.Finish(&arrays[5]));
+    PARQUET_THROW_NOT_OK(funcBuilder.Finish(&arrays[6]));
+    PARQUET_THROW_NOT_OK(levelBuilder.Finish(&arrays[7]));
+    PARQUET_THROW_NOT_OK(arg_countBuilder.Finish(&arrays[8]));
+    for(int i = 0; i < MAX_ARGS; i++)
+        PARQUET_THROW_NOT_OK(argsBuilder[i].Finish(&arrays[NUM_BASE_COLUMNS + i]));
+    std::shared_ptr<arrow::Array>* typed = &arrays[NUM_BASE_COLUMNS + MAX_ARGS];
+    PARQUET_THROW_NOT_OK(fileBuilder.Finish(&typed[0]));
+    PARQUET_THROW_NOT_OK(offsetBuilder.Finish(&typed[1]));
+    PARQUET_THROW_NOT_OK(countBuilder.Finish(&typed[2]));
+    PARQUET_THROW_NOT_OK(sizeBuilder.Finish(&typed[3]));
+    PARQUET_THROW_NOT_OK(flagsBuilder.Finish(&typed[4]));
+
+    auto table = arrow::Table::Make(schema,
+                    std::vector<std::shared_ptr<arrow::Array>>(arrays, arrays + NUM_COLUMNS), rows);
+    PARQUET_THROW_NOT_OK(file->WriteTable(*table, rows));
+    rows = 0;
+}
+
+void ParquetWriter::close() {
+    write_row_group();
+    PARQUET_THROW_NOT_OK(file->Close());
+}
+
+
+typedef struct WriterContext_t {
+    int thread;
+    ParquetWriter* writer;      // opened at the first rank of the thread
+} WriterContext;
+
+void begin_rank(int rank, void* arg) {
+    WriterContext* ctx = (WriterContext*) arg;
+    if(ctx->writer == NULL) {
+        ctx->writer = new ParquetWriter();
+        ctx->writer->open(ctx->thread);
     }
+    ctx->writer->rank = rank;
+    ctx->writer->offsets = recorder_new_file_offsets();
+}
+
+void handle_one_record(RecordView* view, void* arg) {
+    ((WriterContext*) arg)->writer->append(view);
+}
+
+void end_rank(int rank, void* arg) {
+    recorder_free_file_offsets(((WriterContext*) arg)->writer->offsets);
+    printf("\r[Recorder] rank %d finished\n", rank);
 }
 
 int min(int a, int b) { return a < b ? a : b; }
 int max(int a, int b) { return a > b ? a : b; }
 
 
+/*
+ * Usage: recorder2parquet <traces dir> [rows per row group]
+ */
 int main(int argc, char **argv) {
 
-    char parquet_file_dir[256], parquet_file_path[256];
     sprintf(parquet_file_dir, "%s/_parquet", argv[1]);
-    mkdir(parquet_file_dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-    int mpi_size, mpi_rank;
+    if(argc > 2 && atoll(argv[2]) > 0)
+        row_group_size = atoll(argv[2]);
+
+    int mpi_size;
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
     MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
@@ -203,20 +231,44 @@ int main(int argc, char **argv) {
         mkdir(parquet_file_dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
     MPI_Barrier(MPI_COMM_WORLD);
     recorder_init_reader(argv[1], &reader);
+    schema = make_schema();
+
+    // Balance the ranks among processes by their number of records,
+    // each process counts a strided subset of them
+    int total_ranks = reader.metadata.total_ranks;
+    std::vector<size_t> counts(total_ranks);
+    for(int rank = mpi_rank; rank < total_ranks; rank += mpi_size)
+        counts[rank] = recorder_get_num_records(&reader, rank);
+    MPI_Allreduce(MPI_IN_PLACE, counts.data(), total_ranks, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    std::vector<int> ranks(total_ranks+1);      // never NULL, that means all ranks
+    int num_ranks = recorder_plan_ranks(counts.data(), total_ranks, mpi_size, mpi_rank, ranks.data());
 
-    // Each rank will process n files (n ranks traces)
-    int n = max(reader.metadata.total_ranks/mpi_size, 1);
-    int start_rank = n * mpi_rank;
-    int end_rank   = min(reader.metadata.total_ranks, n*(mpi_rank+1));
-    sprintf(parquet_file_path, "%s/%d" , parquet_file_dir, mpi_rank);
-
-    ParquetWriter writer(0, parquet_file_path);
-    for(int rank = start_rank; rank < end_rank; rank++) {
-        writer.rank = rank;
-        recorder_decode_records(&reader, rank, handle_one_record, &writer);
-        printf("\r[Recorder] rank %d finished, unique call signatures: %d\n", rank, cst.entries);
+    // Share the cores of a node among the processes on it
+    MPI_Comm node_comm;
+    int node_size;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, mpi_rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_free(&node_comm);
+    int nthreads = max(sysconf(_SC_NPROCESSORS_ONLN) / node_size, 1);
+
+    std::vector<WriterContext> writers(nthreads);
+    std::vector<void*> ctxs(nthreads);
+    for(int t = 0; t < nthreads; t++) {
+        writers[t].thread = t;
+        writers[t].writer = NULL;
+        ctxs[t] = &writers[t];
+    }
+
+    RecorderRankOps ops = { begin_rank, handle_one_record, end_rank };
+    recorder_decode_ranks_parallel(&reader, ranks.data(), num_ranks, nthreads, &ops, ctxs.data());
+
+    for(int t = 0; t < nthreads; t++) {
+        if(writers[t].writer) {
+            writers[t].writer->close();
+            delete writers[t].writer;
+        }
     }
-    writer.finish();
     recorder_free_reader(&reader);
 
     MPI_Barrier(MPI_COMM_WORLD);
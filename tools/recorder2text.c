@@ -3,15 +3,31 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <math.h>
 #include <mpi.h>
 #include "reader.h"
 
 #define DECIMAL 6
+#define OUTPUT_BUFFER_SIZE (4*1024*1024)
 
 RecorderReader reader;
-static char formatting_record[32];
 static char formatting_fname[20];
+static char textfile_dir[256];
+static int decimal;
+static uint64_t decimal_scale;      // 10^decimal, 0 if too many decimals
+
+/*
+ * Per-thread output, records are formatted into a large
+ * buffer that is written out when full.
+ */
+typedef struct TextWriter_t {
+    FILE* f;
+    char* buf;
+    size_t size;
+    size_t len;
+    size_t records;
+} TextWriter;
 
 int digits_count(int n) {
     int digits = 0;
@@ -22,32 +38,128 @@ int digits_count(int n) {
     return digits;
 }
 
-void write_to_textfile(Record *record, void* arg) {
-    FILE* f = (FILE*) arg;
+static inline char* write_uint(char* p, uint64_t v) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v != 0);
+    while(n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
 
-    bool user_func = (record->func_id == RECORDER_USER_FUNCTION);
+/*
+ * Same output as printf("%.<decimal>f", t). Scaled to an integer,
+ * t is rounded as printf would unless it is too close to half-way
+ * (or too large to be exact), in which case printf does it.
+ */
+static inline char* write_timestamp(char* p, double t) {
+    double scaled = t * decimal_scale;
+    double rounded = floor(scaled + 0.5);
+    if(decimal_scale == 0 || t < 0 || scaled >= 1e12 || fabs(scaled - floor(scaled) - 0.5) < 0.01)
+        return p + sprintf(p, "%.*f", decimal, t);
+
+    uint64_t v = (uint64_t) rounded;
+    p = write_uint(p, v / decimal_scale);
+    if(decimal > 0) {
+        *p++ = '.';
+        uint64_t frac = v % decimal_scale;
+        for(int i = decimal-1; i >= 0; i--) {
+            p[i] = '0' + frac % 10;
+            frac /= 10;
+        }
+        p += decimal;
+    }
+    return p;
+}
 
-    const char* func_name = recorder_get_func_name(&reader, record);
+static void flush_textfile(TextWriter* w) {
+    fwrite(w->buf, 1, w->len, w->f);
+    w->len = 0;
+}
 
-    fprintf(f, formatting_record, record->tstart, record->tend, // record->tid
-                             func_name, record->level, recorder_get_func_type(&reader, record));
+/*
+ * <tstart> <tend> <func> <level> <type> ( <args> )
+ */
+void write_to_textfile(RecordView *view, TextWriter* w) {
+    const Record* record = view->tmpl;
 
-    for(int arg_id = 0; !user_func && arg_id < record->arg_count; arg_id++) {
-        char *arg = record->args[arg_id];
-        fprintf(f, " %s", arg);
+    bool user_func = (record->func_id == RECORDER_USER_FUNCTION);
+    const char* func_name = recorder_get_func_name(&reader, record);
+    int func_type = recorder_get_func_type(&reader, record);
+    int arg_count = user_func ? 0 : record->arg_count;
+
+    size_t func_len = strlen(func_name);
+    size_t needed = 2*64 + func_len + 32;
+    for(int arg_id = 0; arg_id < arg_count; arg_id++)
+        needed += strlen(record->args[arg_id]) + 1;
+
+    if(w->len + needed > w->size) {
+        flush_textfile(w);
+        if(needed > w->size) {
+            w->size = needed;
+            w->buf = realloc(w->buf, w->size);
+        }
+    }
+
+    char* p = w->buf + w->len;
+    p = write_timestamp(p, view->tstart);
+    *p++ = ' ';
+    p = write_timestamp(p, view->tend);
+    *p++ = ' ';
+    memcpy(p, func_name, func_len);
+    p += func_len;
+    *p++ = ' ';
+    p = write_uint(p, record->level);
+    *p++ = ' ';
+    if(func_type < 0)
+        p += sprintf(p, "%d", func_type);
+    else
+        p = write_uint(p, func_type);
+    *p++ = ' ';
+    *p++ = '(';
+
+    for(int arg_id = 0; arg_id < arg_count; arg_id++) {
+        size_t len = strlen(record->args[arg_id]);
+        *p++ = ' ';
+        memcpy(p, record->args[arg_id], len);
+        p += len;
     }
 
-    fprintf(f, " )\n");
+    memcpy(p, " )\n", 3);
+    p += 3;
+
+    w->len = p - w->buf;
+    w->records++;
 }
 
 
+void open_textfile(int rank, void* ctx) {
+    TextWriter* w = (TextWriter*) ctx;
+    char textfile_path[256];
+    sprintf(textfile_path, formatting_fname, textfile_dir, rank);
+    w->f = fopen(textfile_path, "w");
+    w->len = 0;
+}
+
+void write_to_current_textfile(RecordView *view, void* ctx) {
+    write_to_textfile(view, (TextWriter*) ctx);
+}
+
+void close_textfile(int rank, void* ctx) {
+    TextWriter* w = (TextWriter*) ctx;
+    flush_textfile(w);
+    fclose(w->f);
+    printf("\r[Recorder] rank %d finished\n", rank);
+}
+
 int min(int a, int b) { return a < b ? a : b; }
 int max(int a, int b) { return a > b ? a : b; }
 
 int main(int argc, char **argv) {
 
-    char textfile_dir[256];
-    char textfile_path[256];
     sprintf(textfile_dir, "%s/_text", argv[1]);
 
     int mpi_size, mpi_rank;
@@ -61,29 +173,65 @@ int main(int argc, char **argv) {
 
     recorder_init_reader(argv[1], &reader);
 
-    int decimal =  log10(1 / reader.metadata.time_resolution);
-    sprintf(formatting_record, "%%.%df %%.%df %%s %%d %%d (", decimal, decimal);
+    decimal =  log10(1 / reader.metadata.time_resolution);
+    decimal_scale = 0;
+    if(decimal >= 0 && decimal <= 9) {
+        decimal_scale = 1;
+        for(int i = 0; i < decimal; i++)
+            decimal_scale *= 10;
+    }
     sprintf(formatting_fname,  "%%s/%%0%dd.txt", digits_count(reader.metadata.total_ranks));
 
-    // Each rank will process n files (n ranks traces)
-    int n = max(reader.metadata.total_ranks/mpi_size, 1);
-    int start_rank = n * mpi_rank;
-    int end_rank   = min(reader.metadata.total_ranks, n*(mpi_rank+1));
-
-    for(int rank = start_rank; rank < end_rank; rank++) {
-
-        sprintf(textfile_path, formatting_fname, textfile_dir, rank);
-        FILE* fout = fopen(textfile_path, "w");
-
-        recorder_decode_records(&reader, rank, write_to_textfile, fout);
+    // Balance the ranks among processes by their number of records,
+    // each process counts a strided subset of them
+    int total_ranks = reader.metadata.total_ranks;
+    size_t* counts = calloc(total_ranks, sizeof(size_t));
+    for(int rank = mpi_rank; rank < total_ranks; rank += mpi_size)
+        counts[rank] = recorder_get_num_records(&reader, rank);
+    MPI_Allreduce(MPI_IN_PLACE, counts, total_ranks, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    int* ranks = malloc(sizeof(int) * (total_ranks+1));     // never NULL, that means all ranks
+    int num_ranks = recorder_plan_ranks(counts, total_ranks, mpi_size, mpi_rank, ranks);
+    free(counts);
+
+    // Share the cores of a node among the processes on it
+    MPI_Comm node_comm;
+    int node_size;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, mpi_rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_free(&node_comm);
+    int nthreads = max(sysconf(_SC_NPROCESSORS_ONLN) / node_size, 1);
+
+    TextWriter writers[nthreads];
+    void* ctxs[nthreads];
+    for(int t = 0; t < nthreads; t++) {
+        writers[t].size = OUTPUT_BUFFER_SIZE;
+        writers[t].buf = malloc(writers[t].size);
+        writers[t].records = 0;
+        ctxs[t] = &writers[t];
+    }
 
-        fclose(fout);
+    double t1 = MPI_Wtime();
+    RecorderRankOps ops = { open_textfile, write_to_current_textfile, close_textfile };
+    recorder_decode_ranks_parallel(&reader, ranks, num_ranks, nthreads, &ops, ctxs);
+    double elapsed = MPI_Wtime() - t1;
 
-        printf("\r[Recorder] rank %d finished\n", rank);
+    unsigned long long records = 0, total_records;
+    for(int t = 0; t < nthreads; t++) {
+        records += writers[t].records;
+        free(writers[t].buf);
     }
 
+    free(ranks);
     recorder_free_reader(&reader);
 
+    double max_elapsed;
+    MPI_Reduce(&records, &total_records, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if(mpi_rank == 0)
+        printf("[Recorder] %llu records converted in %.3f seconds (%.0f records/s)\n",
+               total_records, max_elapsed, max_elapsed > 0 ? total_records / max_elapsed : 0.0);
+
     MPI_Barrier(MPI_COMM_WORLD);
     MPI_Finalize();
 
@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "reader.h"
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 #include <assert.h>
 #include <mpi.h>
 #include <ostream>
@@ -12,13 +18,12 @@
 #include <iostream>
 #include <iomanip>
 
-RecorderReader reader;
+#define OUTPUT_BUFFER_SIZE  (4*1024*1024)
 
-struct Writer{
-    std::ofstream outFile;
-    const char* sep;
-    int rank, my_rank, total_ranks;
-};
+RecorderReader reader;
+static bool perfetto = false;
+static double lod_threshold = 0;    // seconds, 0: no level of detail pass
+static bool arrows = false;         // flow events between matched MPI calls
 
 static const char* type_name(int type) {
     switch (type) {
@@ -54,51 +59,595 @@ operator<<( std::ostream&      out,
     return out;
 }
 
-void write_to_json(Record *record, void* arg) {
-
-   int cat = recorder_get_func_type(&reader, record);
-   if (record->level == 0 || (cat == 0 || cat == 1 || cat == 3)) {
-        Writer *writer = (Writer *) arg;
-        bool user_func = (record->func_id == RECORDER_USER_FUNCTION);
-        const char *func_name = recorder_get_func_name(&reader, record);
-
-        if (user_func)
-            func_name = record->args[0];
-        std::stringstream ss;
-        ss  << writer->sep
-            << "{\"pid\":"      << writer->rank
-            << ",\"tid\":"      << record->tid
-            << ",\"ts\":"       << timeline_ts{record->tstart}
-            << ",\"name\":\""   << func_name
-            << "\",\"cat\":\""  << type_name(cat)
+
+/*
+ * One event of the timeline, the record is not kept as its template
+ * may be freed (e.g., at the end of a segment) before it is written.
+ */
+struct Slice {
+    double tstart, tend;
+    int cat, level;
+    pthread_t tid;
+    bool user_func;
+    std::string name;
+    std::string args;       // already formatted for the output
+    size_t count = 0;       // > 1: aggregated by the level of detail pass
+    std::vector<uint64_t> flows_out, flows_in;  // arrows from and to the call
+};
+
+class TimelineWriter {
+public:
+    virtual ~TimelineWriter() {}
+    virtual void begin_rank(int rank) = 0;
+    // Slices of a thread come in the order of their records
+    virtual void write(Slice& slice) = 0;
+    virtual void end_rank() = 0;
+    virtual void close() = 0;
+};
+
+
+/*
+ * Chrome JSON trace format, one complete ("X") event per slice
+ */
+class JsonWriter : public TimelineWriter {
+    std::ofstream out;
+    const char* sep;
+    int rank;
+public:
+    JsonWriter(const char* path) {
+        out.open(path, std::ofstream::trunc|std::ofstream::out);
+        out << "{\"traceEvents\": [\n";
+        sep = "";
+    }
+    void begin_rank(int r) { rank = r; }
+    void write(Slice& s) {
+        out << sep
+            << "{\"pid\":"      << rank
+            << ",\"tid\":"      << s.tid
+            << ",\"ts\":"       << timeline_ts{s.tstart}
+            << ",\"name\":\""   << s.name
+            << "\",\"cat\":\""  << type_name(s.cat)
             << "\",\"ph\":\"X\""
-            << ",\"dur\":"      << timeline_ts{record->tend - record->tstart}
+            << ",\"dur\":"      << timeline_ts{s.tend - s.tstart}
             << ",\"args\":{";
-        if (!user_func) {
-            ss  << "\"args\":[";
-            const char* sep = "";
-            for (int arg_id = 0; arg_id < record->arg_count; arg_id++) {
-                char *arg = record->args[arg_id];
-                ss << sep << "\"" << arg << "\"";
-                sep = ",";
+        if (s.count > 1)
+            out << "\"count\":" << s.count << ",";
+        else if (!s.user_func)
+            out << "\"args\":[" << s.args << "],";
+        out << "\"tend\": \"" << s.tend << "\"}}";
+        sep = ",\n";
+        // Flow events bind to the slice enclosing them
+        for (uint64_t id : s.flows_out)
+            write_flow(s, id, "\"s\"");
+        for (uint64_t id : s.flows_in)
+            write_flow(s, id, "\"f\",\"bp\":\"e\"");
+    }
+    void write_flow(const Slice& s, uint64_t id, const char* ph) {
+        out << sep
+            << "{\"pid\":"      << rank
+            << ",\"tid\":"      << s.tid
+            << ",\"ts\":"       << timeline_ts{s.tstart}
+            << ",\"name\":\"MPI\",\"cat\":\"MPI\",\"ph\":" << ph
+            << ",\"id\":"       << id << "}";
+    }
+    void end_rank() {}
+    void close() {
+        out << "],\n\"displayTimeUnit\": \"ms\",\"systemTraceEvents\": \"SystemTraceData\",\"otherData\": {\"version\": \"Taxonomy v1.0\" }, \"stackFrames\": {}, \"samples\": []}\n";
+        out.close();
+    }
+};
+
+
+/*
+ * Minimal protobuf encoder for the Perfetto trace format
+ * (perfetto/protos/perfetto/trace/trace_packet.proto).
+ *
+ * Like protozero, nested messages reserve a 4-byte varint for
+ * their length, which is filled in (redundantly encoded) when the
+ * message ends, so nothing is copied.
+ */
+class ProtoBuffer {
+public:
+    std::string buf;
+
+    void varint(uint64_t v) {
+        while(v >= 0x80) {
+            buf.push_back((char)(v | 0x80));
+            v >>= 7;
+        }
+        buf.push_back((char) v);
+    }
+    void uint_field(int field, uint64_t v) {
+        varint((uint64_t) field << 3);
+        varint(v);
+    }
+    void fixed64_field(int field, uint64_t v) {
+        varint((uint64_t) field << 3 | 1);
+        for(int i = 0; i < 8; i++)
+            buf.push_back((char)(v >> (8*i)));
+    }
+    void string_field(int field, const char* s, size_t len) {
+        varint((uint64_t) field << 3 | 2);
+        varint(len);
+        buf.append(s, len);
+    }
+    void string_field(int field, const std::string& s) {
+        string_field(field, s.data(), s.size());
+    }
+    size_t begin_message(int field) {
+        varint((uint64_t) field << 3 | 2);
+        buf.append(4, '\0');
+        return buf.size();
+    }
+    void end_message(size_t start) {
+        size_t len = buf.size() - start;
+        assert(len < (1u << 28));
+        char* p = &buf[start - 4];
+        for(int i = 0; i < 4; i++)
+            p[i] = (char)(((len >> (7*i)) & 0x7f) | (i < 3 ? 0x80 : 0));
+    }
+};
+
+// Field numbers
+enum {
+    TRACE_PACKET = 1,
+
+    PACKET_TIMESTAMP = 8, PACKET_SEQUENCE_ID = 10, PACKET_TRACK_EVENT = 11,
+    PACKET_INTERNED_DATA = 12, PACKET_SEQUENCE_FLAGS = 13, PACKET_TRACK_DESCRIPTOR = 60,
+
+    TRACK_UUID = 1, TRACK_NAME = 2, TRACK_PROCESS = 3, TRACK_PARENT_UUID = 5,
+    PROCESS_PID = 1, PROCESS_NAME = 6,
+
+    EVENT_CATEGORY_IIDS = 3, EVENT_DEBUG_ANNOTATIONS = 4, EVENT_TYPE = 9,
+    EVENT_NAME_IID = 10, EVENT_TRACK_UUID = 11,
+    EVENT_FLOW_IDS = 47, EVENT_TERMINATING_FLOW_IDS = 48,
+    ANNOTATION_NAME_IID = 1, ANNOTATION_UINT = 3, ANNOTATION_STRING = 6,
+
+    INTERNED_CATEGORIES = 1, INTERNED_EVENT_NAMES = 2, INTERNED_ANNOTATION_NAMES = 3,
+    INTERNED_IID = 1, INTERNED_NAME = 2,
+};
+enum { SLICE_BEGIN = 1, SLICE_END = 2 };
+enum { INCREMENTAL_STATE_CLEARED = 1, NEEDS_INCREMENTAL_STATE = 2 };
+enum { ANNOTATION_ARGS = 1, ANNOTATION_COUNT = 2 };
+
+/*
+ * Binary Perfetto trace, one packet sequence per output file.
+ *
+ * Each rank is a process and each of its threads a track. Begin and
+ * end events of a track must be properly nested, so slices are kept
+ * per thread until a top level (level 0) record closes the calls in
+ * progress, then sorted by start time and written with their children.
+ * Event names and categories are interned.
+ */
+class PerfettoWriter : public TimelineWriter {
+    FILE* f;
+    ProtoBuffer out;
+    uint64_t sequence_id;
+    bool first_packet;
+    std::unordered_map<std::string, uint64_t> names;
+    bool categories_interned[RECORDER_FTRACE+1];
+
+    struct Thread {
+        uint64_t uuid;
+        uint64_t last_ts;           // events of a track are in time order
+        std::vector<Slice> slices;
+    };
+    int rank;
+    std::unordered_map<pthread_t, Thread> threads;
+
+    uint64_t process_uuid() { return (uint64_t)(rank + 1) << 32; }
+
+    size_t begin_packet() {
+        size_t packet = out.begin_message(TRACE_PACKET);
+        out.uint_field(PACKET_SEQUENCE_ID, sequence_id);
+        if(first_packet) {
+            out.uint_field(PACKET_SEQUENCE_FLAGS, INCREMENTAL_STATE_CLEARED);
+            first_packet = false;
+        }
+        return packet;
+    }
+
+    void end_packet(size_t packet) {
+        out.end_message(packet);
+        if(out.buf.size() >= OUTPUT_BUFFER_SIZE) {
+            fwrite(out.buf.data(), 1, out.buf.size(), f);
+            out.buf.clear();
+        }
+    }
+
+    void interned_entry(int field, uint64_t iid, const std::string& name) {
+        size_t entry = out.begin_message(field);
+        out.uint_field(INTERNED_IID, iid);
+        out.string_field(INTERNED_NAME, name);
+        out.end_message(entry);
+    }
+
+    // Rounded timestamps of consecutive records can overlap by a tick
+    uint64_t track_ts(Thread& t, double time) {
+        uint64_t ts = time > 0 ? (uint64_t) llround(time * 1e9) : 0;
+        t.last_ts = std::max(t.last_ts, ts);
+        return t.last_ts;
+    }
+
+    void write_begin(const Slice& s, Thread& t, double tstart) {
+        // Names and categories seen for the first time
+        // are interned in the packet that uses them
+        uint64_t name_iid;
+        bool new_name = false;
+        auto it = names.find(s.name);
+        if(it == names.end()) {
+            name_iid = names.size() + 1;
+            names.emplace(s.name, name_iid);
+            new_name = true;
+        } else {
+            name_iid = it->second;
+        }
+        bool new_category = !categories_interned[s.cat];
+        categories_interned[s.cat] = true;
+
+        size_t packet = begin_packet();
+        out.uint_field(PACKET_TIMESTAMP, track_ts(t, tstart));
+        out.uint_field(PACKET_SEQUENCE_FLAGS, NEEDS_INCREMENTAL_STATE);
+        if(new_name || new_category) {
+            size_t interned = out.begin_message(PACKET_INTERNED_DATA);
+            if(new_category)
+                interned_entry(INTERNED_CATEGORIES, s.cat + 1, type_name(s.cat));
+            if(new_name)
+                interned_entry(INTERNED_EVENT_NAMES, name_iid, s.name);
+            out.end_message(interned);
+        }
+        size_t event = out.begin_message(PACKET_TRACK_EVENT);
+        out.uint_field(EVENT_TYPE, SLICE_BEGIN);
+        out.uint_field(EVENT_TRACK_UUID, t.uuid);
+        out.uint_field(EVENT_CATEGORY_IIDS, s.cat + 1);
+        out.uint_field(EVENT_NAME_IID, name_iid);
+        for(uint64_t id : s.flows_out)
+            out.fixed64_field(EVENT_FLOW_IDS, id);
+        for(uint64_t id : s.flows_in)
+            out.fixed64_field(EVENT_TERMINATING_FLOW_IDS, id);
+        if(s.count > 1) {
+            size_t annotation = out.begin_message(EVENT_DEBUG_ANNOTATIONS);
+            out.uint_field(ANNOTATION_NAME_IID, ANNOTATION_COUNT);
+            out.uint_field(ANNOTATION_UINT, s.count);
+            out.end_message(annotation);
+        } else if(!s.user_func) {
+            size_t annotation = out.begin_message(EVENT_DEBUG_ANNOTATIONS);
+            out.uint_field(ANNOTATION_NAME_IID, ANNOTATION_ARGS);
+            out.string_field(ANNOTATION_STRING, s.args);
+            out.end_message(annotation);
+        }
+        out.end_message(event);
+        end_packet(packet);
+    }
+
+    void write_end(Thread& t, double tend) {
+        size_t packet = begin_packet();
+        out.uint_field(PACKET_TIMESTAMP, track_ts(t, tend));
+        out.uint_field(PACKET_SEQUENCE_FLAGS, NEEDS_INCREMENTAL_STATE);
+        size_t event = out.begin_message(PACKET_TRACK_EVENT);
+        out.uint_field(EVENT_TYPE, SLICE_END);
+        out.uint_field(EVENT_TRACK_UUID, t.uuid);
+        out.end_message(event);
+        end_packet(packet);
+    }
+
+    void flush_thread(Thread& t) {
+        // Parents start no later than their children and have a lower level
+        std::stable_sort(t.slices.begin(), t.slices.end(), [](const Slice& a, const Slice& b) {
+            return a.tstart < b.tstart || (a.tstart == b.tstart && a.level < b.level);
+        });
+
+        // Open slices, children are clamped to their parent. The parent
+        // of a record may not be in the timeline (e.g., an MPI call)
+        struct Open { int level; double tend; };
+        std::vector<Open> stack;
+        for(const Slice& s : t.slices) {
+            while(!stack.empty() && (stack.back().level >= s.level || stack.back().tend < s.tstart)) {
+                write_end(t, stack.back().tend);
+                stack.pop_back();
             }
-            ss  << "],";
+            double tstart = s.tstart, tend = s.tend;
+            if(!stack.empty()) {
+                tstart = std::min(tstart, stack.back().tend);
+                tend = std::min(tend, stack.back().tend);
+            }
+            write_begin(s, t, tstart);
+            stack.push_back({s.level, std::max(tstart, tend)});
+        }
+        while(!stack.empty()) {
+            write_end(t, stack.back().tend);
+            stack.pop_back();
         }
-        ss << "\"tend\": \"" << record->tend << "\"}}";
-        writer->outFile << ss.rdbuf();
-        writer->sep = ",\n";
+        t.slices.clear();
+    }
+
+public:
+    PerfettoWriter(const char* path, int mpi_rank) {
+        f = fopen(path, "wb");
+        sequence_id = mpi_rank + 1;
+        first_packet = true;
+        memset(categories_interned, 0, sizeof(categories_interned));
+        out.buf.reserve(OUTPUT_BUFFER_SIZE + 4096);
+
+        size_t packet = begin_packet();
+        size_t interned = out.begin_message(PACKET_INTERNED_DATA);
+        interned_entry(INTERNED_ANNOTATION_NAMES, ANNOTATION_ARGS, "args");
+        interned_entry(INTERNED_ANNOTATION_NAMES, ANNOTATION_COUNT, "count");
+        out.end_message(interned);
+        end_packet(packet);
+    }
+
+    void begin_rank(int r) {
+        rank = r;
+        // pid 0 is the idle process in Perfetto
+        size_t packet = begin_packet();
+        size_t track = out.begin_message(PACKET_TRACK_DESCRIPTOR);
+        out.uint_field(TRACK_UUID, process_uuid());
+        size_t process = out.begin_message(TRACK_PROCESS);
+        out.uint_field(PROCESS_PID, rank + 1);
+        out.string_field(PROCESS_NAME, "Rank " + std::to_string(rank));
+        out.end_message(process);
+        out.end_message(track);
+        end_packet(packet);
+    }
+
+    void write(Slice& s) {
+        auto it = threads.find(s.tid);
+        if(it == threads.end()) {
+            Thread t;
+            t.uuid = process_uuid() + threads.size() + 1;
+            t.last_ts = 0;
+            it = threads.emplace(s.tid, std::move(t)).first;
+
+            size_t packet = begin_packet();
+            size_t track = out.begin_message(PACKET_TRACK_DESCRIPTOR);
+            out.uint_field(TRACK_UUID, it->second.uuid);
+            out.string_field(TRACK_NAME, "Thread " + std::to_string((unsigned long) s.tid));
+            out.uint_field(TRACK_PARENT_UUID, process_uuid());
+            out.end_message(track);
+            end_packet(packet);
+        }
+
+        Thread& t = it->second;
+        t.slices.push_back(std::move(s));
+        if(t.slices.back().level == 0)
+            flush_thread(t);
+    }
+
+    void end_rank() {
+        for(auto& it : threads)
+            flush_thread(it.second);
+        threads.clear();
+    }
+
+    void close() {
+        fwrite(out.buf.data(), 1, out.buf.size(), f);
+        fclose(f);
+    }
+};
+
+
+/*
+ * Arrows: each head and tail pair of a match of MPI calls, except
+ * all-to-all ones, is a flow from the head to the tail. Rank 0 matches
+ * the whole trace and sends each converter process the flow ends of
+ * its ranks. Flows with an end that is not in the timeline are dropped.
+ */
+struct FlowEnd {
+    size_t seq_id;
+    uint64_t id;
+    bool out;
+};
+
+/*
+ * Level of detail: consecutive records of a thread with the same
+ * function and level, each shorter than lod_threshold, are merged
+ * into one slice until it spans lod_threshold. Any other record of
+ * the thread ends the run, so merged slices keep the call nesting.
+ */
+struct Converter {
+    TimelineWriter* writer;
+    std::unordered_map<pthread_t, Slice> runs;     // count == 0: no run
+    std::vector<FlowEnd> flows;                     // of the rank, by seq_id
+    size_t next_flow;
+};
+
+static void lod_end_run(Converter* c, Slice& run) {
+    if(run.count > 0)
+        c->writer->write(run);
+    run.count = 0;
+}
+
+static void lod_add(Converter* c, Slice& s) {
+    Slice& run = c->runs[s.tid];
+    bool short_event = s.tend - s.tstart < lod_threshold && s.flows_out.empty() && s.flows_in.empty();
+    if(run.count > 0 && short_event && run.level == s.level && run.name == s.name) {
+        run.tend = s.tend;
+        run.count++;
+    } else {
+        lod_end_run(c, run);
+        if(!short_event) {
+            c->writer->write(s);
+            return;
+        }
+        run = std::move(s);
+    }
+    if(run.tend - run.tstart >= lod_threshold)
+        lod_end_run(c, run);
+}
+
+static void format_args(const Record* record, std::string& args) {
+    for (int arg_id = 0; arg_id < record->arg_count; arg_id++) {
+        if (perfetto) {
+            if (arg_id > 0) args += ' ';
+            args += record->args[arg_id];
+        } else {
+            if (arg_id > 0) args += ',';
+            args += '"';
+            args += record->args[arg_id];
+            args += '"';
+        }
+    }
+}
+
+// MPI calls and user functions made inside other calls are left out
+static bool in_timeline(int cat, int level) {
+    return level == 0 || cat == 0 || cat == 1 || cat == 3;
+}
+
+// Records come in seq_id order, s is NULL if not in the timeline
+static void take_flows(Converter* c, size_t seq_id, Slice* s) {
+    while (c->next_flow < c->flows.size() && c->flows[c->next_flow].seq_id <= seq_id) {
+        const FlowEnd& f = c->flows[c->next_flow++];
+        if (s && f.seq_id == seq_id)
+            (f.out ? s->flows_out : s->flows_in).push_back(f.id);
     }
 }
 
+void write_to_timeline(RecordView* view, void* arg) {
+    Converter* c = (Converter*) arg;
+    const Record* record = view->tmpl;
+
+    int cat = recorder_get_func_type(&reader, record);
+    if (!in_timeline(cat, record->level)) {
+        if (lod_threshold > 0) {
+            auto it = c->runs.find(record->tid);
+            if (it != c->runs.end())
+                lod_end_run(c, it->second);
+        }
+        take_flows(c, view->seq_id, NULL);
+        return;
+    }
+
+    Slice s;
+    s.tstart = view->tstart;
+    s.tend = view->tend;
+    s.cat = cat;
+    s.level = record->level;
+    s.tid = record->tid;
+    s.user_func = (record->func_id == RECORDER_USER_FUNCTION);
+    s.name = s.user_func ? record->args[0] : recorder_get_func_name(&reader, record);
+    s.count = 1;
+    if (!s.user_func)
+        format_args(record, s.args);
+    take_flows(c, view->seq_id, &s);
+
+    if (lod_threshold > 0)
+        lod_add(c, s);
+    else
+        c->writer->write(s);
+}
+
+static bool node_in_timeline(const MPIMatchNode* node) {
+    Record r;
+    r.func_id = node->func_id;
+    return in_timeline(recorder_get_func_type(&reader, &r), node->level);
+}
+
+static void match_flows(std::vector<std::vector<FlowEnd>>& flows) {
+    MPIMatches* matches = match_mpi_calls(&reader);
+    uint64_t id = 0;
+    for (size_t i = 0; i < matches->num_matches; i++) {
+        const MPIMatch* m = &matches->matches[i];
+        if (m->type == MPI_MATCH_ALL_TO_ALL)
+            continue;
+        const MPIMatchNode* heads = matches->nodes + m->begin;
+        const MPIMatchNode* tails = heads + m->num_heads;
+        for (int h = 0; h < m->num_heads; h++) {
+            if (!node_in_timeline(&heads[h]))
+                continue;
+            for (int t = 0; t < m->num_tails; t++) {
+                if (!node_in_timeline(&tails[t]))
+                    continue;
+                id++;
+                flows[heads[h].rank].push_back({ (size_t) heads[h].seq_id, id, true });
+                flows[tails[t].rank].push_back({ (size_t) tails[t].seq_id, id, false });
+            }
+        }
+    }
+    free_mpi_matches(matches);
+
+    for (auto& f : flows)
+        std::stable_sort(f.begin(), f.end(), [](const FlowEnd& a, const FlowEnd& b) {
+            return a.seq_id < b.seq_id;
+        });
+}
+
+/*
+ * flows[rank] is filled for the ranks of this process. Rank 0 sends
+ * the others the flow ends of their ranks, in the order of their plan.
+ */
+static void find_flows(const size_t* counts, int mpi_size, int mpi_rank,
+                       std::vector<std::vector<FlowEnd>>& flows) {
+    int total_ranks = flows.size();
+    if (mpi_rank == 0)
+        match_flows(flows);
+
+    std::vector<size_t> num_ends(total_ranks);
+    for (int rank = 0; rank < total_ranks; rank++)
+        num_ends[rank] = flows[rank].size();
+    MPI_Bcast(num_ends.data(), total_ranks, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+
+    MPI_Datatype flow_type;
+    MPI_Type_contiguous(sizeof(FlowEnd), MPI_BYTE, &flow_type);
+    MPI_Type_commit(&flow_type);
+
+    std::vector<int> ranks(total_ranks+1);
+    std::vector<FlowEnd> buf;
+    if (mpi_rank == 0) {
+        for (int p = 1; p < mpi_size; p++) {
+            int n = recorder_plan_ranks(counts, total_ranks, mpi_size, p, ranks.data());
+            buf.clear();
+            for (int i = 0; i < n; i++) {
+                std::vector<FlowEnd>& f = flows[ranks[i]];
+                buf.insert(buf.end(), f.begin(), f.end());
+                std::vector<FlowEnd>().swap(f);
+            }
+            assert(buf.size() <= INT32_MAX);
+            MPI_Send(buf.data(), (int) buf.size(), flow_type, p, 0, MPI_COMM_WORLD);
+        }
+    } else {
+        int n = recorder_plan_ranks(counts, total_ranks, mpi_size, mpi_rank, ranks.data());
+        size_t total = 0;
+        for (int i = 0; i < n; i++)
+            total += num_ends[ranks[i]];
+        assert(total <= INT32_MAX);
+        buf.resize(total);
+        MPI_Recv(buf.data(), (int) total, flow_type, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        size_t begin = 0;
+        for (int i = 0; i < n; i++) {
+            size_t end = begin + num_ends[ranks[i]];
+            flows[ranks[i]].assign(buf.begin() + begin, buf.begin() + end);
+            begin = end;
+        }
+    }
+    MPI_Type_free(&flow_type);
+}
+
 int min(int a, int b) { return a < b ? a : b; }
 int max(int a, int b) { return a > b ? a : b; }
 
+/*
+ * Usage: recorder2timeline <traces dir> [--perfetto] [--lod <seconds>] [--arrows]
+ */
 int main(int argc, char **argv) {
 
-    if(argc!=2) {
-        std::cerr << "Usage: " << argv[0] << " <directory-of-recorder.mt>\n";
+    if(argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <directory-of-recorder.mt> [--perfetto] [--lod <seconds>] [--arrows]\n";
         std::exit(1);
     }
+    for(int i = 2; i < argc; i++) {
+        if(strcmp(argv[i], "--perfetto") == 0)
+            perfetto = true;
+        else if(strcmp(argv[i], "--lod") == 0 && i+1 < argc)
+            lod_threshold = atof(argv[++i]);
+        else if(strcmp(argv[i], "--arrows") == 0)
+            arrows = true;
+        else {
+            std::cerr << "Unknown option: " << argv[i] << "\n";
+            std::exit(1);
+        }
+    }
 
     int mpi_size, mpi_rank;
     MPI_Init(&argc, &argv);
@@ -106,7 +655,7 @@ int main(int argc, char **argv) {
     MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
 
     char textfile_dir[256];
-    sprintf(textfile_dir, "%s/_chrome", argv[1]);
+    sprintf(textfile_dir, "%s/%s", argv[1], perfetto ? "_perfetto" : "_chrome");
 
     if(mpi_rank == 0)
         mkdir(textfile_dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
@@ -114,23 +663,44 @@ int main(int argc, char **argv) {
 
     recorder_init_reader(argv[1], &reader);
 
-    // Each rank will process n files (n ranks traces)
-    int n = max(reader.metadata.total_ranks/mpi_size, 1);
-    int start_rank = n * mpi_rank;
-    int end_rank   = min(reader.metadata.total_ranks, n*(mpi_rank+1));
+    // Balance the ranks among processes by their number of records,
+    // each process counts a strided subset of them
+    int total_ranks = reader.metadata.total_ranks;
+    std::vector<size_t> counts(total_ranks);
+    for(int rank = mpi_rank; rank < total_ranks; rank += mpi_size)
+        counts[rank] = recorder_get_num_records(&reader, rank);
+    MPI_Allreduce(MPI_IN_PLACE, counts.data(), total_ranks, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    std::vector<int> ranks(total_ranks+1);
+    int num_ranks = recorder_plan_ranks(counts.data(), total_ranks, mpi_size, mpi_rank, ranks.data());
+
+    std::vector<std::vector<FlowEnd>> flows(total_ranks);
+    if(arrows)
+        find_flows(counts.data(), mpi_size, mpi_rank, flows);
+
     char textfile_path[256];
-    sprintf(textfile_path, "%s/timeline_%d.json", textfile_dir, mpi_rank);
-    Writer local;
-    local.outFile.open(textfile_path, std::ofstream::trunc|std::ofstream::out);
-    local.outFile << "{\"traceEvents\": [\n";
-    local.sep = "";
-    for(int rank = start_rank; rank < end_rank; rank++) {
-        local.rank = rank;
-        recorder_decode_records(&reader, rank, write_to_json, &local);
+    Converter local;
+    if(perfetto) {
+        sprintf(textfile_path, "%s/timeline_%d.pftrace", textfile_dir, mpi_rank);
+        local.writer = new PerfettoWriter(textfile_path, mpi_rank);
+    } else {
+        sprintf(textfile_path, "%s/timeline_%d.json", textfile_dir, mpi_rank);
+        local.writer = new JsonWriter(textfile_path);
+    }
+    for(int i = 0; i < num_ranks; i++) {
+        int rank = ranks[i];
+        local.writer->begin_rank(rank);
+        local.flows.swap(flows[rank]);
+        local.next_flow = 0;
+        recorder_decode_record_views(&reader, rank, write_to_timeline, &local);
+        for(auto& it : local.runs)
+            lod_end_run(&local, it.second);
+        local.runs.clear();
+        local.writer->end_rank();
         printf("\r[Recorder] rank %d finished, %s\n", rank, textfile_path);
     }
-    local.outFile << "],\n\"displayTimeUnit\": \"ms\",\"systemTraceEvents\": \"SystemTraceData\",\"otherData\": {\"version\": \"Taxonomy v1.0\" }, \"stackFrames\": {}, \"samples\": []}\n";
-    local.outFile.close();
+    local.writer->close();
+    delete local.writer;
     recorder_free_reader(&reader);
 
     MPI_Barrier(MPI_COMM_WORLD);
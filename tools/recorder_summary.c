@@ -1,12 +1,412 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <float.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <math.h>
 #include "reader.h"
 
 
+RecorderReader reader;
+
+/*
+ * Request sizes, bin i counts the sizes up to size_bins[i]
+ * bytes (exclusive), the last bin everything above
+ */
+#define NUM_SIZE_BINS 10
+static const size_t size_bins[NUM_SIZE_BINS-1] = {
+    100, 1024, 10*1024, 100*1024, 1024*1024, 4*1024*1024,
+    10*1024*1024, 100*1024*1024, 1024*1024*1024
+};
+static const char* size_bin_names[NUM_SIZE_BINS] = {
+    "0-100", "100-1K", "1K-10K", "10K-100K", "100K-1M",
+    "1M-4M", "4M-10M", "10M-100M", "100M-1G", "1G+"
+};
+
+static const char* layer_names[] = { "POSIX", "MPI-IO", "MPI", "HDF5", "User" };
+#define NUM_LAYERS (sizeof(layer_names) / sizeof(layer_names[0]))
+
+typedef struct FileSummary_t {
+    char* filename;
+    size_t reads, writes;
+    size_t bytes_read, bytes_written;
+    int ranks;
+    int last_rank;              // count each rank once
+    UT_hash_handle hh;
+} FileSummary;
+
+typedef struct RankSummary_t {
+    size_t calls;
+    size_t reads, writes;       // POSIX
+    size_t bytes_read, bytes_written;
+    double read_time, write_time;
+    double tstart, tend;
+} RankSummary;
+
+/*
+ * Reads and writes of a layer. The bytes are those of the sized
+ * calls, HDF5 calls and MPI-IO calls with a derived datatype do
+ * not log how much they transfer.
+ */
+typedef struct LayerIO_t {
+    size_t reads, writes;
+    size_t bytes_read, bytes_written;
+    size_t unsized;
+} LayerIO;
+
+/*
+ * One per decoding thread. Counts and bytes come from the
+ * grammars, times from the timestamps of the records.
+ */
+typedef struct Summary_t {
+    size_t calls[256];
+    double time[256];
+    size_t read_sizes[NUM_SIZE_BINS], write_sizes[NUM_SIZE_BINS];
+    LayerIO layer_io[NUM_LAYERS];
+    FileSummary* files;
+    RankSummary* ranks;         // of all ranks, each filled by one thread
+    int rank;                   // being summarized
+} Summary;
+
+
+static int size_bin(size_t bytes) {
+    int i = 0;
+    while(i < NUM_SIZE_BINS-1 && bytes >= size_bins[i])
+        i++;
+    return i;
+}
+
+static FileSummary* find_file(FileSummary** files, const char* filename) {
+    FileSummary* f = NULL;
+    HASH_FIND_STR(*files, filename, f);
+    if(f == NULL) {
+        f = calloc(1, sizeof(FileSummary));
+        f->filename = strdup(filename);
+        f->last_rank = -1;
+        HASH_ADD_KEYPTR(hh, *files, f->filename, strlen(f->filename), f);
+    }
+    return f;
+}
+
+static void summarize_signature(const Record* tmpl, size_t count, void* arg) {
+    Summary* s = (Summary*) arg;
+    RankSummary* rs = &s->ranks[s->rank];
+    s->calls[tmpl->func_id] += count;
+    rs->calls += count;
+
+    size_t bytes;
+    bool sized, is_read;
+    if(!recorder_get_layer_io_bytes(&reader, tmpl, &bytes, &sized, &is_read))
+        return;
+    LayerIO* lio = &s->layer_io[recorder_get_func_type(&reader, tmpl)];
+    if(is_read) {
+        lio->reads += count;
+        lio->bytes_read += count * bytes;
+    } else {
+        lio->writes += count;
+        lio->bytes_written += count * bytes;
+    }
+    if(!sized)
+        lio->unsized += count;
+
+    const char* filename;
+    if(!recorder_get_io_bytes(&reader, tmpl, &filename, &bytes, &is_read))
+        return;
+
+    FileSummary* f = find_file(&s->files, filename);
+    if(f->last_rank != s->rank) {
+        f->last_rank = s->rank;
+        f->ranks++;
+    }
+    if(is_read) {
+        s->read_sizes[size_bin(bytes)] += count;
+        f->reads += count;
+        f->bytes_read += count * bytes;
+        rs->reads += count;
+        rs->bytes_read += count * bytes;
+    } else {
+        s->write_sizes[size_bin(bytes)] += count;
+        f->writes += count;
+        f->bytes_written += count * bytes;
+        rs->writes += count;
+        rs->bytes_written += count * bytes;
+    }
+}
+
+static void begin_rank(int rank, void* ctx) {
+    Summary* s = (Summary*) ctx;
+    s->rank = rank;
+    s->ranks[rank].tstart = DBL_MAX;
+    s->ranks[rank].tend = 0;
+    recorder_visit_signatures(&reader, rank, summarize_signature, s);
+}
+
+static void summarize_record(RecordView* v, void* ctx) {
+    Summary* s = (Summary*) ctx;
+    RankSummary* rs = &s->ranks[s->rank];
+    const RecorderFuncDesc* desc = recorder_get_func_desc(&reader, v->tmpl);
+    double duration = v->tend - v->tstart;
+
+    s->time[v->tmpl->func_id] += duration;
+    if(v->tstart < rs->tstart) rs->tstart = v->tstart;
+    if(v->tend > rs->tend) rs->tend = v->tend;
+
+    if(desc->layer == RECORDER_POSIX) {
+        if(desc->op == RECORDER_OP_READ)
+            rs->read_time += duration;
+        else if(desc->op == RECORDER_OP_WRITE)
+            rs->write_time += duration;
+    }
+}
+
+static void merge_summary(Summary* dst, Summary* src) {
+    for(int i = 0; i < 256; i++) {
+        dst->calls[i] += src->calls[i];
+        dst->time[i] += src->time[i];
+    }
+    for(int i = 0; i < NUM_SIZE_BINS; i++) {
+        dst->read_sizes[i] += src->read_sizes[i];
+        dst->write_sizes[i] += src->write_sizes[i];
+    }
+    for(int l = 0; l < NUM_LAYERS; l++) {
+        dst->layer_io[l].reads += src->layer_io[l].reads;
+        dst->layer_io[l].writes += src->layer_io[l].writes;
+        dst->layer_io[l].bytes_read += src->layer_io[l].bytes_read;
+        dst->layer_io[l].bytes_written += src->layer_io[l].bytes_written;
+        dst->layer_io[l].unsized += src->layer_io[l].unsized;
+    }
+
+    // A rank is summarized by one thread only
+    FileSummary *f, *tmp;
+    HASH_ITER(hh, src->files, f, tmp) {
+        FileSummary* d = find_file(&dst->files, f->filename);
+        d->reads += f->reads;
+        d->writes += f->writes;
+        d->bytes_read += f->bytes_read;
+        d->bytes_written += f->bytes_written;
+        d->ranks += f->ranks;
+        HASH_DEL(src->files, f);
+        free(f->filename);
+        free(f);
+    }
+}
+
+static int by_bytes(FileSummary* a, FileSummary* b) {
+    size_t ba = a->bytes_read + a->bytes_written;
+    size_t bb = b->bytes_read + b->bytes_written;
+    if(ba != bb)
+        return ba > bb ? -1 : 1;
+    return strcmp(a->filename, b->filename);
+}
+
+static double mib_per_sec(size_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0;
+}
+
+static void json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for(; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if(c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if(c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+
+/*
+ * Job-level results derived from the merged summary
+ */
+typedef struct JobSummary_t {
+    int total_ranks;
+    double tstart, tend;
+    size_t calls;
+    size_t layer_calls[NUM_LAYERS];
+    double layer_time[NUM_LAYERS];
+    size_t reads, writes, bytes_read, bytes_written;
+    double read_time, write_time;           // of the slowest rank
+} JobSummary;
+
+static void summarize_job(Summary* s, JobSummary* job) {
+    memset(job, 0, sizeof(JobSummary));
+    job->total_ranks = reader.metadata.total_ranks;
+    job->tstart = DBL_MAX;
+
+    for(int i = 0; i < 256; i++) {
+        Record r;
+        r.func_id = i;
+        int layer = recorder_get_func_type(&reader, &r);
+        job->layer_calls[layer] += s->calls[i];
+        job->layer_time[layer] += s->time[i];
+        job->calls += s->calls[i];
+    }
+
+    for(int rank = 0; rank < job->total_ranks; rank++) {
+        RankSummary* rs = &s->ranks[rank];
+        if(rs->tstart < job->tstart) job->tstart = rs->tstart;
+        if(rs->tend > job->tend) job->tend = rs->tend;
+        job->reads += rs->reads;
+        job->writes += rs->writes;
+        job->bytes_read += rs->bytes_read;
+        job->bytes_written += rs->bytes_written;
+        if(rs->read_time > job->read_time) job->read_time = rs->read_time;
+        if(rs->write_time > job->write_time) job->write_time = rs->write_time;
+    }
+    if(job->tstart > job->tend)         // no timestamps
+        job->tstart = job->tend;
+}
+
+static void print_tables(Summary* s, JobSummary* job) {
+    printf("Ranks: %d\nWall time: %.6f s\nTotal calls: %zu\n",
+           job->total_ranks, job->tend - job->tstart, job->calls);
+
+    printf("\n%-10s %18s %14s\n", "Layer", "Calls", "Time(s)");
+    for(int l = 0; l < NUM_LAYERS; l++) {
+        if(job->layer_calls[l] > 0)
+            printf("%-10s %18zu %14.6f\n", layer_names[l], job->layer_calls[l], job->layer_time[l]);
+    }
+
+    size_t unsized = 0;
+    printf("\n%-10s %12s %16s %12s %16s %10s\n", "Layer I/O", "Reads", "Bytes Read",
+           "Writes", "Bytes Written", "Unsized");
+    for(int l = 0; l < NUM_LAYERS; l++) {
+        LayerIO* lio = &s->layer_io[l];
+        if(lio->reads + lio->writes == 0)
+            continue;
+        printf("%-10s %12zu %16zu %12zu %16zu %10zu\n", layer_names[l], lio->reads,
+               lio->bytes_read, lio->writes, lio->bytes_written, lio->unsized);
+        unsized += lio->unsized;
+    }
+    if(unsized > 0)
+        printf("Unsized calls log no size (HDF5, MPI-IO with derived datatypes), "
+               "their bytes are not counted.\n");
+
+    // Bandwidth of the job: bytes over the time of the slowest rank
+    printf("\n%-10s %14s %18s %14s %16s\n", "POSIX I/O", "Ops", "Bytes", "Time(s)", "MiB/s");
+    printf("%-10s %14zu %18zu %14.6f %16.2f\n", "Read", job->reads, job->bytes_read,
+           job->read_time, mib_per_sec(job->bytes_read, job->read_time));
+    printf("%-10s %14zu %18zu %14.6f %16.2f\n", "Write", job->writes, job->bytes_written,
+           job->write_time, mib_per_sec(job->bytes_written, job->write_time));
+
+    printf("\n%-12s %14s %14s\n", "Request size", "Reads", "Writes");
+    for(int i = 0; i < NUM_SIZE_BINS; i++)
+        printf("%-12s %14zu %14zu\n", size_bin_names[i], s->read_sizes[i], s->write_sizes[i]);
+
+    printf("\n%-25s %8s %18s %14s %12s\n", "Func", "Layer", "Calls", "Time(s)", "Avg(us)");
+    for(int i = 0; i < 256; i++) {
+        if(s->calls[i] == 0)
+            continue;
+        Record r;
+        r.func_id = i;
+        printf("%-25s %8s %18zu %14.6f %12.3f\n", recorder_get_func_name(&reader, &r),
+               layer_names[recorder_get_func_type(&reader, &r)], s->calls[i], s->time[i],
+               s->time[i] / s->calls[i] * 1e6);
+    }
+
+    if(s->files) {
+        printf("\n%-40s %6s %12s %16s %12s %16s\n", "File", "Ranks", "Reads", "Bytes Read", "Writes", "Bytes Written");
+        FileSummary *f, *tmp;
+        HASH_ITER(hh, s->files, f, tmp) {
+            printf("%-40s %6d %12zu %16zu %12zu %16zu\n", f->filename, f->ranks,
+                   f->reads, f->bytes_read, f->writes, f->bytes_written);
+        }
+    }
+
+    printf("\n%-8s %14s %12s %16s %12s %16s %14s %12s\n", "Rank", "Calls", "Reads", "Bytes Read",
+           "Writes", "Bytes Written", "I/O Time(s)", "MiB/s");
+    for(int rank = 0; rank < job->total_ranks; rank++) {
+        RankSummary* rs = &s->ranks[rank];
+        double io_time = rs->read_time + rs->write_time;
+        printf("%-8d %14zu %12zu %16zu %12zu %16zu %14.6f %12.2f\n", rank, rs->calls,
+               rs->reads, rs->bytes_read, rs->writes, rs->bytes_written, io_time,
+               mib_per_sec(rs->bytes_read + rs->bytes_written, io_time));
+    }
+}
+
+static void write_json(FILE* out, Summary* s, JobSummary* job) {
+    fprintf(out, "{\n  \"total_ranks\": %d,\n  \"wall_time\": %.9g,\n  \"calls\": %zu,\n",
+            job->total_ranks, job->tend - job->tstart, job->calls);
+
+    fprintf(out, "  \"layers\": {");
+    const char* sep = "";
+    for(int l = 0; l < NUM_LAYERS; l++) {
+        fprintf(out, "%s\n    \"%s\": {\"calls\": %zu, \"time\": %.9g}", sep,
+                layer_names[l], job->layer_calls[l], job->layer_time[l]);
+        sep = ",";
+    }
+    fprintf(out, "\n  },\n");
+
+    fprintf(out, "  \"layer_io\": {");
+    sep = "";
+    for(int l = 0; l < NUM_LAYERS; l++) {
+        LayerIO* lio = &s->layer_io[l];
+        fprintf(out, "%s\n    \"%s\": {\"reads\": %zu, \"bytes_read\": %zu, \"writes\": %zu, "
+                "\"bytes_written\": %zu, \"unsized\": %zu}", sep, layer_names[l], lio->reads,
+                lio->bytes_read, lio->writes, lio->bytes_written, lio->unsized);
+        sep = ",";
+    }
+    fprintf(out, "\n  },\n");
+
+    fprintf(out, "  \"posix\": {\n");
+    fprintf(out, "    \"read\": {\"ops\": %zu, \"bytes\": %zu, \"time\": %.9g, \"bandwidth\": %.9g},\n",
+            job->reads, job->bytes_read, job->read_time, mib_per_sec(job->bytes_read, job->read_time));
+    fprintf(out, "    \"write\": {\"ops\": %zu, \"bytes\": %zu, \"time\": %.9g, \"bandwidth\": %.9g}\n",
+            job->writes, job->bytes_written, job->write_time, mib_per_sec(job->bytes_written, job->write_time));
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"request_sizes\": [");
+    for(int i = 0; i < NUM_SIZE_BINS; i++) {
+        fprintf(out, "%s\n    {\"bin\": \"%s\", \"reads\": %zu, \"writes\": %zu}", i ? "," : "",
+                size_bin_names[i], s->read_sizes[i], s->write_sizes[i]);
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"functions\": [");
+    sep = "";
+    for(int i = 0; i < 256; i++) {
+        if(s->calls[i] == 0)
+            continue;
+        Record r;
+        r.func_id = i;
+        fprintf(out, "%s\n    {\"name\": ", sep);
+        json_string(out, recorder_get_func_name(&reader, &r));
+        fprintf(out, ", \"layer\": \"%s\", \"calls\": %zu, \"time\": %.9g}",
+                layer_names[recorder_get_func_type(&reader, &r)], s->calls[i], s->time[i]);
+        sep = ",";
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"files\": [");
+    sep = "";
+    FileSummary *f, *tmp;
+    HASH_ITER(hh, s->files, f, tmp) {
+        fprintf(out, "%s\n    {\"name\": ", sep);
+        json_string(out, f->filename);
+        fprintf(out, ", \"ranks\": %d, \"reads\": %zu, \"bytes_read\": %zu, \"writes\": %zu, \"bytes_written\": %zu}",
+                f->ranks, f->reads, f->bytes_read, f->writes, f->bytes_written);
+        sep = ",";
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"ranks\": [");
+    for(int rank = 0; rank < job->total_ranks; rank++) {
+        RankSummary* rs = &s->ranks[rank];
+        bool timed = rs->tstart <= rs->tend;
+        fprintf(out, "%s\n    {\"rank\": %d, \"calls\": %zu, \"reads\": %zu, \"bytes_read\": %zu, "
+                "\"writes\": %zu, \"bytes_written\": %zu, \"read_time\": %.9g, \"write_time\": %.9g, "
+                "\"tstart\": %.9g, \"tend\": %.9g}", rank ? "," : "", rank, rs->calls,
+                rs->reads, rs->bytes_read, rs->writes, rs->bytes_written, rs->read_time,
+                rs->write_time, timed ? rs->tstart : 0, timed ? rs->tend : 0);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
 
 void print_cst(RecorderReader* reader, CST* cst) {
     printf("\nBelow are the unique call signatures: \n");
@@ -28,55 +428,74 @@ void print_cst(RecorderReader* reader, CST* cst) {
     }
 }
 
-void show_statistics(RecorderReader* reader, CST* cst) {
 
-    int unique_signature[256] = {0};
-    int call_count[256] = {0};
-    int mpiio_count = 0, hdf5_count = 0, posix_count = 0;
+/*
+ * recorder_summary <traces dir> [--signatures]
+ *
+ * Prints the tables and writes the same in JSON to
+ * <traces dir>/summary.json. With --signatures, the unique
+ * call signatures of rank 0 are printed as well.
+ */
+int main(int argc, char **argv) {
 
-    for(int i = 0; i < cst->entries; i++) {
-        Record* record = recorder_cs_to_record(&cst->cs_list[i]);
-        const char* func_name = recorder_get_func_name(reader, record);
+    bool signatures = (argc > 2 && strcmp(argv[2], "--signatures") == 0);
 
-        int type = recorder_get_func_type(reader, record);
-        if(type == RECORDER_MPIIO)
-            mpiio_count += cst->cs_list[i].count;
-        if(type == RECORDER_HDF5)
-            hdf5_count += cst->cs_list[i].count;
-        if(type == RECORDER_POSIX)
-            posix_count += cst->cs_list[i].count;
+    recorder_init_reader(argv[1], &reader);
 
-        unique_signature[record->func_id]++;
-        call_count[record->func_id] += cst->cs_list[i].count;
+    int total_ranks = reader.metadata.total_ranks;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads > total_ranks) nthreads = total_ranks;
+    if(nthreads < 1) nthreads = 1;
+    // Keep a rank loaded from its grammar pass to its decoding
+    recorder_reader_set_cache(&reader, 2*nthreads, 0);
 
-        recorder_free_record(record);
+    RankSummary* ranks = calloc(total_ranks, sizeof(RankSummary));
+    Summary* summaries = calloc(nthreads, sizeof(Summary));
+    void* ctxs[nthreads];
+    for(int t = 0; t < nthreads; t++) {
+        summaries[t].ranks = ranks;
+        ctxs[t] = &summaries[t];
     }
-    long int total = hdf5_count + mpiio_count + posix_count;
-    printf("Total: %ld\nHDF5: %d\nMPI-IO Count: %d\nPOSIX: %d\n", total, hdf5_count, mpiio_count, posix_count);
-
-    printf("\n%-25s %18s %18s\n", "Func", "Unique Signature", "Total Call Count");
-    for(int i = 0; i < 256; i++) {
-        if(unique_signature[i] > 0) {
-            printf("%-25s %18d %18d\n", func_list[i], unique_signature[i], call_count[i]);
-        }
-    }
-
-}
 
+    RecorderRankOps ops = { begin_rank, summarize_record, NULL };
+    recorder_decode_ranks_parallel(&reader, NULL, 0, nthreads, &ops, ctxs);
 
-int main(int argc, char **argv) {
-
-    RecorderReader reader;
-    recorder_init_reader(argv[1], &reader);
+    for(int t = 1; t < nthreads; t++)
+        merge_summary(&summaries[0], &summaries[t]);
+    Summary* s = &summaries[0];
+    HASH_SRT(hh, s->files, by_bytes);
 
-    CST* cst;
-    CFG* cfg;
-    recorder_get_cst_cfg(&reader, 0, &cst, &cfg);
+    JobSummary job;
+    summarize_job(s, &job);
+    print_tables(s, &job);
 
-    show_statistics(&reader, cst);
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/summary.json", argv[1]);
+    FILE* json = fopen(path, "w");
+    if(json) {
+        write_json(json, s, &job);
+        fclose(json);
+        printf("\nJSON summary written to %s\n", path);
+    } else {
+        fprintf(stderr, "[Recorder] cannot write %s\n", path);
+    }
 
-    print_cst(&reader, cst);
+    if(signatures) {
+        CST* cst;
+        CFG* cfg;
+        recorder_get_cst_cfg(&reader, 0, &cst, &cfg);
+        print_cst(&reader, cst);
+        recorder_release_cst_cfg(&reader, 0);
+    }
 
+    FileSummary *f, *tmp;
+    HASH_ITER(hh, s->files, f, tmp) {
+        HASH_DEL(s->files, f);
+        free(f->filename);
+        free(f);
+    }
+    free(summaries);
+    free(ranks);
     recorder_free_reader(&reader);
 
     return 0;
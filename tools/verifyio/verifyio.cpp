@@ -0,0 +1,715 @@
+/*
+ * Verify if conflicting I/O accesses are properly synchronized
+ * under a consistency semantics.
+ *
+ * 1. MPI calls are matched by match_mpi_calls(): sends with receives,
+ *    collectives with each other, and nonblocking calls with the
+ *    wait/test calls that complete them. Each match is an edge of the
+ *    happens-before graph.
+ * 2. Nodes are the matched calls and the calls that the conflicts are
+ *    checked at. Program order edges between consecutive nodes of a
+ *    rank are implicit, only the matches are stored, in CSR form.
+ * 3. Vector clocks are computed in one topological pass. A rank keeps
+ *    its current clock, a message keeps a copy until it is received,
+ *    and only the clock entries needed by the checks are saved.
+ * 4. Conflicting pairs, found as by conflict_detector, are checked
+ *    in parallel: op1 happens-before op2 if the clock of op2 has seen
+ *    op1 on its rank.
+ *
+ * Semantics (release after op1 must happen-before acquire before op2):
+ *  POSIX:   op1 itself and op2 itself
+ *  Commit:  the next fsync or close of the file by op1's rank, op2
+ *  Session: the next close of the file, the previous open of the file
+ *  MPI-IO:  the next MPI_File_sync/close, the previous MPI_File_sync/open
+ *           of the file handle, and only the collectives that synchronize
+ *           (MPI_Barrier, MPI_Allreduce, ...) count as synchronization.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+extern "C" {
+#include "../reader.h"
+}
+using namespace std;
+
+static const char* semantics_names[] = { "POSIX", "Commit", "Session", "MPI-IO" };
+
+/*
+ * The release and acquire calls of the semantics of a rank,
+ * by file name or file handle, in program order.
+ */
+typedef struct RankTrace_t {
+    unordered_map<string, vector<int>> releases, acquires;
+} RankTrace;
+
+typedef struct DecodeContext_t {
+    RecorderReader* reader;
+    int semantics;
+    vector<RankTrace>* traces;
+    RankTrace* trace;                       // of the rank being decoded
+} DecodeContext;
+
+
+static double now() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void read_sync_call(DecodeContext* ctx, const RecorderFuncDesc* desc, const Record* R, int seq) {
+    if(desc->file_arg < 0 || desc->file_arg >= R->arg_count)
+        return;
+    bool release = false, acquire = false;
+    switch(ctx->semantics) {
+        case COMMIT_SEMANTICS:
+            release = (desc->layer == RECORDER_POSIX) &&
+                      (desc->op == RECORDER_OP_SYNC || desc->op == RECORDER_OP_CLOSE);
+            break;
+        case SESSION_SEMANTICS:
+            release = (desc->layer == RECORDER_POSIX) && (desc->op == RECORDER_OP_CLOSE);
+            acquire = (desc->layer == RECORDER_POSIX) && (desc->op == RECORDER_OP_OPEN);
+            break;
+        case MPIIO_SEMANTICS:
+            release = (desc->layer == RECORDER_MPIIO) &&
+                      (desc->op == RECORDER_OP_SYNC || desc->op == RECORDER_OP_CLOSE);
+            acquire = (desc->layer == RECORDER_MPIIO) &&
+                      (desc->op == RECORDER_OP_SYNC || desc->op == RECORDER_OP_OPEN);
+            break;
+    }
+    if(release)
+        ctx->trace->releases[R->args[desc->file_arg]].push_back(seq);
+    if(acquire)
+        ctx->trace->acquires[R->args[desc->file_arg]].push_back(seq);
+}
+
+static void decode_begin_rank(int rank, void* arg) {
+    DecodeContext* ctx = (DecodeContext*) arg;
+    ctx->trace = &(*ctx->traces)[rank];
+}
+
+static void decode_record(RecordView* v, void* arg) {
+    DecodeContext* ctx = (DecodeContext*) arg;
+    const Record* R = v->tmpl;
+    read_sync_call(ctx, recorder_get_func_desc(ctx->reader, R), R, (int) v->seq_id);
+}
+
+static void decode_end_rank(int rank, void* arg) {
+}
+
+static void read_traces(RecorderReader* reader, int semantics, vector<RankTrace>& traces) {
+    int nthreads = max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+    vector<DecodeContext> contexts(nthreads);
+    vector<void*> ctxs(nthreads);
+    for(int t = 0; t < nthreads; t++) {
+        contexts[t].reader = reader;
+        contexts[t].semantics = semantics;
+        contexts[t].traces = &traces;
+        ctxs[t] = &contexts[t];
+    }
+    RecorderRankOps ops = { decode_begin_rank, decode_record, decode_end_rank };
+    recorder_decode_ranks_parallel(reader, NULL, 0, nthreads, &ops, ctxs.data());
+}
+
+
+/*
+ * Happens-before graph
+ *
+ * Nodes of rank r are [rank_begin[r], rank_begin[r+1]), in program
+ * order, followed by one ghost node per all-to-all match: its
+ * participants precede it, and it precedes what follows each of them,
+ * so all-to-all matches take n instead of n^2 edges.
+ */
+typedef struct HBGraph_t {
+    int num_ranks;
+    size_t num_nodes;
+    vector<size_t> rank_begin;
+    vector<int> seqs;           // of the rank nodes
+    vector<int> node_ranks;     // of the rank nodes
+    vector<size_t> out_begin;   // edges of node v: out_nodes[out_begin[v] .. out_begin[v+1])
+    vector<size_t> out_nodes;
+} HBGraph;
+
+static size_t find_node(const HBGraph* g, int rank, int seq) {
+    auto first = g->seqs.begin() + g->rank_begin[rank];
+    auto last = g->seqs.begin() + g->rank_begin[rank+1];
+    return lower_bound(first, last, seq) - g->seqs.begin();
+}
+
+/*
+ * seqs[r]: calls of rank r that are checked at, they become nodes
+ * together with the ends of the matches used, i.e., only the
+ * synchronizing ones if sync_only.
+ */
+static bool use_match(const MPIMatch* m, bool sync_only) {
+    return !sync_only || (m->flags & MPI_MATCH_SYNCHRONIZING);
+}
+
+static void build_graph(HBGraph* g, vector<vector<int>>& seqs, const MPIMatches* matches, bool sync_only) {
+    int num_ranks = seqs.size();
+    size_t ghosts = 0;
+    for(size_t i = 0; i < matches->num_matches; i++) {
+        const MPIMatch* m = &matches->matches[i];
+        if(!use_match(m, sync_only))
+            continue;
+        const MPIMatchNode* nodes = matches->nodes + m->begin;
+        for(int k = 0; k < m->num_heads + m->num_tails; k++)
+            seqs[nodes[k].rank].push_back(nodes[k].seq_id);
+        if(m->type == MPI_MATCH_ALL_TO_ALL)
+            ghosts++;
+    }
+
+    g->num_ranks = num_ranks;
+    g->rank_begin.assign(num_ranks+1, 0);
+    for(int rank = 0; rank < num_ranks; rank++) {
+        vector<int>& s = seqs[rank];
+        sort(s.begin(), s.end());
+        s.erase(unique(s.begin(), s.end()), s.end());
+        g->rank_begin[rank+1] = g->rank_begin[rank] + s.size();
+        g->seqs.insert(g->seqs.end(), s.begin(), s.end());
+        g->node_ranks.insert(g->node_ranks.end(), s.size(), rank);
+        vector<int>().swap(s);
+    }
+    size_t rank_nodes = g->rank_begin[num_ranks];
+    g->num_nodes = rank_nodes + ghosts;
+
+    vector<pair<size_t, size_t>> links;
+    size_t ghost = rank_nodes;
+    for(size_t i = 0; i < matches->num_matches; i++) {
+        const MPIMatch* m = &matches->matches[i];
+        if(!use_match(m, sync_only))
+            continue;
+        const MPIMatchNode* heads = matches->nodes + m->begin;
+        const MPIMatchNode* tails = heads + m->num_heads;
+        if(m->type == MPI_MATCH_ALL_TO_ALL) {
+            for(int k = 0; k < m->num_heads; k++) {
+                size_t v = find_node(g, heads[k].rank, heads[k].seq_id);
+                links.push_back(make_pair(v, ghost));
+                if(v+1 < g->rank_begin[heads[k].rank+1])
+                    links.push_back(make_pair(ghost, v+1));
+            }
+            ghost++;
+            continue;
+        }
+        // The node after a MPI_Sendrecv keeps two exchanging ranks acyclic
+        size_t after = (m->flags & MPI_MATCH_TAILS_AFTER) ? 1 : 0;
+        for(int h = 0; h < m->num_heads; h++) {
+            size_t u = find_node(g, heads[h].rank, heads[h].seq_id);
+            for(int t = 0; t < m->num_tails; t++) {
+                size_t v = find_node(g, tails[t].rank, tails[t].seq_id) + after;
+                if(v < g->rank_begin[tails[t].rank+1])
+                    links.push_back(make_pair(u, v));
+            }
+        }
+    }
+
+    g->out_begin.assign(g->num_nodes+1, 0);
+    for(const pair<size_t, size_t>& l : links)
+        g->out_begin[l.first+1]++;
+    for(size_t v = 0; v < g->num_nodes; v++)
+        g->out_begin[v+1] += g->out_begin[v];
+    g->out_nodes.resize(links.size());
+    vector<size_t> pos(g->out_begin.begin(), g->out_begin.end()-1);
+    for(const pair<size_t, size_t>& l : links)
+        g->out_nodes[pos[l.first]++] = l.second;
+}
+
+
+/*
+ * The clock entries to keep: entry ranks[i] of the clock of node v,
+ * for i in [begin[v], begin[v+1]), is saved in values[i]. Entry r of
+ * a clock is the last seq id of rank r that happens-before the node
+ * (or is the node), -1 if none.
+ */
+typedef struct ClockQuery_t {
+    int rank, seq;              // node
+    int of_rank;                // clock entry
+    bool operator<(const ClockQuery_t& o) const {
+        if(rank != o.rank) return rank < o.rank;
+        if(seq != o.seq) return seq < o.seq;
+        return of_rank < o.of_rank;
+    }
+    bool operator==(const ClockQuery_t& o) const {
+        return rank == o.rank && seq == o.seq && of_rank == o.of_rank;
+    }
+} ClockQuery;
+
+typedef struct ClockEntries_t {
+    vector<size_t> begin;
+    vector<int> ranks;
+    vector<int> values;
+} ClockEntries;
+
+// queries are sorted, so in node order
+static void build_clock_entries(const HBGraph* g, const vector<ClockQuery>& queries, ClockEntries* ce) {
+    size_t rank_nodes = g->rank_begin[g->num_ranks];
+    ce->begin.assign(rank_nodes+1, 0);
+    ce->ranks.resize(queries.size());
+    ce->values.assign(queries.size(), -1);
+    for(size_t i = 0; i < queries.size(); i++) {
+        size_t v = find_node(g, queries[i].rank, queries[i].seq);
+        ce->begin[v+1]++;
+        ce->ranks[i] = queries[i].of_rank;
+    }
+    for(size_t v = 0; v < rank_nodes; v++)
+        ce->begin[v+1] += ce->begin[v];
+}
+
+static int clock_entry(const ClockEntries* ce, size_t v, int rank) {
+    auto first = ce->ranks.begin() + ce->begin[v];
+    auto last = ce->ranks.begin() + ce->begin[v+1];
+    auto it = lower_bound(first, last, rank);
+    return (it != last && *it == rank) ? ce->values[it - ce->ranks.begin()] : -1;
+}
+
+/*
+ * Vector clocks in one topological pass. A rank advances while its
+ * next node has received all its messages (clocks of predecessors on
+ * other ranks). A message is merged into the receiver's clock and
+ * dropped, so memory is one clock per rank plus the messages in
+ * flight, not one per node.
+ *
+ * A cycle means inconsistent matches, it is broken by letting a
+ * blocked rank go on without the missing messages.
+ */
+static size_t run_vector_clocks(const HBGraph* g, ClockEntries* ce) {
+    int num_ranks = g->num_ranks;
+    size_t rank_nodes = g->rank_begin[num_ranks];
+
+    vector<int> pending(g->num_nodes, 0);
+    for(size_t w : g->out_nodes)
+        pending[w]++;
+    vector<size_t> next(g->rank_begin.begin(), g->rank_begin.end()-1);
+    vector<vector<int>> clocks(num_ranks, vector<int>(num_ranks, -1));
+    unordered_map<size_t, vector<int>> inbox;
+    vector<int> ready;
+    vector<size_t> ghosts;
+    for(int rank = num_ranks-1; rank >= 0; rank--)
+        ready.push_back(rank);
+
+    auto deliver = [&](const vector<int>& clock, size_t w) {
+        if(w < rank_nodes && w < next[g->node_ranks[w]])   // went on without it
+            return;
+        auto it = inbox.find(w);
+        if(it == inbox.end())
+            inbox.insert(make_pair(w, clock));
+        else
+            for(int r = 0; r < num_ranks; r++)
+                it->second[r] = max(it->second[r], clock[r]);
+        if(--pending[w] == 0) {
+            if(w >= rank_nodes)
+                ghosts.push_back(w);
+            else if(w == next[g->node_ranks[w]])
+                ready.push_back(g->node_ranks[w]);
+        }
+    };
+
+    size_t forced = 0;
+    while(true) {
+        while(!ready.empty() || !ghosts.empty()) {
+            if(!ghosts.empty()) {
+                size_t v = ghosts.back();
+                ghosts.pop_back();
+                vector<int> clock = move(inbox[v]);
+                inbox.erase(v);
+                for(size_t e = g->out_begin[v]; e < g->out_begin[v+1]; e++)
+                    deliver(clock, g->out_nodes[e]);
+                continue;
+            }
+
+            int rank = ready.back();
+            ready.pop_back();
+            vector<int>& clock = clocks[rank];
+            while(next[rank] < g->rank_begin[rank+1] && pending[next[rank]] == 0) {
+                size_t v = next[rank]++;
+                auto it = inbox.find(v);
+                if(it != inbox.end()) {
+                    for(int r = 0; r < num_ranks; r++)
+                        clock[r] = max(clock[r], it->second[r]);
+                    inbox.erase(it);
+                }
+                clock[rank] = g->seqs[v];
+                for(size_t i = ce->begin[v]; i < ce->begin[v+1]; i++)
+                    ce->values[i] = clock[ce->ranks[i]];
+                for(size_t e = g->out_begin[v]; e < g->out_begin[v+1]; e++)
+                    deliver(clock, g->out_nodes[e]);
+            }
+        }
+
+        int blocked = -1;
+        for(int rank = 0; rank < num_ranks && blocked < 0; rank++)
+            if(next[rank] < g->rank_begin[rank+1])
+                blocked = rank;
+        if(blocked < 0)
+            break;
+        pending[next[blocked]] = 0;
+        ready.push_back(blocked);
+        forced++;
+    }
+    return forced;
+}
+
+
+typedef struct ActiveInterval_t {
+    size_t end;
+    size_t index;
+} ActiveInterval;
+
+/*
+ * Where the sweep over the intervals of a file can be resumed:
+ * the active intervals, in heap order, before interval begin
+ * and how many pairs were visited before it.
+ */
+typedef struct SweepPoint_t {
+    size_t begin;
+    size_t first_pair;
+    vector<ActiveInterval> active;
+} SweepPoint;
+
+/*
+ * Conflicting pairs of a file, and the calls they are checked at.
+ * Pairs are not stored: they are visited once to find the queries,
+ * and again from the sweep points when they are checked.
+ */
+typedef struct FileChecks_t {
+    size_t pairs;
+    vector<int> release, acquire;               // per interval, seq id, -1 if none
+    vector<ClockQuery> queries;
+    vector<SweepPoint> points;
+    size_t unsynchronized;
+    size_t example[2];                          // first pair not properly synchronized
+} FileChecks;
+
+static bool ends_later(const ActiveInterval& a, const ActiveInterval& b) {
+    return a.end > b.end;
+}
+
+static bool compare_by_offset(const Interval& lhs, const Interval& rhs) {
+    if(lhs.offset != rhs.offset)
+        return lhs.offset < rhs.offset;
+    if(lhs.rank != rhs.rank)
+        return lhs.rank < rhs.rank;
+    return lhs.seqId < rhs.seqId;
+}
+
+static bool is_conflict(const Interval* i1, const Interval* i2) {
+    if(i1->rank == i2->rank)
+        return false;
+    if(i1->isRead && i2->isRead)
+        return false;
+    if(i1->offset+i1->count <= i2->offset)
+        return false;
+    if(i2->offset+i2->count <= i1->offset)
+        return false;
+    return true;
+}
+
+// first seq id in seqs after seq, or the last one before, -1 if none
+static int next_seq(const unordered_map<string, vector<int>>& lists, const char* key, int seq) {
+    auto it = lists.find(key);
+    if(it == lists.end())
+        return -1;
+    auto s = upper_bound(it->second.begin(), it->second.end(), seq);
+    return s == it->second.end() ? -1 : *s;
+}
+
+static int prev_seq(const unordered_map<string, vector<int>>& lists, const char* key, int seq) {
+    auto it = lists.find(key);
+    if(it == lists.end())
+        return -1;
+    auto s = lower_bound(it->second.begin(), it->second.end(), seq);
+    return s == it->second.begin() ? -1 : *(s-1);
+}
+
+/*
+ * One step of the sweep over the intervals sorted by start offset, as
+ * conflict_detector does: visit(a, i) for every interval a before i
+ * that conflicts with it.
+ */
+template<typename Visit>
+static void sweep_interval(const Interval* intervals, size_t i,
+                           vector<ActiveInterval>& active, Visit visit) {
+    const Interval* cur = &intervals[i];
+    if(cur->count == 0)
+        return;
+    while(!active.empty() && active.front().end <= cur->offset) {
+        pop_heap(active.begin(), active.end(), ends_later);
+        active.pop_back();
+    }
+    for(const ActiveInterval& a : active)
+        if(is_conflict(&intervals[a.index], cur))
+            visit(a.index, i);
+    active.push_back({ cur->offset + cur->count, i });
+    push_heap(active.begin(), active.end(), ends_later);
+}
+
+/*
+ * Find where each access is released and acquired, then visit every
+ * conflicting pair for the clock entries its check needs. Sweep points
+ * are saved about every chunk pairs, and not more often than every
+ * 1024 pairs per active interval so that they take less memory than
+ * the pairs would.
+ */
+static void find_file_checks(IntervalsMap* im, const vector<RankTrace>& traces,
+                             int semantics, size_t chunk, FileChecks* fc) {
+    Interval* intervals = im->intervals;
+    size_t n = im->num_intervals;
+    sort(intervals, intervals + n, compare_by_offset);
+
+    fc->pairs = 0;
+    fc->release.resize(n);
+    fc->acquire.resize(n);
+    for(size_t i = 0; i < n; i++) {
+        const Interval* I = &intervals[i];
+        const RankTrace& t = traces[I->rank];
+        const char* key = (semantics == MPIIO_SEMANTICS) ? I->mpifh : im->filename;
+        switch(semantics) {
+            case POSIX_SEMANTICS:
+                fc->release[i] = fc->acquire[i] = I->seqId;
+                break;
+            case COMMIT_SEMANTICS:
+                fc->release[i] = next_seq(t.releases, key, I->seqId);
+                fc->acquire[i] = I->seqId;
+                break;
+            default:
+                fc->release[i] = next_seq(t.releases, key, I->seqId);
+                fc->acquire[i] = prev_seq(t.acquires, key, I->seqId);
+                break;
+        }
+    }
+
+    size_t unique_queries = 0;
+    auto dedup = [&]() {
+        sort(fc->queries.begin(), fc->queries.end());
+        fc->queries.erase(unique(fc->queries.begin(), fc->queries.end()), fc->queries.end());
+        unique_queries = fc->queries.size();
+    };
+    auto visit = [&](size_t i, size_t j) {
+        const Interval* a = &intervals[i];
+        const Interval* b = &intervals[j];
+        if(fc->release[i] >= 0 && fc->acquire[j] >= 0)
+            fc->queries.push_back({ b->rank, fc->acquire[j], a->rank });
+        if(fc->release[j] >= 0 && fc->acquire[i] >= 0)
+            fc->queries.push_back({ a->rank, fc->acquire[i], b->rank });
+        if(fc->queries.size() >= 2*unique_queries + chunk)
+            dedup();
+        fc->pairs++;
+    };
+
+    vector<ActiveInterval> active;
+    size_t last_point = 0;
+    fc->points.push_back({ 0, 0, active });
+    for(size_t i = 0; i < n; i++) {
+        if(fc->pairs - last_point >= max(chunk, 1024*active.size())) {
+            fc->points.push_back({ i, fc->pairs, active });
+            last_point = fc->pairs;
+        }
+        sweep_interval(intervals, i, active, visit);
+    }
+    dedup();
+
+    if(fc->pairs == 0) {
+        vector<SweepPoint>().swap(fc->points);
+        vector<int>().swap(fc->release);
+        vector<int>().swap(fc->acquire);
+    }
+}
+
+// a is released before b is acquired
+static bool happens_before(const HBGraph* g, const ClockEntries* ce,
+                           const Interval* a, int release, const Interval* b, int acquire) {
+    if(release < 0 || acquire < 0)
+        return false;
+    size_t v = find_node(g, b->rank, acquire);
+    return clock_entry(ce, v, a->rank) >= release;
+}
+
+static void print_node(const Interval* I) {
+    printf("Rank %d: %dth %s(%s)", I->rank, I->seqId, I->isRead ? "read" : "write", I->mpifh);
+}
+
+
+int main(int argc, char* argv[]) {
+    int semantics = MPIIO_SEMANTICS;
+    const char* traces_dir = NULL;
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--semantics=", 12) == 0) {
+            semantics = -1;
+            for(int s = 0; s < 4; s++)
+                if(strcasecmp(argv[i]+12, semantics_names[s]) == 0)
+                    semantics = s;
+        } else if(argv[i][0] != '-' && traces_dir == NULL) {
+            traces_dir = argv[i];
+        } else {
+            semantics = -1;
+        }
+    }
+    if(traces_dir == NULL || semantics < 0) {
+        fprintf(stderr, "usage: %s /path/to/traces [--semantics=POSIX|MPI-IO|Commit|Session]\n", argv[0]);
+        return 1;
+    }
+
+    RecorderReader reader;
+    recorder_init_reader(traces_dir, &reader);
+    int num_ranks = reader.metadata.total_ranks;
+    int nthreads = max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+
+    double t1 = now();
+    MPIMatches* matches = match_mpi_calls(&reader);
+    if(matches->unmatched_sends || matches->unmatched_recvs)
+        fprintf(stderr, "warning: %zu unmatched sends, %zu unmatched receives\n",
+                matches->unmatched_sends, matches->unmatched_recvs);
+    if(matches->mismatched_colls)
+        fprintf(stderr, "warning: %zu collective calls matched with another function\n",
+                matches->mismatched_colls);
+    double t2 = now();
+    printf("match mpi calls: %.3f secs, mpi edges: %zu\n", t2-t1, matches->num_matches);
+
+    vector<RankTrace> traces(num_ranks);
+    if(semantics != POSIX_SEMANTICS)
+        read_traces(&reader, semantics, traces);
+
+    // Conflicting pairs, files are independent
+    t1 = now();
+    const size_t chunk = 1 << 20;
+    int num_files;
+    IntervalsMap* IM = build_offset_intervals(&reader, &num_files);
+    vector<FileChecks> checks(num_files);
+    {
+        atomic<int> next(0);
+        auto worker = [&]() {
+            int i;
+            while((i = next.fetch_add(1)) < num_files)
+                find_file_checks(&IM[i], traces, semantics, chunk, &checks[i]);
+        };
+        vector<thread> threads;
+        for(int t = 1; t < min(nthreads, num_files); t++)
+            threads.emplace_back(worker);
+        worker();
+        for(thread& t : threads)
+            t.join();
+    }
+
+    vector<ClockQuery> queries;
+    for(FileChecks& fc : checks) {
+        queries.insert(queries.end(), fc.queries.begin(), fc.queries.end());
+        vector<ClockQuery>().swap(fc.queries);
+    }
+    sort(queries.begin(), queries.end());
+    queries.erase(unique(queries.begin(), queries.end()), queries.end());
+
+    vector<vector<int>> seqs(num_ranks);
+    for(const ClockQuery& q : queries)
+        seqs[q.rank].push_back(q.seq);
+    vector<RankTrace>().swap(traces);
+
+    HBGraph G;
+    build_graph(&G, seqs, matches, semantics == MPIIO_SEMANTICS);
+    free_mpi_matches(matches);
+    ClockEntries CE;
+    build_clock_entries(&G, queries, &CE);
+    vector<ClockQuery>().swap(queries);
+    size_t forced = run_vector_clocks(&G, &CE);
+    if(forced)
+        fprintf(stderr, "warning: the matches form a cycle, %zu calls went on without a match\n", forced);
+    t2 = now();
+    printf("build happens-before graph: %.3f secs, nodes: %zu\n", t2-t1, G.num_nodes);
+
+    // Check all pairs in parallel, resuming the sweep of a file at each of its points
+    t1 = now();
+    typedef struct CheckTask_t {
+        int file;
+        size_t point;
+        size_t unsynchronized;
+        size_t example[2];              // first pair of the task not properly synchronized
+    } CheckTask;
+    vector<CheckTask> tasks;
+    for(int i = 0; i < num_files; i++)
+        for(size_t p = 0; p < checks[i].points.size(); p++)
+            tasks.push_back({ i, p, 0, { 0, 0 } });
+    {
+        atomic<size_t> next(0);
+        auto worker = [&]() {
+            size_t c;
+            while((c = next.fetch_add(1)) < tasks.size()) {
+                CheckTask* task = &tasks[c];
+                FileChecks* fc = &checks[task->file];
+                const Interval* intervals = IM[task->file].intervals;
+                SweepPoint* point = &fc->points[task->point];
+                size_t end = (task->point+1 < fc->points.size()) ?
+                             fc->points[task->point+1].begin : IM[task->file].num_intervals;
+                vector<ActiveInterval> active = move(point->active);
+                auto check = [&](size_t i, size_t j) {
+                    if(happens_before(&G, &CE, &intervals[i], fc->release[i], &intervals[j], fc->acquire[j]) ||
+                       happens_before(&G, &CE, &intervals[j], fc->release[j], &intervals[i], fc->acquire[i]))
+                        return;
+                    if(task->unsynchronized++ == 0) {
+                        task->example[0] = i;
+                        task->example[1] = j;
+                    }
+                };
+                for(size_t i = point->begin; i < end; i++)
+                    sweep_interval(intervals, i, active, check);
+            }
+        };
+        vector<thread> threads;
+        for(int t = 1; t < nthreads; t++)
+            threads.emplace_back(worker);
+        worker();
+        for(thread& t : threads)
+            t.join();
+    }
+
+    // Tasks are in the order of the pairs
+    for(int i = 0; i < num_files; i++)
+        checks[i].unsynchronized = 0;
+    for(const CheckTask& task : tasks) {
+        FileChecks* fc = &checks[task.file];
+        if(fc->unsynchronized == 0 && task.unsynchronized) {
+            fc->example[0] = task.example[0];
+            fc->example[1] = task.example[1];
+        }
+        fc->unsynchronized += task.unsynchronized;
+    }
+
+    size_t total_pairs = 0, total_unsynchronized = 0;
+    for(int i = 0; i < num_files; i++) {
+        FileChecks* fc = &checks[i];
+        total_pairs += fc->pairs;
+        total_unsynchronized += fc->unsynchronized;
+        if(fc->pairs == 0)
+            continue;
+        printf("%s: %zu conflicting pairs, %zu not properly synchronized\n",
+               IM[i].filename, fc->pairs, fc->unsynchronized);
+        if(fc->unsynchronized) {
+            printf("    e.g., ");
+            print_node(&IM[i].intervals[fc->example[0]]);
+            printf(" <--> ");
+            print_node(&IM[i].intervals[fc->example[1]]);
+            printf("\n");
+        }
+    }
+    t2 = now();
+
+    printf("\n%zu conflicting pairs, %zu not properly synchronized\n", total_pairs, total_unsynchronized);
+    if(total_unsynchronized == 0)
+        printf("Properly synchronized under %s semantics\n", semantics_names[semantics]);
+    else
+        printf("Not properly synchronized under %s semantics\n", semantics_names[semantics]);
+    printf("verify time: %.3f secs\n", t2-t1);
+
+    for(int i = 0; i < num_files; i++) {
+        free(IM[i].filename);
+        free(IM[i].intervals);
+    }
+    free(IM);
+    recorder_free_reader(&reader);
+    return 0;
+}